@@ -0,0 +1,528 @@
+// getline and open_memstream are POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
+
+#include "batch.h"
+#include "vm.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void *allocate(size_t size) {
+    void *memory = malloc(size);
+    if (memory == NULL) {
+        fprintf(stderr, "Could not allocate memory for the records\n");
+        exit(EXIT_FAILURE);
+    }
+    return memory;
+}
+
+static void append_output(batch_record *record, int value) {
+    if (record->output_size == record->output_capacity) {
+        int capacity = record->output_capacity > 0 ?
+            record->output_capacity * 2 : 16;
+        int *output = (int *)realloc(record->output, sizeof(int) * capacity);
+        if (output == NULL) {
+            fprintf(stderr, "Could not allocate memory for the records\n");
+            exit(EXIT_FAILURE);
+        }
+        record->output = output;
+        record->output_capacity = capacity;
+    }
+    record->output[(record->output_size)++] = value;
+}
+
+// Set up the scalar interpreter at the start of the program
+static void start_scalar(vm_t *vm, code_generator_t *generator) {
+    init_vm(vm);
+    load_program(vm, generator, SUPER_NONE);
+}
+
+// Run a record on the scalar interpreter until the program halts, from
+// wherever the machine is, with the record's input from a cursor on
+static void finish_on_scalar(vm_t *vm, batch_record *record,
+    int input_cursor, batch_stats *stats) {
+    char *bytes = NULL;
+    size_t size = 0;
+
+    FILE *output = open_memstream(&bytes, &size);
+    if (output == NULL) {
+        fprintf(stderr, "Could not open the output of a record\n");
+        exit(EXIT_FAILURE);
+    }
+    set_vm_io(vm, NULL, output, IO_BINARY);
+    queue_input(vm, &(record->input[input_cursor]),
+        record->input_size - input_cursor);
+    close_input(vm);
+
+    long instructions = vm->instructions;
+    // The input is closed, so the machine never waits
+    while (run_vm_budget(vm, LONG_MAX) != VM_HALTED);
+    free_vm(vm);
+    fclose(output);
+
+    for (size_t b = 0; b + sizeof(int) <= size; b += sizeof(int)) {
+        int value;
+        memcpy(&value, &bytes[b], sizeof(int));
+        append_output(record, value);
+    }
+    free(bytes);
+    record->error = vm->error;
+    (stats->scalar_records)++;
+    stats->scalar_instructions += vm->instructions - instructions;
+}
+
+#ifdef __GNUC__
+
+typedef int32_t lanes_t
+    __attribute__((vector_size(sizeof(int32_t) * BATCH_LANES)));
+// Arithmetic wraps around on unsigned lanes instead of overflowing
+typedef uint32_t unsigned_lanes_t
+    __attribute__((vector_size(sizeof(uint32_t) * BATCH_LANES)));
+
+typedef struct batch_machine {
+    lanes_t registers[NUM_REGISTERS];
+    lanes_t stack[MAX_STACK_HEIGHT];
+    int pc[BATCH_LANES];            // Of every lane, while lanes are apart
+    int sp[BATCH_LANES];
+    int input_cursor[BATCH_LANES];  // Next value of the record to read
+    batch_record *records[BATCH_LANES];
+    unsigned int running;           // Lanes still running, one bit each
+} batch_machine;
+
+// All ones in the lanes whose bit is set, zeros in the others
+static lanes_t lane_mask(unsigned int lanes) {
+    lanes_t mask;
+    for (int lane = 0; lane < BATCH_LANES; lane++) {
+        mask[lane] = (lanes >> lane) & 1 ? -1 : 0;
+    }
+    return mask;
+}
+
+// Bits of the lanes a comparison holds in
+static unsigned int lane_bits(lanes_t condition) {
+    unsigned int bits = 0;
+    for (int lane = 0; lane < BATCH_LANES; lane++) {
+        if (condition[lane] != 0) bits |= 1u << lane;
+    }
+    return bits;
+}
+
+// Write a vector, leaving lanes outside of the mask alone while apart
+static inline void assign(lanes_t *target, lanes_t value, lanes_t mask,
+    bool converged) {
+    *target = converged ? value : (value & mask) | (*target & ~mask);
+}
+
+static void halt_lane(batch_machine *machine, int lane, char *error) {
+    machine->records[lane]->error = error;
+    machine->running &= ~(1u << lane);
+}
+
+// Start the program on up to BATCH_LANES records, with the lanes past them
+// left idle
+static void start_lanes(batch_machine *machine, batch_record *records,
+    int count, int max_stack) {
+    memset(machine->registers, 0, sizeof(machine->registers));
+    // Verified programs never address beyond the stack INC reserved
+    memset(machine->stack, 0, sizeof(lanes_t) * (max_stack + 1));
+    for (int lane = 0; lane < BATCH_LANES; lane++) {
+        machine->pc[lane] = 0;
+        machine->sp[lane] = 0;
+        machine->input_cursor[lane] = 0;
+        machine->records[lane] = lane < count ? &records[lane] : NULL;
+    }
+    machine->running = count == BATCH_LANES ? ~0u >> (32 - BATCH_LANES) :
+        (1u << count) - 1;
+}
+
+// Take a running lane out of lockstep and finish it on the scalar
+// interpreter, with its registers and stack as they are
+static void finish_lane(batch_machine *machine, int lane, vm_t *vm,
+    code_generator_t *generator, int max_stack, batch_stats *stats) {
+    start_scalar(vm, generator);
+    for (int a = 0; a <= max_stack; a++) {
+        vm->stack[a] = machine->stack[a][lane];
+    }
+    for (int r = 0; r < NUM_REGISTERS; r++) {
+        vm->registers[r] = machine->registers[r][lane];
+    }
+    vm->pc = machine->pc[lane];
+    vm->sp = machine->sp[lane];
+
+    finish_on_scalar(vm, machine->records[lane],
+        machine->input_cursor[lane], stats);
+    machine->running &= ~(1u << lane);
+}
+
+// Keep the largest group of lanes at the same instruction in lockstep and
+// finish the others on the scalar interpreter, returns the group's pc
+static int split_off(batch_machine *machine, vm_t *vm,
+    code_generator_t *generator, int max_stack, batch_stats *stats) {
+    int kept = -1, most = 0;
+
+    for (int lane = 0; lane < BATCH_LANES; lane++) {
+        if (!((machine->running >> lane) & 1)) continue;
+
+        int count = 0;
+        for (int other = 0; other < BATCH_LANES; other++) {
+            if (((machine->running >> other) & 1) &&
+                machine->pc[other] == machine->pc[lane]) count++;
+        }
+        if (count > most) {
+            most = count;
+            kept = machine->pc[lane];
+        }
+    }
+
+    for (int lane = 0; lane < BATCH_LANES; lane++) {
+        if (((machine->running >> lane) & 1) && machine->pc[lane] != kept) {
+            finish_lane(machine, lane, vm, generator, max_stack, stats);
+        }
+    }
+    return kept;
+}
+
+// Run the program on the lanes until every one of them halted. Verified
+// programs only address their one frame at bp 1, so the address of a LOD or
+// STO is the same in every lane.
+static void run_lanes(batch_machine *machine, code_generator_t *generator,
+    vm_t *vm, int max_stack, batch_stats *stats) {
+    cg_instruction *code = generator->code;
+    lanes_t *r = machine->registers;
+    int pc = 0;                 // Of every running lane while converged
+    bool converged = true;
+    long apart = 0;             // Steps since the lanes were last converged
+
+    while (machine->running != 0) {
+        unsigned int lanes = machine->running;
+        lanes_t mask = { 0 };
+
+        // Apart, the lanes furthest behind run, so lanes that took the
+        // shorter way around a branch wait for the others at its end
+        if (!converged) {
+            pc = INT_MAX;
+            for (int lane = 0; lane < BATCH_LANES; lane++) {
+                if (((machine->running >> lane) & 1) &&
+                    machine->pc[lane] < pc) pc = machine->pc[lane];
+            }
+            lanes = 0;
+            for (int lane = 0; lane < BATCH_LANES; lane++) {
+                if (((machine->running >> lane) & 1) &&
+                    machine->pc[lane] == pc) lanes |= 1u << lane;
+            }
+
+            if (lanes == machine->running) {
+                converged = true;
+                apart = 0;
+            } else if (++apart > BATCH_DIVERGENCE_LIMIT) {
+                pc = split_off(machine, vm, generator, max_stack, stats);
+                converged = true;
+                apart = 0;
+                continue;
+            } else {
+                mask = lane_mask(lanes);
+            }
+        }
+
+        cg_instruction *i = &code[pc];
+        int next = pc + 1;
+        (stats->steps)++;
+        stats->lane_instructions += __builtin_popcount(lanes);
+
+        switch (i->op) {
+            case LIT:
+                assign(&r[i->regiser_num], (lanes_t){ 0 } + i->modifier,
+                    mask, converged);
+                break;
+            case LOD:
+                assign(&r[i->regiser_num], machine->stack[1 + i->modifier],
+                    mask, converged);
+                break;
+            case STO:
+                assign(&(machine->stack[1 + i->modifier]), r[i->regiser_num],
+                    mask, converged);
+                break;
+            case INC:
+                for (int lane = 0; lane < BATCH_LANES; lane++) {
+                    if ((lanes >> lane) & 1) machine->sp[lane] += i->modifier;
+                }
+                break;
+            case JMP:
+                next = i->modifier;
+                break;
+            case JPC: {
+                unsigned int taken = lane_bits(r[i->regiser_num] == 0) & lanes;
+                if (taken == lanes) {
+                    next = i->modifier;
+                } else if (taken != 0) {
+                    // The lanes go separate ways
+                    for (int lane = 0; converged && lane < BATCH_LANES;
+                        lane++) {
+                        machine->pc[lane] = pc;
+                    }
+                    for (int lane = 0; lane < BATCH_LANES; lane++) {
+                        if ((lanes >> lane) & 1) {
+                            machine->pc[lane] = (taken >> lane) & 1 ?
+                                i->modifier : pc + 1;
+                        }
+                    }
+                    converged = false;
+                    continue;
+                }
+                break;
+            }
+            case SIO_WRITE:
+                for (int lane = 0; lane < BATCH_LANES; lane++) {
+                    if ((lanes >> lane) & 1) {
+                        append_output(machine->records[lane],
+                            r[i->regiser_num][lane]);
+                    }
+                }
+                break;
+            case SIO_READ:
+                for (int lane = 0; lane < BATCH_LANES; lane++) {
+                    if (!((lanes >> lane) & 1)) continue;
+
+                    batch_record *record = machine->records[lane];
+                    if (machine->input_cursor[lane] == record->input_size) {
+                        halt_lane(machine, lane,
+                            "Expected an integer on input.");
+                    } else {
+                        r[i->regiser_num][lane] =
+                            record->input[(machine->input_cursor[lane])++];
+                    }
+                }
+                break;
+            case SIO_END:
+                machine->running &= ~lanes;
+                break;
+            case NEG:
+                assign(&r[i->regiser_num],
+                    (lanes_t)(0u - (unsigned_lanes_t)r[i->regiser_num]),
+                    mask, converged);
+                break;
+            case ADD:
+                assign(&r[i->regiser_num],
+                    (lanes_t)((unsigned_lanes_t)r[i->lex_level] +
+                    (unsigned_lanes_t)r[i->modifier]), mask, converged);
+                break;
+            case SUB:
+                assign(&r[i->regiser_num],
+                    (lanes_t)((unsigned_lanes_t)r[i->lex_level] -
+                    (unsigned_lanes_t)r[i->modifier]), mask, converged);
+                break;
+            case MUL:
+                assign(&r[i->regiser_num],
+                    (lanes_t)((unsigned_lanes_t)r[i->lex_level] *
+                    (unsigned_lanes_t)r[i->modifier]), mask, converged);
+                break;
+            case DIV:
+            case MOD:
+                // No vector unit divides integers, and every lane has its
+                // own divisor to check
+                for (int lane = 0; lane < BATCH_LANES; lane++) {
+                    if (!((lanes >> lane) & 1)) continue;
+
+                    int divisor = r[i->modifier][lane];
+                    if (divisor == 0) {
+                        halt_lane(machine, lane, "Division by zero.");
+                    } else if (divisor == -1) {
+                        // Negate like the machine, INT_MIN / -1 wraps
+                        r[i->regiser_num][lane] = i->op == DIV ?
+                            (int)(0u - (unsigned int)r[i->lex_level][lane]) : 0;
+                    } else if (i->op == DIV) {
+                        r[i->regiser_num][lane] =
+                            r[i->lex_level][lane] / divisor;
+                    } else {
+                        r[i->regiser_num][lane] =
+                            r[i->lex_level][lane] % divisor;
+                    }
+                }
+                break;
+            case ODD: {
+                // The remainder takes the sign of the dividend, like % 2
+                lanes_t value = r[i->regiser_num];
+                lanes_t sign = value >> 31;
+                assign(&r[i->regiser_num], ((value & 1) ^ sign) - sign,
+                    mask, converged);
+                break;
+            }
+            case EQL:
+                assign(&r[i->regiser_num],
+                    (r[i->lex_level] == r[i->modifier]) & 1, mask, converged);
+                break;
+            case NEQ:
+                assign(&r[i->regiser_num],
+                    (r[i->lex_level] != r[i->modifier]) & 1, mask, converged);
+                break;
+            case LSS:
+                assign(&r[i->regiser_num],
+                    (r[i->lex_level] < r[i->modifier]) & 1, mask, converged);
+                break;
+            case LEQ:
+                assign(&r[i->regiser_num],
+                    (r[i->lex_level] <= r[i->modifier]) & 1, mask, converged);
+                break;
+            case GTR:
+                assign(&r[i->regiser_num],
+                    (r[i->lex_level] > r[i->modifier]) & 1, mask, converged);
+                break;
+            case GEQ:
+                assign(&r[i->regiser_num],
+                    (r[i->lex_level] >= r[i->modifier]) & 1, mask, converged);
+                break;
+            case SHL:
+                assign(&r[i->regiser_num],
+                    (lanes_t)((unsigned_lanes_t)r[i->lex_level] <<
+                    i->modifier), mask, converged);
+                break;
+            case SHR:
+                assign(&r[i->regiser_num], r[i->lex_level] >> i->modifier,
+                    mask, converged);
+                break;
+            case MULH:
+                for (int lane = 0; lane < BATCH_LANES; lane++) {
+                    if ((lanes >> lane) & 1) {
+                        r[i->regiser_num][lane] =
+                            (int)(((long long)r[i->lex_level][lane] *
+                            r[i->modifier][lane]) >> 32);
+                    }
+                }
+                break;
+            default:
+                // Verified programs hold no calls, nor anything else
+                for (int lane = 0; lane < BATCH_LANES; lane++) {
+                    if ((lanes >> lane) & 1) {
+                        halt_lane(machine, lane, "Invalid opcode.");
+                    }
+                }
+        }
+
+        if (converged) {
+            pc = next;
+        } else {
+            for (int lane = 0; lane < BATCH_LANES; lane++) {
+                if ((lanes >> lane) & 1) machine->pc[lane] = next;
+            }
+        }
+    }
+}
+
+#endif /* __GNUC__ */
+
+void run_batch(code_generator_t *generator, batch_record *records,
+    int num_records, batch_stats *stats) {
+    static vm_t vm;
+
+#ifdef __GNUC__
+    static batch_machine machine;
+    verification_t verification;
+
+    if (verify_program(&verification, generator)) {
+        for (int first = 0; first < num_records; first += BATCH_LANES) {
+            int count = num_records - first < BATCH_LANES ?
+                num_records - first : BATCH_LANES;
+            start_lanes(&machine, &records[first], count,
+                verification.max_stack);
+            run_lanes(&machine, generator, &vm, verification.max_stack,
+                stats);
+        }
+        return;
+    }
+#endif
+
+    // Without lockstep, records run one after another
+    for (int k = 0; k < num_records; k++) {
+        start_scalar(&vm, generator);
+        finish_on_scalar(&vm, &records[k], 0, stats);
+    }
+}
+
+// Parse the integers of a line into a record
+static void parse_record(char *line, int number, batch_record *record) {
+    int capacity = 0;
+
+    record->input = NULL;
+    record->input_size = 0;
+    record->output = NULL;
+    record->output_size = 0;
+    record->output_capacity = 0;
+    record->error = NULL;
+
+    char *c = line;
+    while (true) {
+        while (*c == ' ' || *c == '\t' || *c == '\r' || *c == '\n') c++;
+        if (*c == '\0') break;
+
+        char *end;
+        errno = 0;
+        long value = strtol(c, &end, 10);
+        if (end == c || errno == ERANGE || value < INT_MIN ||
+            value > INT_MAX) {
+            fprintf(stderr, "ERROR: Record %d: expected an integer\n",
+                number);
+            exit(EXIT_FAILURE);
+        }
+        c = end;
+
+        if (record->input_size == capacity) {
+            capacity = capacity > 0 ? capacity * 2 : 16;
+            record->input = (int *)realloc(record->input,
+                sizeof(int) * capacity);
+            if (record->input == NULL) {
+                fprintf(stderr, "Could not allocate memory for the records\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        record->input[(record->input_size)++] = (int)value;
+    }
+}
+
+batch_record *read_batch_records(FILE *in, int *num_records) {
+    int capacity = 64;
+    batch_record *records = (batch_record *)allocate(
+        sizeof(batch_record) * capacity);
+    char *line = NULL;
+    size_t size = 0;
+
+    *num_records = 0;
+    while (getline(&line, &size, in) != -1) {
+        if (*num_records == capacity) {
+            capacity *= 2;
+            records = (batch_record *)realloc(records,
+                sizeof(batch_record) * capacity);
+            if (records == NULL) {
+                fprintf(stderr, "Could not allocate memory for the records\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        parse_record(line, *num_records + 1, &records[*num_records]);
+        (*num_records)++;
+    }
+    free(line);
+    return records;
+}
+
+void print_batch_records(batch_record *records, int num_records, FILE *out) {
+    for (int k = 0; k < num_records; k++) {
+        for (int v = 0; v < records[k].output_size; v++) {
+            fprintf(out, v > 0 ? " %d" : "%d", records[k].output[v]);
+        }
+        fputc('\n', out);
+        if (records[k].error != NULL) {
+            fprintf(stderr, "Record %d: VM Error: %s\n", k + 1,
+                records[k].error);
+        }
+    }
+}
+
+void free_batch_records(batch_record *records, int num_records) {
+    for (int k = 0; k < num_records; k++) {
+        free(records[k].input);
+        free(records[k].output);
+    }
+    free(records);
+}
@@ -0,0 +1,115 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+/**
+ * @file batch.h
+ * @brief Runs one program over many independent input records in lockstep
+ *
+ * Records are run BATCH_LANES at a time, one per lane. Every register and
+ * stack slot of the machine holds a vector with a value for each lane, so a
+ * single arithmetic instruction computes the results of all lanes at once.
+ * Vectors use the GNU C vector extensions, which the compiler maps onto
+ * SSE, AVX2 or AVX-512 registers, whichever the target has.
+ *
+ * As long as every lane is at the same instruction, the lanes run as one.
+ * A JPC whose condition differs between lanes splits them. The lanes at
+ * the lowest program counter then run, masked, until they catch up with
+ * the others, so lanes taking different sides of an if statement or
+ * running a loop a different number of times join again after it. Lanes
+ * that stay apart for more than BATCH_DIVERGENCE_LIMIT instructions are
+ * taken out: all but the largest group of lanes at the same instruction
+ * finish on the scalar interpreter, from where they are.
+ *
+ * Only verified programs run in lockstep. They have no calls and every
+ * frame sits at the same place, so lanes at the same instruction address
+ * the same stack slots. Other programs, and every program if the compiler
+ * has no vector extensions, run each record on the scalar interpreter.
+ *
+ */
+
+#include "codegen.h"
+
+#include <stdio.h>
+
+// Lanes run at once, as many 32 bit values as a vector register of the
+// target holds
+#if defined(__AVX512F__)
+#define BATCH_LANES 16
+#elif defined(__AVX__)
+#define BATCH_LANES 8
+#else
+#define BATCH_LANES 4
+#endif
+
+// Instructions lanes may spend apart before all but the largest group of
+// them are finished on the scalar interpreter
+#define BATCH_DIVERGENCE_LIMIT 4096
+
+/**
+ * @brief Input and output of one run of the program
+ */
+typedef struct batch_record {
+    int *input;             // Values read by SIO_READ, in order
+    int input_size;
+    int *output;            // Values written by SIO_WRITE, in order
+    int output_size;
+    int output_capacity;
+    char *error;            // Why the run stopped, NULL if it halted
+} batch_record;
+
+/**
+ * @brief How much of the work ran in lockstep
+ */
+typedef struct batch_stats {
+    long steps;             // Instructions executed for a group of lanes
+    long lane_instructions; // Instructions retired by lanes in lockstep
+    long scalar_records;    // Records finished on the scalar interpreter
+    long scalar_instructions;   // Instructions those retired there
+} batch_stats;
+
+/**
+ * @brief Run a program once for every record
+ *
+ * Errors stop the record they happen in, which keeps its error message
+ * and the output written before it, and do not affect other records.
+ *
+ * @param generator Generator holding the program's code
+ * @param records Records to run, their output is appended to
+ * @param num_records Number of records
+ * @param stats Counts to add to
+ */
+void run_batch(code_generator_t *generator, batch_record *records,
+    int num_records, batch_stats *stats);
+
+/**
+ * @brief Read input records, one per line of whitespace separated integers
+ *
+ * If the input is malformed, an error is logged to stderr and the program
+ * is exited with EXIT_FAILURE.
+ *
+ * @param in Stream to read the records from
+ * @param num_records Set to the number of records read
+ * @return batch_record* The records read, to be freed by free_batch_records
+ */
+batch_record *read_batch_records(FILE *in, int *num_records);
+
+/**
+ * @brief Print the output of every record on a line of its own
+ *
+ * Errors are printed to stderr along with the number of the record.
+ *
+ * @param records Records to print
+ * @param num_records Number of records
+ * @param out Stream to print the output to
+ */
+void print_batch_records(batch_record *records, int num_records, FILE *out);
+
+/**
+ * @brief Free records and their input and output
+ *
+ * @param records Records to free
+ * @param num_records Number of records
+ */
+void free_batch_records(batch_record *records, int num_records);
+
+#endif /* BATCH_H */
@@ -0,0 +1,276 @@
+// mkdir, readdir, stat and utimensat are POSIX, not C99
+#define _XOPEN_SOURCE 700
+
+#include "cache.h"
+#include "verify.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Bumped whenever the layout of an entry changes
+#define CACHE_FORMAT_VERSION 1
+// Suffix of entry files, temporary files and other files are left alone
+#define ENTRY_SUFFIX ".pl0c"
+
+static const char ENTRY_MAGIC[4] = { 'P', 'L', '0', 'C' };
+
+// Fields of an instruction as stored in an entry
+#define FIELDS_PER_INSTRUCTION 4
+
+/**
+ * @brief Header of an entry, followed by code_size instructions
+ */
+typedef struct entry_header {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    int32_t code_size;
+} entry_header;
+
+/**
+ * @brief An entry file found while evicting
+ */
+typedef struct entry_file {
+    char *path;
+    struct timespec used;   // Modification time, touched on every hit
+    long size;
+} entry_file;
+
+// 64 bit FNV-1a
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t length) {
+    const unsigned char *bytes = (const unsigned char *)data;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static uint64_t hash_int(uint64_t hash, int value) {
+    int32_t fixed = value;
+    return hash_bytes(hash, &fixed, sizeof(fixed));
+}
+
+uint64_t hash_compilation(token_list_t *tokens, compile_options_t *options) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+
+    hash = hash_int(hash, CODEGEN_VERSION);
+    hash = hash_int(hash, CACHE_FORMAT_VERSION);
+    hash = hash_int(hash, NUM_REGISTERS);
+    hash = hash_int(hash, options->optimization_level);
+
+    // Identifier IDs follow the order names first appear in, so the types,
+    // payloads and names together determine the program
+    hash = hash_int(hash, tokens->size);
+    hash = hash_bytes(hash, tokens->types, sizeof(uint8_t) * tokens->size);
+    for (int i = 0; i < tokens->size; i++) {
+        hash = hash_int(hash, tokens->payloads[i]);
+    }
+    for (int id = 0; id < tokens->num_names; id++) {
+        // Names keep their terminator, so "ab" "c" and "a" "bc" differ
+        char *name = tokens->names[id];
+        hash = hash_bytes(hash, name, strlen(name) + 1);
+    }
+    return hash;
+}
+
+void init_compile_cache(compile_cache_t *cache, char *directory,
+    long max_bytes) {
+    if (mkdir(directory, 0777) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Could not create cache directory %s\n", directory);
+        exit(EXIT_FAILURE);
+    }
+    cache->directory = directory;
+    cache->max_bytes = max_bytes;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->stores = 0;
+    cache->evictions = 0;
+}
+
+static void entry_path(compile_cache_t *cache, uint64_t key, char *path,
+    size_t size) {
+    snprintf(path, size, "%s/%016llx" ENTRY_SUFFIX, cache->directory,
+        (unsigned long long)key);
+}
+
+// Read an entry into the generator, returns false if it is missing or bad
+static bool read_entry(char *path, uint64_t key,
+    code_generator_t *generator) {
+    static int32_t fields[MAX_CODE_LENGTH * FIELDS_PER_INSTRUCTION];
+    entry_header header;
+    bool valid = false;
+
+    FILE *in = fopen(path, "rb");
+    if (in == NULL) return false;
+
+    if (fread(&header, sizeof(header), 1, in) == 1 &&
+        memcmp(header.magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC)) == 0 &&
+        header.version == CACHE_FORMAT_VERSION && header.key == key &&
+        header.code_size > 0 && header.code_size <= MAX_CODE_LENGTH) {
+        size_t count = (size_t)header.code_size * FIELDS_PER_INSTRUCTION;
+
+        // Nothing may follow the last instruction
+        valid = fread(fields, sizeof(int32_t), count, in) == count &&
+            fgetc(in) == EOF;
+    }
+    fclose(in);
+    if (!valid) return false;
+
+    for (int i = 0; i < header.code_size; i++) {
+        int32_t *f = &fields[i * FIELDS_PER_INSTRUCTION];
+        generator->code[i] = create_instruction((opcode)f[0], f[1], f[2],
+            f[3]);
+        if (!check_instruction(&(generator->code[i]), header.code_size)) {
+            return false;
+        }
+    }
+    generator->code_size = header.code_size;
+    return true;
+}
+
+bool lookup_compiled(compile_cache_t *cache, uint64_t key,
+    code_generator_t *generator) {
+    char path[FILENAME_MAX];
+
+    entry_path(cache, key, path, sizeof(path));
+    if (!read_entry(path, key, generator)) {
+        (cache->misses)++;
+        return false;
+    }
+
+    // Mark the entry as the most recently used
+    utimensat(AT_FDCWD, path, NULL, 0);
+    (cache->hits)++;
+    return true;
+}
+
+static int compare_use(const void *a, const void *b) {
+    const entry_file *x = (const entry_file *)a;
+    const entry_file *y = (const entry_file *)b;
+
+    if (x->used.tv_sec != y->used.tv_sec) {
+        return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+    }
+    if (x->used.tv_nsec != y->used.tv_nsec) {
+        return x->used.tv_nsec < y->used.tv_nsec ? -1 : 1;
+    }
+    return strcmp(x->path, y->path);
+}
+
+static bool is_entry_name(char *name) {
+    size_t length = strlen(name);
+    size_t suffix = strlen(ENTRY_SUFFIX);
+
+    return length > suffix &&
+        strcmp(&name[length - suffix], ENTRY_SUFFIX) == 0;
+}
+
+// Remove the least recently used entries until they fit in the size limit
+static void evict(compile_cache_t *cache) {
+    DIR *directory = opendir(cache->directory);
+    if (directory == NULL) return;
+
+    entry_file *entries = NULL;
+    int num_entries = 0, capacity = 0;
+    long total = 0;
+    struct dirent *d;
+
+    while ((d = readdir(directory)) != NULL) {
+        char path[FILENAME_MAX];
+        struct stat status;
+
+        if (!is_entry_name(d->d_name)) continue;
+        snprintf(path, sizeof(path), "%s/%s", cache->directory, d->d_name);
+        // Another compiler may have evicted it in the meantime
+        if (stat(path, &status) != 0) continue;
+
+        if (num_entries == capacity) {
+            capacity = capacity > 0 ? capacity * 2 : 64;
+            entry_file *grown = (entry_file *)realloc(entries,
+                sizeof(entry_file) * capacity);
+            if (grown == NULL) break;
+            entries = grown;
+        }
+        entry_file *e = &entries[num_entries++];
+        e->path = (char *)malloc(strlen(path) + 1);
+        if (e->path == NULL) {
+            num_entries--;
+            break;
+        }
+        strcpy(e->path, path);
+        e->used = status.st_mtim;
+        e->size = (long)status.st_size;
+        total += e->size;
+    }
+    closedir(directory);
+
+    qsort(entries, num_entries, sizeof(entry_file), compare_use);
+    for (int i = 0; i < num_entries; i++) {
+        if (total > cache->max_bytes && remove(entries[i].path) == 0) {
+            total -= entries[i].size;
+            (cache->evictions)++;
+        }
+        free(entries[i].path);
+    }
+    free(entries);
+}
+
+void store_compiled(compile_cache_t *cache, uint64_t key,
+    code_generator_t *generator) {
+    static int32_t fields[MAX_CODE_LENGTH * FIELDS_PER_INSTRUCTION];
+    char path[FILENAME_MAX];
+    char temporary[FILENAME_MAX + 32];
+    entry_header header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC));
+    header.version = CACHE_FORMAT_VERSION;
+    header.key = key;
+    header.code_size = generator->code_size;
+
+    for (int i = 0; i < generator->code_size; i++) {
+        cg_instruction *c = &(generator->code[i]);
+        int32_t *f = &fields[i * FIELDS_PER_INSTRUCTION];
+        f[0] = c->op;
+        f[1] = c->regiser_num;
+        f[2] = c->lex_level;
+        f[3] = c->modifier;
+    }
+    size_t count = (size_t)generator->code_size * FIELDS_PER_INSTRUCTION;
+
+    // Unique to this process, so concurrent stores never share a file
+    entry_path(cache, key, path, sizeof(path));
+    snprintf(temporary, sizeof(temporary), "%s.%ld.tmp", path,
+        (long)getpid());
+
+    FILE *out = fopen(temporary, "wb");
+    if (out == NULL) return;
+
+    bool written = fwrite(&header, sizeof(header), 1, out) == 1 &&
+        fwrite(fields, sizeof(int32_t), count, out) == count;
+    written = fflush(out) == 0 && written;
+    written = fsync(fileno(out)) == 0 && written;
+    written = fclose(out) == 0 && written;
+
+    if (!written || rename(temporary, path) != 0) {
+        remove(temporary);
+        return;
+    }
+    (cache->stores)++;
+    evict(cache);
+}
+
+void print_cache_stats(compile_cache_t *cache, FILE *out) {
+    fprintf(out, "cache: %ld hits, %ld misses, %ld stored, %ld evicted\n",
+        cache->hits, cache->misses, cache->stores, cache->evictions);
+}
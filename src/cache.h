@@ -0,0 +1,92 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+/**
+ * @file cache.h
+ * @brief On-disk cache of generated code, keyed by what it was compiled from
+ *
+ * The key is a hash of the token stream, the compile options and
+ * CODEGEN_VERSION, so entries written by a compiler generating different
+ * code never match, while rebuilding the same compiler keeps them. Each entry is a file named after its key holding the binary code
+ * image. Entries are written to a temporary file and renamed into place, so
+ * concurrent compilers sharing a directory never read a partial entry.
+ *
+ * Reading an entry touches its modification time. Once the entries take up
+ * more than the cache's size limit, the least recently used are removed.
+ *
+ */
+
+#include "codegen.h"
+#include "options.h"
+#include "token_list.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct compile_cache_t {
+    char *directory;    // Where the entries are kept
+    long max_bytes;     // Size the entries are evicted down to
+    long hits;
+    long misses;        // Lookups finding no entry, or a corrupt one
+    long stores;
+    long evictions;
+} compile_cache_t;
+
+/**
+ * @brief Initialize a cache, creating its directory if it does not exist
+ *
+ * If the directory cannot be created, an error is logged to stderr and the
+ * program is exited with EXIT_FAILURE.
+ *
+ * @param cache The cache to initialize
+ * @param directory Directory holding the entries, kept by the cache
+ * @param max_bytes Size the entries may take up before some are evicted
+ */
+void init_compile_cache(compile_cache_t *cache, char *directory,
+    long max_bytes);
+
+/**
+ * @brief Hash everything the generated code of a program depends on
+ *
+ * @param tokens Tokens of the program
+ * @param options Options the program is compiled with
+ * @return uint64_t Key of the program's entry
+ */
+uint64_t hash_compilation(token_list_t *tokens, compile_options_t *options);
+
+/**
+ * @brief Look up the code compiled for a key
+ *
+ * Entries that are truncated or hold malformed instructions count as
+ * misses.
+ *
+ * @param cache Cache to look in
+ * @param key Key from hash_compilation
+ * @param generator Set to the cached code on a hit
+ * @return bool Whether the entry was found
+ */
+bool lookup_compiled(compile_cache_t *cache, uint64_t key,
+    code_generator_t *generator);
+
+/**
+ * @brief Store the code compiled for a key, evicting entries if needed
+ *
+ * Failing to write the entry is not an error, the code just stays uncached.
+ *
+ * @param cache Cache to store in
+ * @param key Key from hash_compilation
+ * @param generator Generator holding the compiled code
+ */
+void store_compiled(compile_cache_t *cache, uint64_t key,
+    code_generator_t *generator);
+
+/**
+ * @brief Print the hit, miss, store and eviction counts of a cache
+ *
+ * @param cache The cache whose counts to print
+ * @param out Stream to print to
+ */
+void print_cache_stats(compile_cache_t *cache, FILE *out);
+
+#endif /* CACHE_H */
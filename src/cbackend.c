@@ -0,0 +1,376 @@
+#include "cbackend.h"
+#include "vm.h"
+
+#include <stdbool.h>
+
+// Size of the buffer the translated program writes its output through
+#define OUTPUT_BUFFER_SIZE 65536
+
+/**
+ * @brief Range of instructions being translated
+ */
+typedef struct c_region {
+    int start;          // First instruction translated
+    int end;            // One past the last instruction translated
+    bool whole_program; // Whether control never leaves the translation
+    int stack_size;     // Cells of the stack array
+} c_region;
+
+// Errors print the same messages as the virtual machine
+static const char *fail_function =
+    "static void fail(const char *message) {\n"
+    "    fflush(stdout);\n"
+    "    fprintf(stderr, \"VM Error: %s\\n\", message);\n"
+    "    exit(EXIT_FAILURE);\n"
+    "}\n"
+    "\n"
+    "static int base(int *stack, int b, int l) {\n"
+    "    while (l-- > 0) b = stack[b + 1];\n"
+    "    return b;\n"
+    "}\n"
+    "\n";
+
+static bool is_jump(opcode op) {
+    return op == JMP || op == JPC || op == CAL;
+}
+
+// C operator of a binary instruction, or NULL if it needs more than one
+static char *c_operator(opcode op) {
+    switch (op) {
+        case EQL: return "==";
+        case NEQ: return "!=";
+        case LSS: return "<";
+        case LEQ: return "<=";
+        case GTR: return ">";
+        case GEQ: return ">=";
+        default: return NULL;
+    }
+}
+
+// Expression of the stack cell at lexicographical level l and offset m
+static void write_address(FILE *out, int l, int m) {
+    if (l == 0) fprintf(out, "stack[bp + %d]", m);
+    else fprintf(out, "stack[base(stack, bp, %d) + %d]", l, m);
+}
+
+// Jumps out of a region hand the target back to the caller, as do jumps
+// back within it once the budget is spent
+static void write_jump(FILE *out, c_region *region, int index, int target) {
+    if (region->whole_program) {
+        fprintf(out, "goto L%d;", target);
+    } else if (target >= region->start && target <= index) {
+        fprintf(out, "{ if (n >= budget) { pc = %d; goto leave; } "
+            "goto L%d; }", target, target);
+    } else if (target >= region->start && target < region->end) {
+        fprintf(out, "goto L%d;", target);
+    } else {
+        fprintf(out, "{ pc = %d; goto leave; }", target);
+    }
+}
+
+static void write_instruction(FILE *out, cg_instruction *c, int index,
+    c_region *region) {
+    int r = c->regiser_num, l = c->lex_level, m = c->modifier;
+    int stack_size = region->stack_size;
+
+    fprintf(out, "    ");
+
+    // Regions leave frames, I/O and halting to the caller
+    if (!region->whole_program &&
+        (c->op == CAL || c->op == RTN || c->op == SIO_READ ||
+        c->op == SIO_WRITE || c->op == SIO_END)) {
+        fprintf(out, "pc = %d; goto leave;\n", index);
+        return;
+    }
+    // Regions count what they execute for the caller
+    if (!region->whole_program) fprintf(out, "n++; ");
+
+    switch (c->op) {
+        case LIT:
+            fprintf(out, "r%d = %d;\n", r, m);
+            break;
+        case RTN:
+            fprintf(out, "sp = bp - 1; bp = stack[sp + 3]; "
+                "ra = stack[sp + 4]; goto ret;\n");
+            break;
+        case LOD:
+            fprintf(out, "r%d = ", r);
+            write_address(out, l, m);
+            fprintf(out, ";\n");
+            break;
+        case STO:
+            write_address(out, l, m);
+            fprintf(out, " = r%d;\n", r);
+            break;
+        case CAL:
+            fprintf(out, "if (sp + 4 >= %d) fail(\"Stack overflow.\");\n",
+                stack_size);
+            fprintf(out, "    stack[sp + 1] = 0; "
+                "stack[sp + 2] = base(stack, bp, %d); stack[sp + 3] = bp; "
+                "stack[sp + 4] = %d; bp = sp + 1; goto L%d;\n",
+                l, index + 1, m);
+            break;
+        case INC:
+            fprintf(out, "if (sp + %d >= %d) fail(\"Stack overflow.\");\n"
+                "    sp += %d;\n", m, stack_size, m);
+            break;
+        case JMP:
+            write_jump(out, region, index, m);
+            fprintf(out, "\n");
+            break;
+        case JPC:
+            fprintf(out, "if (r%d == 0) ", r);
+            write_jump(out, region, index, m);
+            fprintf(out, "\n");
+            break;
+        case SIO_WRITE:
+            fprintf(out, "printf(\"%%d\\n\", r%d);\n", r);
+            break;
+        case SIO_READ:
+            fprintf(out, "if (scanf(\"%%d\", &r%d) != 1) "
+                "fail(\"Expected an integer on input.\");\n", r);
+            break;
+        case SIO_END:
+            fprintf(out, "return 0;\n");
+            break;
+        // Arithmetic wraps around through unsigned, like the machine
+        case NEG:
+            fprintf(out, "r%d = (int)(0u - (unsigned int)r%d);\n", r, r);
+            break;
+        case ADD:
+        case SUB:
+        case MUL:
+            fprintf(out,
+                "r%d = (int)((unsigned int)r%d %c (unsigned int)r%d);\n",
+                r, l, c->op == ADD ? '+' : c->op == SUB ? '-' : '*', m);
+            break;
+        // Dividing by -1 negates, so INT_MIN / -1 does not trap either
+        case DIV:
+            fprintf(out, "if (r%d == 0) fail(\"Division by zero.\");\n"
+                "    r%d = r%d == -1 ? (int)(0u - (unsigned int)r%d) : "
+                "r%d / r%d;\n", m, r, m, l, l, m);
+            break;
+        case MOD:
+            fprintf(out, "if (r%d == 0) fail(\"Division by zero.\");\n"
+                "    r%d = r%d == -1 ? 0 : r%d %% r%d;\n", m, r, m, l, m);
+            break;
+        case ODD:
+            fprintf(out, "r%d = r%d %% 2;\n", r, r);
+            break;
+        case SHL:
+            fprintf(out, "r%d = (int)((unsigned int)r%d << %d);\n", r, l, m);
+            break;
+        case SHR:
+            fprintf(out, "r%d = r%d >> %d;\n", r, l, m);
+            break;
+        case MULH:
+            fprintf(out, "r%d = (int)(((long long)r%d * r%d) >> 32);\n",
+                r, l, m);
+            break;
+        default:
+            // A register compared with itself gives a constant, which C
+            // compilers warn about when it is spelled out
+            if (c_operator(c->op) != NULL && l == m) {
+                fprintf(out, "r%d = %d;\n", r,
+                    c->op == EQL || c->op == LEQ || c->op == GEQ);
+            } else if (c_operator(c->op) != NULL) {
+                fprintf(out, "r%d = r%d %s r%d;\n", r, l, c_operator(c->op), m);
+            } else {
+                fprintf(out, "fail(\"Invalid opcode.\");\n");
+            }
+    }
+}
+
+// Stack cells the program can use, counted from the INC instructions
+static int find_stack_size(code_generator_t *generator) {
+    int size = 1;   // The base pointer starts at 1
+    for (int i = 0; i < generator->code_size; i++) {
+        // Frames of called procedures can pile up without limit
+        if (generator->code[i].op == CAL) return MAX_STACK_HEIGHT;
+        if (generator->code[i].op == INC) size += generator->code[i].modifier;
+    }
+    return size + 1;
+}
+
+// Print the labeled instructions of a region
+static void write_region(FILE *out, code_generator_t *generator,
+    c_region *region, bool *labeled) {
+    for (int i = region->start; i < region->end; i++) {
+        if (labeled[i]) fprintf(out, "L%d:\n", i);
+        write_instruction(out, &(generator->code[i]), i, region);
+    }
+}
+
+// Mark the registers a region reads and writes, as write_instruction
+// spells them out
+static void find_registers(code_generator_t *generator, c_region *region,
+    bool *read, bool *written) {
+    for (int r = 0; r < NUM_REGISTERS; r++) read[r] = written[r] = false;
+
+    for (int i = region->start; i < region->end; i++) {
+        cg_instruction *c = &(generator->code[i]);
+        int r = c->regiser_num, l = c->lex_level, m = c->modifier;
+        bool reads_r = false, writes_r = false, reads_l = false,
+            reads_m = false;
+
+        switch (c->op) {
+            case LIT:
+            case LOD:
+            case SIO_READ:
+                writes_r = true;
+                break;
+            case STO:
+            case JPC:
+            case SIO_WRITE:
+                reads_r = true;
+                break;
+            case NEG:
+            case ODD:
+                reads_r = writes_r = true;
+                break;
+            case SHL:
+            case SHR:
+                writes_r = reads_l = true;
+                break;
+            case ADD:
+            case SUB:
+            case MUL:
+            case DIV:
+            case MOD:
+            case MULH:
+                writes_r = reads_l = reads_m = true;
+                break;
+            default:
+                if (c_operator(c->op) != NULL) {
+                    writes_r = true;
+                    reads_l = reads_m = l != m;
+                }
+        }
+        // Regions leave I/O to the caller, without touching its register
+        if (!region->whole_program &&
+            (c->op == SIO_READ || c->op == SIO_WRITE)) {
+            continue;
+        }
+
+        if (reads_r && r >= 0 && r < NUM_REGISTERS) read[r] = true;
+        if (writes_r && r >= 0 && r < NUM_REGISTERS) written[r] = true;
+        if (reads_l && l >= 0 && l < NUM_REGISTERS) read[l] = true;
+        if (reads_m && m >= 0 && m < NUM_REGISTERS) read[m] = true;
+    }
+}
+
+void write_c_program(code_generator_t *generator, FILE *out) {
+    int size = generator->code_size;
+    c_region region = { 0, size, true, find_stack_size(generator) };
+    bool labeled[MAX_CODE_LENGTH + 1] = { false };
+    bool read[NUM_REGISTERS], written[NUM_REGISTERS];
+    bool returns = false;
+
+    for (int i = 0; i < size; i++) {
+        cg_instruction *c = &(generator->code[i]);
+
+        if (is_jump(c->op) && c->modifier >= 0 && c->modifier <= size) {
+            labeled[c->modifier] = true;
+        }
+        if (c->op == CAL) labeled[i + 1] = true;
+        if (c->op == RTN) returns = true;
+    }
+    // The first frame returns to the start of the program
+    if (returns) labeled[0] = true;
+
+    fprintf(out, "#include <stdio.h>\n#include <stdlib.h>\n\n%s",
+        fail_function);
+    fprintf(out,
+        "int main(void) {\n"
+        "    static char output[%d];\n"
+        "    int stack[%d] = { 0 };\n"
+        "    int sp = 0, bp = 1;\n",
+        OUTPUT_BUFFER_SIZE, region.stack_size);
+    if (returns) fprintf(out, "    int ra;\n");
+    // Only the registers the code uses are declared, so that the
+    // translation compiles without warnings
+    find_registers(generator, &region, read, written);
+    for (int r = 0; r < NUM_REGISTERS; r++) {
+        if (read[r] || written[r]) fprintf(out, "    int r%d = 0;\n", r);
+    }
+    fprintf(out,
+        "\n"
+        "    setvbuf(stdout, output, _IOFBF, sizeof(output));\n"
+        "    (void)base;\n"
+        "    (void)stack;\n"
+        "    (void)sp;\n"
+        "    (void)bp;\n");
+    for (int r = 0; r < NUM_REGISTERS; r++) {
+        if (written[r] && !read[r]) fprintf(out, "    (void)r%d;\n", r);
+    }
+    fprintf(out, "\n");
+
+    write_region(out, generator, &region, labeled);
+
+    // Running past the last instruction stops the machine
+    if (labeled[size]) fprintf(out, "L%d:\n", size);
+    fprintf(out, "    fail(\"Program counter out of bounds.\");\n");
+
+    if (returns) {
+        fprintf(out, "ret:\n    switch (ra) {\n");
+        for (int i = 0; i <= size; i++) {
+            if (i == 0 || generator->code[i - 1].op == CAL) {
+                fprintf(out, "        case %d: goto L%d;\n", i, i);
+            }
+        }
+        fprintf(out, "    }\n    fail(\"Program counter out of bounds.\");\n");
+    }
+
+    fprintf(out, "    return 0;\n}\n");
+}
+
+void write_c_loop(code_generator_t *generator, int start, int end,
+    char *name, FILE *out) {
+    c_region region = { start, end, false, MAX_STACK_HEIGHT };
+    bool labeled[MAX_CODE_LENGTH + 1] = { false };
+    bool read[NUM_REGISTERS], written[NUM_REGISTERS];
+
+    for (int i = start; i < end; i++) {
+        cg_instruction *c = &(generator->code[i]);
+
+        if ((c->op == JMP || c->op == JPC) && c->modifier >= start &&
+            c->modifier < end) {
+            labeled[c->modifier] = true;
+        }
+    }
+
+    fprintf(out, "#include <stdio.h>\n#include <stdlib.h>\n\n%s",
+        fail_function);
+    fprintf(out,
+        "int %s(int *registers, int *stack, int *sp_pointer, "
+        "int *bp_pointer, long *retired, long budget) {\n"
+        "    int sp = *sp_pointer, bp = *bp_pointer;\n"
+        "    int pc;\n"
+        "    long n = 0;\n",
+        name);
+    find_registers(generator, &region, read, written);
+    for (int r = 0; r < NUM_REGISTERS; r++) {
+        if (read[r] || written[r]) {
+            fprintf(out, "    int r%d = registers[%d];\n", r, r);
+        }
+    }
+    fprintf(out, "\n    (void)base;\n    (void)stack;\n\n");
+
+    write_region(out, generator, &region, labeled);
+    // Falling out of the loop goes through the label too, which is then
+    // used even if nothing else leaves
+    fprintf(out, "    pc = %d;\n    goto leave;\n", end);
+
+    // Hand the machine state back to the interpreter
+    fprintf(out, "leave:\n");
+    // Registers the loop only reads still hold the interpreter's values
+    for (int r = 0; r < NUM_REGISTERS; r++) {
+        if (written[r]) fprintf(out, "    registers[%d] = r%d;\n", r, r);
+    }
+    fprintf(out,
+        "    *sp_pointer = sp;\n"
+        "    *bp_pointer = bp;\n"
+        "    *retired = n;\n"
+        "    return pc;\n"
+        "}\n");
+}
@@ -0,0 +1,53 @@
+#ifndef CBACKEND_H
+#define CBACKEND_H
+
+/**
+ * @file cbackend.h
+ * @brief Ahead-of-time translation of generated code into C
+ *
+ * The translation unit behaves like the virtual machine running the code,
+ * errors included, so a host C compiler can turn a program into a native
+ * binary where an interpreter is not wanted.
+ *
+ */
+
+#include "codegen.h"
+
+#include <stdio.h>
+
+/**
+ * @brief Print a self-contained C program running the given code
+ *
+ * Registers become locals and the stack a local array, sized from the INC
+ * instructions unless the program calls procedures. Jump targets become
+ * labels, and CAL and RTN go through a switch over the return addresses.
+ * Output is fully buffered and flushed when the program ends.
+ *
+ * @param generator Generator holding the program's code
+ * @param out Stream to print the translation unit to
+ */
+void write_c_program(code_generator_t *generator, FILE *out);
+
+/**
+ * @brief Print a C function running a loop of the given code
+ *
+ * The function has the signature
+ *  int name(int *registers, int *stack, int *sp, int *bp, long *retired,
+ *      long budget)
+ * and runs on the machine state it is given, starting at instruction start.
+ * It returns the index of the next instruction to interpret once control 
+ * leaves the range [start, end), or reaches a CAL, RTN or SIO instruction,
+ * which are left for the interpreter to execute. It also returns at a
+ * backward jump once it has executed budget instructions, and sets retired
+ * to the number of instructions it executed.
+ *
+ * @param generator Generator holding the program's code
+ * @param start First instruction of the loop
+ * @param end One past the last instruction of the loop
+ * @param name Name of the function
+ * @param out Stream to print the translation unit to
+ */
+void write_c_loop(code_generator_t *generator, int start, int end,
+    char *name, FILE *out);
+
+#endif /* CBACKEND_H */
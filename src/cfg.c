@@ -0,0 +1,145 @@
+#include "cfg.h"
+
+#include <string.h>
+
+static bool is_jump(opcode op) {
+    return op == JMP || op == JPC || op == CAL;
+}
+
+static bool ends_block(opcode op) {
+    return is_jump(op) || op == RTN || op == SIO_END;
+}
+
+static bool falls_through(opcode op) {
+    return op != JMP && op != RTN && op != SIO_END;
+}
+
+// Jump targets past the end of the code have no block to go to
+static bool valid_target(code_generator_t *generator, int target) {
+    return target >= 0 && target < generator->code_size;
+}
+
+static void find_blocks(cfg_t *cfg, code_generator_t *generator) {
+    bool leader[MAX_CODE_LENGTH + 1] = { false };
+    cg_instruction *code = generator->code;
+
+    leader[0] = true;
+    for (int i = 0; i < generator->code_size; i++) {
+        if (is_jump(code[i].op) && valid_target(generator, code[i].modifier)) {
+            leader[code[i].modifier] = true;
+        }
+        if (ends_block(code[i].op)) leader[i + 1] = true;
+    }
+
+    cfg->num_blocks = 0;
+    for (int i = 0; i < generator->code_size; i++) {
+        if (leader[i]) {
+            if (cfg->num_blocks > 0) cfg->blocks[cfg->num_blocks - 1].end = i;
+            memset(&(cfg->blocks[cfg->num_blocks]), 0, sizeof(basic_block));
+            cfg->blocks[cfg->num_blocks].start = i;
+            (cfg->num_blocks)++;
+        }
+        cfg->block_of[i] = cfg->num_blocks - 1;
+    }
+    if (cfg->num_blocks > 0) {
+        cfg->blocks[cfg->num_blocks - 1].end = generator->code_size;
+    }
+}
+
+static void find_edges(cfg_t *cfg, code_generator_t *generator) {
+    int in_degree[MAX_BLOCKS] = { 0 };
+
+    for (int b = 0; b < cfg->num_blocks; b++) {
+        basic_block *block = &(cfg->blocks[b]);
+        cg_instruction *last = &(generator->code[block->end - 1]);
+
+        if (falls_through(last->op) && block->end < generator->code_size) {
+            block->successors[(block->num_successors)++] = b + 1;
+            block->falls_through = true;
+        }
+        if (is_jump(last->op) && valid_target(generator, last->modifier)) {
+            block->successors[(block->num_successors)++] =
+                cfg->block_of[last->modifier];
+        }
+
+        for (int s = 0; s < block->num_successors; s++) {
+            in_degree[block->successors[s]]++;
+        }
+    }
+
+    // Lay the predecessor lists out one after another
+    int offset = 0;
+    for (int b = 0; b < cfg->num_blocks; b++) {
+        cfg->blocks[b].first_predecessor = offset;
+        offset += in_degree[b];
+    }
+    for (int b = 0; b < cfg->num_blocks; b++) {
+        basic_block *block = &(cfg->blocks[b]);
+        for (int s = 0; s < block->num_successors; s++) {
+            basic_block *successor = &(cfg->blocks[block->successors[s]]);
+            cfg->predecessors[successor->first_predecessor +
+                (successor->num_predecessors)++] = b;
+        }
+    }
+}
+
+// Depth first walk marking reachable blocks and the targets of back edges
+static void find_loops(cfg_t *cfg, int b, bool *on_path) {
+    basic_block *block = &(cfg->blocks[b]);
+
+    block->reachable = true;
+    on_path[b] = true;
+
+    for (int s = 0; s < block->num_successors; s++) {
+        int successor = block->successors[s];
+
+        if (on_path[successor]) cfg->blocks[successor].loop_header = true;
+        else if (!cfg->blocks[successor].reachable) {
+            find_loops(cfg, successor, on_path);
+        }
+    }
+    on_path[b] = false;
+}
+
+void build_cfg(cfg_t *cfg, code_generator_t *generator) {
+    bool on_path[MAX_BLOCKS] = { false };
+
+    find_blocks(cfg, generator);
+    find_edges(cfg, generator);
+    if (cfg->num_blocks > 0) find_loops(cfg, 0, on_path);
+}
+
+int cfg_predecessor(cfg_t *cfg, int block, int n) {
+    return cfg->predecessors[cfg->blocks[block].first_predecessor + n];
+}
+
+void write_cfg_dot(cfg_t *cfg, code_generator_t *generator, FILE *out) {
+    fprintf(out, "digraph cfg {\n");
+    fprintf(out, "    node [shape=box, fontname=monospace];\n");
+
+    for (int b = 0; b < cfg->num_blocks; b++) {
+        basic_block *block = &(cfg->blocks[b]);
+
+        fprintf(out, "    B%d [label=\"B%d\\l", b, b);
+        for (int i = block->start; i < block->end; i++) {
+            cg_instruction *c = &(generator->code[i]);
+            fprintf(out, "%d: %s %d %d %d\\l", i, opcode_to_string(c->op),
+                c->regiser_num, c->lex_level, c->modifier);
+        }
+        fprintf(out, "\"");
+        if (block->loop_header) fprintf(out, ", peripheries=2");
+        if (!block->reachable) fprintf(out, ", style=dashed");
+        fprintf(out, "];\n");
+    }
+
+    for (int b = 0; b < cfg->num_blocks; b++) {
+        basic_block *block = &(cfg->blocks[b]);
+
+        for (int s = 0; s < block->num_successors; s++) {
+            bool jump = s > 0 || !block->falls_through;
+            fprintf(out, "    B%d -> B%d%s;\n", b, block->successors[s],
+                jump ? " [style=bold]" : "");
+        }
+    }
+    fprintf(out, "}\n");
+}
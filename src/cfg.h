@@ -0,0 +1,76 @@
+#ifndef CFG_H
+#define CFG_H
+
+/**
+ * @file cfg.h
+ * @brief Control flow graph over generated instructions
+ *
+ * Blocks are maximal straight-line runs of instructions: every jump target
+ * starts a block, and every control transfer ends one. Block 0 holds the
+ * first instruction, and blocks are numbered in code order.
+ *
+ */
+
+#include "codegen.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// Any instruction could start a block
+#define MAX_BLOCKS MAX_CODE_LENGTH
+
+typedef struct basic_block {
+    int start;                  // First instruction of the block
+    int end;                    // One past the last instruction
+    int successors[2];          // Fall through first, then jump target
+    int num_successors;
+    bool falls_through;         // Whether successors[0] is the next block
+    int first_predecessor;      // Index into the graph's predecessor list
+    int num_predecessors;
+    bool reachable;             // Whether any path from block 0 reaches it
+    bool loop_header;           // Whether a back edge jumps to it
+} basic_block;
+
+typedef struct cfg_t {
+    basic_block blocks[MAX_BLOCKS];
+    int num_blocks;
+    int block_of[MAX_CODE_LENGTH];      // Block holding each instruction
+    int predecessors[2 * MAX_BLOCKS];   // Every block has at most 2 edges out
+} cfg_t;
+
+/**
+ * @brief Find the basic blocks, edges and loop headers of a program
+ *
+ * CAL continues at both the called code and the next instruction, and RTN
+ * and SIO_END have no successors. A loop header is the target of an edge
+ * that closes a cycle in a depth first walk from block 0.
+ *
+ * @param cfg Graph to build
+ * @param generator Generator holding the program's code
+ */
+void build_cfg(cfg_t *cfg, code_generator_t *generator);
+
+/**
+ * @brief Predecessor of a block
+ *
+ * @param cfg Graph the block belongs to
+ * @param block Index of the block
+ * @param n Which predecessor, below the block's num_predecessors
+ * @return int Index of the predecessor
+ */
+int cfg_predecessor(cfg_t *cfg, int block, int n);
+
+/**
+ * @brief Print the graph in Graphviz dot format
+ *
+ * Every block is labeled with its instructions, loop headers are drawn with
+ * a double border and unreachable blocks dashed. Edges taken by a jump are
+ * drawn bold.
+ *
+ * @param cfg Graph to print
+ * @param generator Generator holding the code the graph was built from
+ * @param out Stream to print to
+ */
+void write_cfg_dot(cfg_t *cfg, code_generator_t *generator, FILE *out);
+
+#endif /* CFG_H */
@@ -1,8 +1,62 @@
 #include "codegen.h"
 #include "error.h"
 
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Fields of an instruction in a code image
+#define FIELDS_PER_INSTRUCTION 4
+
+static const char IMAGE_MAGIC[4] = { 'P', 'L', '0', 'I' };
+static const char IMAGE_END_MAGIC[4] = { 'P', 'L', '0', 'E' };
+
+// Index into this array matches opcode enum values (map)
+char *opcode_strings[] = {
+    "", "LIT", "RTN", "LOD", "STO", "CAL", "INC", "JMP", "JPC", "SIO_WRITE",
+    "SIO_READ", "SIO_END", "NEG", "ADD", "SUB", "MUL", "DIV", "ODD",
+    "MOD", "EQL", "NEQ", "LSS", "LEQ", "GTR", "GEQ", "SHL", "SHR", "MULH"
+};
+
 void init_code_generator(code_generator_t *generator) {
     generator->code_size = 0;
+    generator->stream = NULL;
+    generator->num_written = 0;
+    generator->fixups = NULL;
+    generator->num_fixups = 0;
+    generator->fixups_capacity = 0;
+}
+
+static void write_failed(void) {
+    fprintf(stderr, "Could not write the code image\n");
+    exit(EXIT_FAILURE);
+}
+
+static void write_ints(code_generator_t *generator, int32_t *values,
+    int count) {
+    if (fwrite(values, sizeof(int32_t), count, generator->stream) !=
+        (size_t)count) {
+        write_failed();
+    }
+}
+
+// Write the oldest instruction still kept to the stream
+static void write_oldest(code_generator_t *generator) {
+    cg_instruction *c = &(generator->code[generator->num_written %
+        CODE_WINDOW]);
+    int32_t fields[FIELDS_PER_INSTRUCTION] = {
+        c->op, c->regiser_num, c->lex_level, c->modifier
+    };
+
+    write_ints(generator, fields, FIELDS_PER_INSTRUCTION);
+    (generator->num_written)++;
+}
+
+// Slot of code holding an instruction that was not written yet
+static cg_instruction *kept_instruction(code_generator_t *generator,
+    int index) {
+    if (generator->stream == NULL) return &(generator->code[index]);
+    return &(generator->code[index % CODE_WINDOW]);
 }
 
 cg_instruction create_instruction(opcode op, int r, int l, int m) {
@@ -12,11 +66,18 @@ cg_instruction create_instruction(opcode op, int r, int l, int m) {
 
 void emit_instruction(code_generator_t *generator, opcode op, int r, int l, 
     int m) {
+    if (generator->stream != NULL) {
+        // Make room in the window, the code itself is unbounded
+        if (generator->code_size - generator->num_written == CODE_WINDOW) {
+            write_oldest(generator);
+        }
+    }
     // Throw an error and exit if we've went over our maximum code length
-    if (generator->code_size == MAX_CODE_LENGTH) error(25);
+    else if (generator->code_size == MAX_CODE_LENGTH) 
+        error(EXCEEDED_MAX_CODE_LENGTH);
 
     // Otherwise, put this instruction in the code generator
-    cg_instruction *i = &(generator->code[generator->code_size]);
+    cg_instruction *i = kept_instruction(generator, generator->code_size);
     i->op = op;
     i->regiser_num = r;
     i->lex_level = l;
@@ -35,3 +96,85 @@ void emit_prepared_instruction(code_generator_t *generator,
         i->modifier
     );
 }
+
+void set_modifier(code_generator_t *generator, int index, int m) {
+    if (index >= generator->num_written) {
+        kept_instruction(generator, index)->modifier = m;
+        return;
+    }
+
+    if (generator->num_fixups == generator->fixups_capacity) {
+        int capacity = generator->fixups_capacity > 0 ?
+            generator->fixups_capacity * 2 : 16;
+        code_fixup *fixups = (code_fixup *)realloc(generator->fixups,
+            sizeof(code_fixup) * capacity);
+        if (fixups == NULL) {
+            fprintf(stderr, "Could not allocate memory for fixups\n");
+            exit(EXIT_FAILURE);
+        }
+        generator->fixups = fixups;
+        generator->fixups_capacity = capacity;
+    }
+    code_fixup *f = &(generator->fixups[(generator->num_fixups)++]);
+    f->index = index;
+    f->modifier = m;
+}
+
+void stream_code(code_generator_t *generator, FILE *stream) {
+    generator->stream = stream;
+    if (fwrite(IMAGE_MAGIC, 1, sizeof(IMAGE_MAGIC), stream) !=
+        sizeof(IMAGE_MAGIC)) {
+        write_failed();
+    }
+}
+
+void finish_code_stream(code_generator_t *generator) {
+    FILE *stream = generator->stream;
+    int num_relocations = generator->num_fixups;
+
+    while (generator->num_written < generator->code_size) {
+        write_oldest(generator);
+    }
+
+    // Patch written instructions in place where the stream allows it
+    long end = ftell(stream);
+    if (end >= 0 && fseek(stream, 0, SEEK_CUR) == 0) {
+        // The image need not start at the beginning of the stream
+        long start = end - (long)sizeof(int32_t) * FIELDS_PER_INSTRUCTION *
+            generator->code_size;
+
+        for (int f = 0; f < generator->num_fixups; f++) {
+            code_fixup *fixup = &(generator->fixups[f]);
+            int32_t modifier = fixup->modifier;
+            long offset = start + (long)sizeof(int32_t) *
+                ((long)fixup->index * FIELDS_PER_INSTRUCTION + 3);
+
+            if (fseek(stream, offset, SEEK_SET) != 0) write_failed();
+            write_ints(generator, &modifier, 1);
+        }
+        if (fseek(stream, end, SEEK_SET) != 0) write_failed();
+        num_relocations = 0;
+    } else {
+        for (int f = 0; f < generator->num_fixups; f++) {
+            code_fixup *fixup = &(generator->fixups[f]);
+            int32_t pair[2] = { fixup->index, fixup->modifier };
+            write_ints(generator, pair, 2);
+        }
+    }
+
+    int32_t counts[2] = { generator->code_size, num_relocations };
+    write_ints(generator, counts, 2);
+    if (fwrite(IMAGE_END_MAGIC, 1, sizeof(IMAGE_END_MAGIC), stream) !=
+        sizeof(IMAGE_END_MAGIC) || fflush(stream) != 0) {
+        write_failed();
+    }
+
+    free(generator->fixups);
+    generator->fixups = NULL;
+    generator->num_fixups = 0;
+    generator->fixups_capacity = 0;
+}
+
+char *opcode_to_string(opcode op) {
+    return opcode_strings[op];
+}
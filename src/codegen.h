@@ -1,14 +1,38 @@
 #ifndef CODEGEN_H
 #define CODEGEN_H
 
+#include <stdbool.h>
+#include <stdio.h>
+
 #define MAX_CODE_LENGTH 200
+// Instructions a streaming generator keeps after emitting them
+#define CODE_WINDOW 32
+// Size of the target machine's register file
+#define NUM_REGISTERS 8
+// Deepest nesting of procedures, the main program being level 0
+#define MAX_LEXI_LEVELS 32
+// Bumped whenever a change to the compiler changes the code generated for
+// some program, so code cached by an older compiler is not reused
+#define CODEGEN_VERSION 1
 
+/**
+ * @brief Instruction opcodes
+ * 
+ * SHL, SHR and MULH are not part of the specification's machine. They are 
+ * only emitted by strength reduction (optimization level 3):
+ *  SHL R, L, M: R[r] = R[l] << M
+ *  SHR R, L, M: R[r] = R[l] >> M, shifting in the sign bit
+ *  MULH R, L, M: R[r] = high 32 bits of the 64 bit product R[l] * R[m]
+ */
 typedef enum opcode {
     LIT = 1, RTN, LOD, STO, CAL, INC, JMP, JPC, SIO_WRITE,
     SIO_READ, SIO_END, NEG, ADD, SUB, MUL, DIV, ODD,
-    MOD, EQL, NEQ, LSS, LEQ, GTR, GEQ
+    MOD, EQL, NEQ, LSS, LEQ, GTR, GEQ, SHL, SHR, MULH
 } opcode;
 
+// One past the highest opcode value, for tables indexed by opcode
+#define NUM_OPCODES (MULH + 1)
+
 typedef struct cg_instruction {
     opcode op;
     int regiser_num;
@@ -16,9 +40,29 @@ typedef struct cg_instruction {
     int modifier;
 } cg_instruction;
 
+/**
+ * @brief Modifier to set on an instruction already written to a stream
+ */
+typedef struct code_fixup {
+    int index;
+    int modifier;
+} code_fixup;
+
+/**
+ * @brief Instructions emitted so far
+ *
+ * A streaming generator only keeps the last CODE_WINDOW instructions,
+ * instruction i in code[i % CODE_WINDOW], and writes older ones to its
+ * stream. Its code is not bounded by MAX_CODE_LENGTH.
+ */
 typedef struct code_generator_t {
     cg_instruction code[MAX_CODE_LENGTH];
     int code_size;
+    FILE *stream;           // Where older instructions go, NULL to keep all
+    int num_written;        // Instructions written to the stream
+    code_fixup *fixups;     // Modifiers to set on written instructions
+    int num_fixups;
+    int fixups_capacity;
 } code_generator_t;
 
 /**
@@ -61,4 +105,49 @@ void emit_instruction(code_generator_t *generator, opcode op, int r, int l,
  */
 void emit_prepared_instruction(code_generator_t *generator, cg_instruction *i);
 
+/**
+ * @brief Set the modifier of an emitted instruction, e.g. a jump's target
+ * 
+ * Instructions a streaming generator already wrote are fixed up when the
+ * stream is finished.
+ * 
+ * @param generator Generator the instruction was emitted into
+ * @param index Index of the instruction
+ * @param m New modifier
+ */
+void set_modifier(code_generator_t *generator, int index, int m);
+
+/**
+ * @brief Make a generator write its code to a stream as it is emitted
+ * 
+ * The stream gets a code image: the magic "PL0I", then every instruction
+ * as four 32 bit integers in the machine's byte order (op, register, level,
+ * modifier). Fixups of instructions already written are applied in place
+ * if the stream can seek, and otherwise follow the instructions as pairs of
+ * index and modifier. The image ends with the number of instructions, the
+ * number of those pairs, and the magic "PL0E".
+ * 
+ * @param generator Empty generator to stream from
+ * @param stream Stream to write the code image to
+ */
+void stream_code(code_generator_t *generator, FILE *stream);
+
+/**
+ * @brief Write the rest of a streaming generator's code and its fixups
+ * 
+ * If writing fails, an error is logged to stderr and the program is exited 
+ * with EXIT_FAILURE. The stream is left open.
+ * 
+ * @param generator Streaming generator to finish
+ */
+void finish_code_stream(code_generator_t *generator);
+
+/**
+ * @brief Returns the mnemonic of the given opcode
+ * 
+ * @param op Opcode to stringify
+ * @return char* Mnemonic of the opcode, e.g. "LOD"
+ */
+char *opcode_to_string(opcode op);
+
 #endif /* CODEGEN_H */
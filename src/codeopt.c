@@ -0,0 +1,542 @@
+#include "codeopt.h"
+#include "cfg.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Set of registers, one bit per register
+typedef unsigned int register_set;
+
+#define ALL_REGISTERS ((1u << NUM_REGISTERS) - 1)
+#define REGISTER_BIT(r) (1u << (r))
+
+// Addresses whose stored value is remembered within a basic block
+#define MAX_TRACKED_ADDRESSES 64
+
+void optimize_code(code_generator_t *generator, compile_options_t *options) {
+    if (options->optimization_level >= 2) {
+        number_values(generator);
+        thread_jumps(generator);
+    }
+}
+
+int remove_instructions(code_generator_t *generator, bool *removed) {
+    int *new_index = (int *)malloc(sizeof(int) * (generator->code_size + 1));
+    int kept = 0;
+
+    for (int i = 0; i < generator->code_size; i++) {
+        new_index[i] = kept;
+        if (!removed[i]) kept++;
+    }
+    new_index[generator->code_size] = kept;
+
+    int size = 0;
+    for (int i = 0; i < generator->code_size; i++) {
+        if (removed[i]) continue;
+
+        cg_instruction instruction = generator->code[i];
+        if (instruction.op == JMP || instruction.op == JPC ||
+            instruction.op == CAL) {
+            instruction.modifier = new_index[instruction.modifier];
+        }
+        generator->code[size++] = instruction;
+    }
+
+    int num_removed = generator->code_size - size;
+    generator->code_size = size;
+    free(new_index);
+    return num_removed;
+}
+
+// Three address operations reading the l and m registers
+static bool is_binary(opcode op) {
+    return (op >= ADD && op <= GEQ && op != ODD) || op == MULH;
+}
+
+// Shifts read the l register and take their amount from m
+static bool is_shift(opcode op) {
+    return op == SHL || op == SHR;
+}
+
+// Operations working in place on the r register
+static bool is_unary(opcode op) {
+    return op == NEG || op == ODD;
+}
+
+static bool is_commutative(opcode op) {
+    return op == ADD || op == MUL || op == EQL || op == NEQ;
+}
+
+static register_set reads(cg_instruction *i) {
+    switch (i->op) {
+        case STO:
+        case JPC:
+        case SIO_WRITE:
+        case NEG:
+        case ODD:
+            return REGISTER_BIT(i->regiser_num);
+        case CAL:
+        case RTN:
+            // Unknown code runs next, which may read any register
+            return ALL_REGISTERS;
+        default:
+            if (is_binary(i->op)) {
+                return REGISTER_BIT(i->lex_level) | REGISTER_BIT(i->modifier);
+            }
+            if (is_shift(i->op)) return REGISTER_BIT(i->lex_level);
+            return 0;
+    }
+}
+
+static register_set writes(cg_instruction *i) {
+    switch (i->op) {
+        case LIT:
+        case LOD:
+        case SIO_READ:
+        case NEG:
+        case ODD:
+            return REGISTER_BIT(i->regiser_num);
+        case CAL:
+            return ALL_REGISTERS;
+        default:
+            if (is_binary(i->op) || is_shift(i->op)) {
+                return REGISTER_BIT(i->regiser_num);
+            }
+            return 0;
+    }
+}
+
+/**
+ * @brief Find the registers live after every instruction
+ *
+ * @param generator Generator holding the program's code
+ * @param removed Instructions to treat as deleted, or NULL
+ * @param live_out Set to the registers read later, per instruction
+ */
+static void compute_register_liveness(code_generator_t *generator,
+    bool *removed, register_set *live_out) {
+    cg_instruction *code = generator->code;
+    int size = generator->code_size;
+    register_set *live_in = (register_set *)calloc(size + 1,
+        sizeof(register_set));
+    bool changed = true;
+
+    memset(live_out, 0, sizeof(register_set) * size);
+
+    while (changed) {
+        changed = false;
+        for (int i = size - 1; i >= 0; i--) {
+            cg_instruction *c = &code[i];
+            register_set out = 0;
+
+            if (c->op != JMP && c->op != RTN && c->op != SIO_END) {
+                out |= live_in[i + 1];
+            }
+            if (c->op == JMP || c->op == JPC) out |= live_in[c->modifier];
+
+            register_set in = out;
+            if (removed == NULL || !removed[i]) {
+                in = reads(c) | (out & ~writes(c));
+            }
+
+            if (in != live_in[i] || out != live_out[i]) changed = true;
+            live_in[i] = in;
+            live_out[i] = out;
+        }
+    }
+    free(live_in);
+}
+
+/**
+ * @brief Value numbering state of the basic block being scanned
+ */
+typedef struct value_table {
+    int register_values[NUM_REGISTERS];     // -1 if unknown
+    struct {
+        opcode op;
+        int a, b;
+        int value;
+    } *expressions;
+    int num_expressions;
+    struct {
+        int level, address;
+        int value;
+    } addresses[MAX_TRACKED_ADDRESSES];
+    int num_addresses;
+    int next_value;
+} value_table;
+
+// Value number of an expression, numbering it if it is new
+static int expression_value(value_table *table, opcode op, int a, int b) {
+    for (int i = 0; i < table->num_expressions; i++) {
+        if (table->expressions[i].op == op && table->expressions[i].a == a &&
+            table->expressions[i].b == b) {
+            return table->expressions[i].value;
+        }
+    }
+
+    int n = (table->num_expressions)++;
+    table->expressions[n].op = op;
+    table->expressions[n].a = a;
+    table->expressions[n].b = b;
+    table->expressions[n].value = (table->next_value)++;
+    return table->expressions[n].value;
+}
+
+// Value number held in a register, numbering an unknown value if needed
+static int register_value(value_table *table, int r) {
+    if (table->register_values[r] < 0) {
+        table->register_values[r] = (table->next_value)++;
+    }
+    return table->register_values[r];
+}
+
+static int find_address(value_table *table, int level, int address) {
+    for (int i = 0; i < table->num_addresses; i++) {
+        if (table->addresses[i].level == level &&
+            table->addresses[i].address == address) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void set_address_value(value_table *table, int level, int address,
+    int value) {
+    // The same offset at another level may be the same location
+    for (int i = 0; i < table->num_addresses; i++) {
+        if (table->addresses[i].address == address) {
+            table->addresses[i] = table->addresses[--(table->num_addresses)];
+            i--;
+        }
+    }
+
+    // Forget the oldest address when full
+    if (table->num_addresses == MAX_TRACKED_ADDRESSES) {
+        memmove(&(table->addresses[0]), &(table->addresses[1]),
+            sizeof(table->addresses[0]) * (MAX_TRACKED_ADDRESSES - 1));
+        (table->num_addresses)--;
+    }
+
+    int n = (table->num_addresses)++;
+    table->addresses[n].level = level;
+    table->addresses[n].address = address;
+    table->addresses[n].value = value;
+}
+
+/**
+ * @brief Try to read held instead of the result of instruction i
+ *
+ * Reads of the destination register are renamed until the destination is
+ * written again or is no longer live. Fails if the holding register is
+ * overwritten before the last such read, or if the destination is live at
+ * the end of the block.
+ *
+ * @return bool Whether instruction i may be removed
+ */
+static bool rename_result(code_generator_t *generator, register_set *live_out,
+    int i, int block_end, int held, int *renamed) {
+    cg_instruction *code = generator->code;
+    int destination = code[i].regiser_num;
+    int num_renamed = 0;
+    bool held_overwritten = false;
+
+    for (int j = i + 1; j < block_end; j++) {
+        cg_instruction *c = &code[j];
+
+        if (reads(c) & REGISTER_BIT(destination)) {
+            // In place operations would overwrite the holding register
+            if (held_overwritten || is_unary(c->op) || c->op == CAL ||
+                c->op == RTN) {
+                return false;
+            }
+            renamed[num_renamed++] = j;
+        }
+
+        if ((writes(c) & REGISTER_BIT(destination)) ||
+            !(live_out[j] & REGISTER_BIT(destination))) {
+            for (int k = 0; k < num_renamed; k++) {
+                cg_instruction *r = &code[renamed[k]];
+
+                if (is_binary(r->op)) {
+                    if (r->lex_level == destination) r->lex_level = held;
+                    if (r->modifier == destination) r->modifier = held;
+                } else if (is_shift(r->op)) {
+                    r->lex_level = held;
+                } else {
+                    r->regiser_num = held;
+                }
+            }
+            return true;
+        }
+
+        if (writes(c) & REGISTER_BIT(held)) held_overwritten = true;
+    }
+
+    // Still live when leaving the block
+    return false;
+}
+
+// Number the values of one basic block, marking redundant instructions
+static void number_block(code_generator_t *generator, int start, int end,
+    bool *removed, int *renamed) {
+    static value_table table;
+    register_set *live_out = (register_set *)malloc(
+        sizeof(register_set) * generator->code_size);
+
+    compute_register_liveness(generator, removed, live_out);
+
+    table.expressions = malloc(sizeof(*table.expressions) * (end - start));
+    table.num_expressions = 0;
+    table.num_addresses = 0;
+    table.next_value = 0;
+    for (int r = 0; r < NUM_REGISTERS; r++) table.register_values[r] = -1;
+
+    for (int i = start; i < end; i++) {
+        cg_instruction *c = &(generator->code[i]);
+        int value;
+
+        if (c->op == LIT) {
+            value = expression_value(&table, LIT, c->modifier, 0);
+        } else if (c->op == LOD) {
+            int known = find_address(&table, c->lex_level, c->modifier);
+            if (known >= 0) {
+                value = table.addresses[known].value;
+            } else {
+                value = (table.next_value)++;
+                set_address_value(&table, c->lex_level, c->modifier, value);
+            }
+        } else if (is_unary(c->op)) {
+            value = expression_value(&table, c->op,
+                register_value(&table, c->regiser_num), 0);
+        } else if (is_binary(c->op)) {
+            int a = register_value(&table, c->lex_level);
+            int b = register_value(&table, c->modifier);
+
+            if (is_commutative(c->op) && a > b) {
+                int t = a;
+                a = b;
+                b = t;
+            }
+            value = expression_value(&table, c->op, a, b);
+        } else if (is_shift(c->op)) {
+            // Shift amounts are negative to keep them apart from values
+            value = expression_value(&table, c->op,
+                register_value(&table, c->lex_level), -1 - c->modifier);
+        } else {
+            if (c->op == STO) {
+                set_address_value(&table, c->lex_level, c->modifier,
+                    register_value(&table, c->regiser_num));
+            }
+
+            // Any other result is a new value
+            register_set written = writes(c);
+            for (int r = 0; r < NUM_REGISTERS; r++) {
+                if (written & REGISTER_BIT(r)) table.register_values[r] = -1;
+            }
+            continue;
+        }
+
+        int destination = c->regiser_num;
+        int held = -1;
+        for (int r = 0; r < NUM_REGISTERS; r++) {
+            if (table.register_values[r] == value) {
+                held = r;
+                if (r == destination) break;
+            }
+        }
+
+        if (held == destination) {
+            removed[i] = true;
+        } else if (held >= 0 &&
+            rename_result(generator, live_out, i, end, held, renamed)) {
+            // The destination keeps its previous value
+            removed[i] = true;
+        } else {
+            table.register_values[destination] = value;
+        }
+    }
+
+    free(table.expressions);
+    free(live_out);
+}
+
+void number_values(code_generator_t *generator) {
+    static cfg_t cfg;
+    int size = generator->code_size;
+    bool *removed = (bool *)calloc(size + 1, sizeof(bool));
+    int *renamed = (int *)malloc(sizeof(int) * (size + 1));
+
+    build_cfg(&cfg, generator);
+
+    for (int b = 0; b < cfg.num_blocks; b++) {
+        number_block(generator, cfg.blocks[b].start, cfg.blocks[b].end,
+            removed, renamed);
+    }
+
+    remove_instructions(generator, removed);
+    while (remove_dead_results(generator) > 0);
+
+    free(removed);
+    free(renamed);
+}
+
+int remove_dead_results(code_generator_t *generator) {
+    int size = generator->code_size;
+    register_set *live_out = (register_set *)malloc(
+        sizeof(register_set) * (size + 1));
+    bool *removed = (bool *)calloc(size + 1, sizeof(bool));
+
+    compute_register_liveness(generator, NULL, live_out);
+
+    for (int i = 0; i < size; i++) {
+        cg_instruction *c = &(generator->code[i]);
+
+        // Reads and divisions have effects besides their result
+        bool pure = c->op == LIT || c->op == LOD || is_unary(c->op) ||
+            is_shift(c->op) ||
+            (is_binary(c->op) && c->op != DIV && c->op != MOD);
+
+        if (pure && !(live_out[i] & REGISTER_BIT(c->regiser_num))) {
+            removed[i] = true;
+        }
+    }
+
+    int num_removed = remove_instructions(generator, removed);
+    free(live_out);
+    free(removed);
+    return num_removed;
+}
+
+// Relational opcode with the opposite result, or 0 if there is none
+static opcode inverse_relation(opcode op) {
+    switch (op) {
+        case EQL: return NEQ;
+        case NEQ: return EQL;
+        case LSS: return GEQ;
+        case LEQ: return GTR;
+        case GTR: return LEQ;
+        case GEQ: return LSS;
+        default: return 0;
+    }
+}
+
+// Retarget jumps landing on a JMP to where that JMP finally leads
+static void collapse_jump_chains(code_generator_t *generator) {
+    cg_instruction *code = generator->code;
+
+    for (int i = 0; i < generator->code_size; i++) {
+        if (code[i].op != JMP && code[i].op != JPC) continue;
+
+        // Give up on chains jumping around in a cycle
+        int target = code[i].modifier;
+        for (int hops = 0; hops < generator->code_size &&
+            target >= 0 && target < generator->code_size &&
+            code[target].op == JMP; hops++) {
+            target = code[target].modifier;
+        }
+        code[i].modifier = target;
+    }
+}
+
+// Make room for count instructions at index, moving jump targets along
+static void insert_instructions(code_generator_t *generator, int index,
+    int count) {
+    cg_instruction *code = generator->code;
+
+    for (int i = 0; i < generator->code_size; i++) {
+        if ((code[i].op == JMP || code[i].op == JPC || code[i].op == CAL) &&
+            code[i].modifier >= index) {
+            code[i].modifier += count;
+        }
+    }
+    memmove(&code[index + count], &code[index],
+        sizeof(cg_instruction) * (generator->code_size - index));
+    generator->code_size += count;
+}
+
+/**
+ * @brief Rotate a while loop so its back edge tests the condition itself
+ * 
+ * The loop's JMP back to its condition is replaced by a copy of the 
+ * condition ending in the inverse comparison, and a JPC back into the body 
+ * while the inverse comparison is false. The original condition then only 
+ * guards the first iteration.
+ * 
+ * @param generator Generator holding the program's code
+ * @param cfg Graph of the code
+ * @param live_out Registers live after every instruction
+ * @param jump Index of the loop's JMP back to its condition
+ * @return bool Whether the loop was rotated
+ */
+static bool rotate_loop(code_generator_t *generator, cfg_t *cfg,
+    register_set *live_out, int jump) {
+    cg_instruction *code = generator->code;
+    int condition = code[jump].modifier;
+
+    if (condition < 0 || condition >= jump) return false;
+
+    // The condition must be one block, ending in a comparison and a JPC
+    // leaving the loop
+    basic_block *block = &(cfg->blocks[cfg->block_of[condition]]);
+    int exit = block->end - 1;
+    if (block->start != condition || exit - 1 < condition) return false;
+
+    cg_instruction *test = &code[exit];
+    cg_instruction *compare = &code[exit - 1];
+    if (test->op != JPC || test->modifier != jump + 1) return false;
+    if (inverse_relation(compare->op) == 0 ||
+        compare->regiser_num != test->regiser_num) {
+        return false;
+    }
+
+    // The inverted result is left in the register, so nobody may read it
+    if (live_out[exit] & REGISTER_BIT(test->regiser_num)) return false;
+
+    int length = exit - condition;
+    if (generator->code_size + length > MAX_CODE_LENGTH) return false;
+
+    int body = exit + 1;
+    insert_instructions(generator, jump + 1, length);
+    for (int k = 0; k < length; k++) {
+        code[jump + k] = code[condition + k];
+    }
+    code[jump + length - 1].op = inverse_relation(compare->op);
+    code[jump + length] = create_instruction(JPC, test->regiser_num, 0, body);
+    return true;
+}
+
+void thread_jumps(code_generator_t *generator) {
+    static cfg_t cfg;
+    bool rotated = true;
+
+    collapse_jump_chains(generator);
+
+    // Code moves with every rotation, so start over after each one
+    while (rotated) {
+        register_set *live_out = (register_set *)malloc(
+            sizeof(register_set) * generator->code_size);
+
+        rotated = false;
+        build_cfg(&cfg, generator);
+        compute_register_liveness(generator, NULL, live_out);
+
+        for (int i = 0; i < generator->code_size && !rotated; i++) {
+            if (generator->code[i].op == JMP) {
+                rotated = rotate_loop(generator, &cfg, live_out, i);
+            }
+        }
+        free(live_out);
+    }
+
+    // Jumps to the next instruction do nothing
+    bool *removed = (bool *)calloc(generator->code_size + 1, sizeof(bool));
+    for (int i = 0; i < generator->code_size; i++) {
+        if (generator->code[i].op == JMP &&
+            generator->code[i].modifier == i + 1) {
+            removed[i] = true;
+        }
+    }
+    remove_instructions(generator, removed);
+    free(removed);
+}
@@ -0,0 +1,72 @@
+#ifndef CODEOPT_H
+#define CODEOPT_H
+
+/**
+ * @file codeopt.h
+ * @brief Optimization passes over generated instructions
+ *
+ */
+
+#include "codegen.h"
+#include "options.h"
+
+#include <stdbool.h>
+
+/**
+ * @brief Run the instruction passes enabled by the options
+ *
+ * @param generator Generator holding the program's code, modified in place
+ * @param options Options the program is compiled with
+ */
+void optimize_code(code_generator_t *generator, compile_options_t *options);
+
+/**
+ * @brief Delete the marked instructions and fix up jump targets
+ *
+ * Jumps to a deleted instruction land on the next instruction that is kept.
+ *
+ * @param generator Generator holding the program's code
+ * @param removed Whether each instruction is to be deleted
+ * @return int Number of instructions deleted
+ */
+int remove_instructions(code_generator_t *generator, bool *removed);
+
+/**
+ * @brief Reuse values already held in registers within basic blocks
+ *
+ * Local value numbering over each straight-line run of instructions. An
+ * instruction recomputing a value that another register still holds, such
+ * as the second a * b in (a * b) + (a * b) * c, is removed and later reads
+ * of its register are renamed to the register holding the value. Stores
+ * invalidate the value known for their address, and values stored are
+ * forwarded to later loads of the same address.
+ *
+ * Instructions whose result is never read are removed afterwards.
+ *
+ * @param generator Generator holding the program's code, modified in place
+ */
+void number_values(code_generator_t *generator);
+
+/**
+ * @brief Shorten the jumps taken by the program
+ *
+ * Jumps to a JMP go straight to where that JMP leads, and JMPs to the next
+ * instruction are removed. The JMP closing a while loop is replaced by a
+ * copy of the loop's condition with the comparison inverted and a JPC back
+ * to the start of the body, so each iteration takes one jump instead of
+ * two. Loops whose condition does not end in an invertible comparison, such
+ * as odd, keep their JMP.
+ *
+ * @param generator Generator holding the program's code, modified in place
+ */
+void thread_jumps(code_generator_t *generator);
+
+/**
+ * @brief Remove instructions whose register result is never read
+ *
+ * @param generator Generator holding the program's code, modified in place
+ * @return int Number of instructions removed
+ */
+int remove_dead_results(code_generator_t *generator);
+
+#endif /* CODEOPT_H */
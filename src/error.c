@@ -29,10 +29,22 @@ char *error_type_strings[] = {
     "Attempted to read value into a non-variable identifier",
     "Attempted to write value from a non-existant identifier",
     "Attempted to write value from an identifier that is not a variable nor constant.",
-    "Attempted to redeclare existing identifier."
+    "Attempted to redeclare existing identifier.",
+    "Identifier expected in procedure declaration.",
+    "Semicolon expected in procedure declaration.",
+    "Identifier expected after keyword call in call statement.",
+    "Attempted to call an identifier that is not a procedure.",
+    "Procedures are nested too deeply.",
+    "Too many identifiers declared in scope at once."
 };
 
 void error(error_type e) {
     fprintf(stderr, "Error: %s\n", error_type_strings[e]);
     exit(e);
 }
+
+void print_diagnostic(diagnostic *d) {
+    fprintf(stderr, "Error at token %d (%s): %s\n", d->token,
+        token_to_string(d->found),
+        error_type_strings[d->type]);
+}
@@ -1,6 +1,8 @@
 #ifndef ERROR_H
 #define ERROR_H
 
+#include "token.h"
+
 typedef enum error_type {
     PERIOD_EXPECTED = 1,
     IDENTIFIER_EXPECTED_CONST_DECLARATION,
@@ -26,9 +28,36 @@ typedef enum error_type {
     READ_INTO_NON_VARIABLE,
     WRITE_FROM_INVALID_IDENTIFIER,
     WRITE_FROM_NON_VAR_CONST_IDENTIFIER,
-    IDENTIFIER_ALREADY_DECLARED
+    IDENTIFIER_ALREADY_DECLARED,
+    IDENTIFIER_EXPECTED_PROCEDURE_DECLARATION,
+    SEMICOLON_EXPECTED_PROCEDURE_DECLARATION,
+    IDENTIFIER_EXPECTED_CALL_STATEMENT,
+    CALL_OF_NON_PROCEDURE,
+    PROCEDURES_NESTED_TOO_DEEPLY,
+    SYMBOL_TABLE_FULL
 } error_type;
 
+/**
+ * @brief Error found while parsing, and where
+ */
+typedef struct diagnostic {
+    error_type type;
+    int token;          // Index of the token the error was found at
+    token_type found;   // Type of that token
+} diagnostic;
+
+/**
+ * @brief Print an error and exit with its type as the exit code
+ *
+ * @param e The error
+ */
 void error(error_type e);
 
+/**
+ * @brief Print a diagnostic to stderr, along with the token it is at
+ *
+ * @param d The diagnostic to print
+ */
+void print_diagnostic(diagnostic *d);
+
 #endif /* ERROR_H */
@@ -0,0 +1,319 @@
+// getline and fmemopen are POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
+
+#include "incremental.h"
+#include "error.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Make room for a number of statements
+static void reserve_statements(incremental_t *session, int count) {
+    if (count <= session->statements_capacity) return;
+
+    while (session->statements_capacity < count) {
+        session->statements_capacity = session->statements_capacity > 0 ?
+            session->statements_capacity * 2 : 64;
+    }
+    session->statements = (ir_node **)realloc(session->statements,
+        sizeof(ir_node *) * session->statements_capacity);
+    session->spans = (statement_span *)realloc(session->spans,
+        sizeof(statement_span) * session->statements_capacity);
+    if (session->statements == NULL || session->spans == NULL) {
+        fprintf(stderr, "ERROR: Could not allocate statements\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Collect the statements of the main block's begin statement
+static void find_statements(incremental_t *session) {
+    ir_node *statement = session->parser.program->left;
+
+    session->num_statements = 0;
+    session->begin = statement->kind == IR_BEGIN ? statement : NULL;
+    if (session->begin == NULL) return;
+
+    for (ir_node *s = statement->left; s != NULL; s = s->next) {
+        int k = (session->num_statements)++;
+        reserve_statements(session, session->num_statements);
+        session->statements[k] = s;
+        session->spans[k].first_token = s->first_token;
+        session->spans[k].end_token = s->end_token;
+    }
+}
+
+// Optimize and lower the program, leaving its IR and symbols as parsed
+static void generate(incremental_t *session) {
+    parser_t *parser = &(session->parser);
+    ir_node *program = parser->program;
+
+    parser->symbol_table = session->declared;
+    init_code_generator(&(parser->code_generator));
+    free_ir_arena(&(session->scratch));
+
+    // Optimization changes the IR it runs over, lowering does not
+    if (parser->options.optimization_level > 0) {
+        program = copy_ir(&(session->scratch), program);
+    }
+    generate_program(parser, program, &(session->scratch));
+}
+
+// Parse the program from scratch, keeping its errors in the parser
+static void parse_fully(incremental_t *session) {
+    parser_t *parser = &(session->parser);
+    token_list_t *tokens = parser->token_list;
+    compile_options_t options = parser->options;
+
+    free_parser(parser);
+    init_parser(parser, tokens, &options);
+    parser->program = parse_block(parser, TOKEN_SET(periodsym));
+    if (current_type(parser) != periodsym) {
+        report_error(parser, PERIOD_EXPECTED);
+    }
+
+    session->declared = parser->symbol_table;
+    find_statements(session);
+    session->generated = false;
+    session->reparsed_tokens = 0;
+    (session->full_parses)++;
+}
+
+int start_incremental(incremental_t *session, token_list_t *tokens,
+    compile_options_t *options) {
+    init_parser(&(session->parser), tokens, options);
+    session->begin = NULL;
+    session->generated = false;
+    session->statements = NULL;
+    session->spans = NULL;
+    session->num_statements = 0;
+    session->statements_capacity = 0;
+    init_ir_arena(&(session->scratch));
+    session->reparsed_tokens = 0;
+    session->incremental_updates = 0;
+    session->full_parses = 0;
+
+    parse_fully(session);
+    return session->parser.num_diagnostics;
+}
+
+// Whether any of the tokens could declare a symbol
+static bool declares(token_list_t *tokens, int first, int count) {
+    for (int i = first; i < first + count; i++) {
+        token_type type = (token_type)tokens->types[i];
+        if (type == constsym || type == varsym || type == procsym) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether the edit only touches statements of the main block
+static bool can_reparse(incremental_t *session, token_edit *edit) {
+    // The errors of a malformed program may lie anywhere in it, and the
+    // statements recovered from them need not line up with the tokens
+    if (session->begin == NULL || session->parser.num_diagnostics > 0) {
+        return false;
+    }
+
+    // Inserting right before the begin statement's end is still inside
+    statement_span *spans = session->spans;
+    int end = spans[session->num_statements - 1].end_token;
+    if (edit->first < spans[0].first_token ||
+        edit->first + edit->removed > end) {
+        return false;
+    }
+
+    // The IR of replaced statements is only freed by a full parse
+    if (session->reparsed_tokens > session->parser.token_list->size) {
+        return false;
+    }
+
+    return !declares(session->parser.token_list, edit->first,
+        edit->removed) &&
+        !declares(edit->inserted, 0, edit->inserted->size);
+}
+
+// Last statement starting at or before a token
+static int statement_at(incremental_t *session, int index) {
+    int low = 0, high = session->num_statements - 1;
+
+    while (low < high) {
+        int middle = (low + high + 1) / 2;
+        if (session->spans[middle].first_token <= index) low = middle;
+        else high = middle - 1;
+    }
+    return low;
+}
+
+// Parse the statements around an edit already applied to the tokens.
+// Returns false, leaving the statements as they were, if the edit made
+// them malformed.
+static bool reparse(incremental_t *session, token_edit *edit) {
+    parser_t *parser = &(session->parser);
+    ir_node **statements = session->statements;
+    statement_span *spans = session->spans;
+    int n = session->num_statements;
+    int delta = edit->inserted->size - edit->removed;
+    // Index the first token after the edit had before it
+    int unchanged = edit->first + edit->removed;
+    int first = statement_at(session, edit->first);
+    int start = spans[first].first_token;
+    ir_node *head = NULL;
+    ir_node *tail = NULL;
+    int count = 0;
+    int last = first;
+
+    parser->symbol_table = session->declared;
+    parser->level = 0;
+    parser->token_cursor = start;
+
+    while (true) {
+        int statement_start = parser->token_cursor;
+        ir_node *s = parse_statement(parser, TOKEN_SET(semicolonsym) |
+            TOKEN_SET(endsym) | TOKEN_SET(periodsym));
+        if (parser->num_diagnostics > 0) return false;
+        s->first_token = statement_start;
+        s->end_token = parser->token_cursor;
+        if (head == NULL) head = s;
+        else tail->next = s;
+        tail = s;
+        count++;
+
+        // Parsing continues like before once a statement ends where one
+        // did before, at a separator the edit left alone
+        while (last < n && (spans[last].end_token < unchanged ||
+            spans[last].end_token + delta < parser->token_cursor)) {
+            last++;
+        }
+        if (last < n &&
+            spans[last].end_token + delta == parser->token_cursor) {
+            break;
+        }
+
+        if (current_type(parser) != semicolonsym) {
+            // The begin statement ends here, and the program with it
+            if (current_type(parser) != endsym ||
+                next_type(parser) != periodsym) {
+                return false;
+            }
+            last = n - 1;
+            break;
+        }
+
+        // Consume semicolon
+        next_type(parser);
+    }
+    session->reparsed_tokens += parser->token_cursor - start;
+
+    // Put the new statements in place of the ones from first to last
+    tail->next = last + 1 < n ? statements[last + 1] : NULL;
+    if (first == 0) session->begin->left = head;
+    else statements[first - 1]->next = head;
+
+    int kept = n - last - 1;
+    reserve_statements(session, first + count + kept);
+    statements = session->statements;
+    spans = session->spans;
+    memmove(&statements[first + count], &statements[last + 1],
+        sizeof(ir_node *) * kept);
+    memmove(&spans[first + count], &spans[last + 1],
+        sizeof(statement_span) * kept);
+    for (int k = first; head != tail->next; head = head->next, k++) {
+        statements[k] = head;
+        spans[k].first_token = head->first_token;
+        spans[k].end_token = head->end_token;
+    }
+    if (delta != 0) {
+        for (int k = first + count; k < first + count + kept; k++) {
+            spans[k].first_token += delta;
+            spans[k].end_token += delta;
+        }
+    }
+    session->num_statements = first + count + kept;
+    return true;
+}
+
+int update_incremental(incremental_t *session, token_edit *edit) {
+    token_list_t *tokens = session->parser.token_list;
+
+    // The sentinel at the end is never edited
+    if (edit->first < 0 || edit->removed < 0 ||
+        edit->first + edit->removed > tokens->size - 1) {
+        fprintf(stderr, "ERROR: Edit of %d tokens at %d is out of range\n",
+            edit->removed, edit->first);
+        exit(EXIT_FAILURE);
+    }
+
+    bool incremental = can_reparse(session, edit);
+    splice_tokens(tokens, edit->first, edit->removed, edit->inserted);
+    if (!incremental) {
+        parse_fully(session);
+        return session->parser.num_diagnostics;
+    }
+
+    // Errors are kept like when parsing from scratch, all of them
+    if (!reparse(session, edit)) {
+        parse_fully(session);
+        return session->parser.num_diagnostics;
+    }
+    session->generated = false;
+    (session->incremental_updates)++;
+    return 0;
+}
+
+code_generator_t *incremental_code(incremental_t *session) {
+    if (!session->generated) {
+        generate(session);
+        session->generated = true;
+    }
+    return &(session->parser.code_generator);
+}
+
+void free_incremental(incremental_t *session) {
+    free_parser(&(session->parser));
+    free_ir_arena(&(session->scratch));
+    free(session->statements);
+    free(session->spans);
+    session->statements = NULL;
+    session->spans = NULL;
+    session->num_statements = 0;
+    session->statements_capacity = 0;
+    session->begin = NULL;
+}
+
+bool read_edit(FILE *in, token_edit *edit) {
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t length;
+
+    while ((length = getline(&line, &size, in)) != -1) {
+        int offset;
+
+        if (strspn(line, " \t\r\n") == (size_t)length) continue;
+        if (sscanf(line, "%d %d %n", &(edit->first), &(edit->removed),
+            &offset) != 2) {
+            fprintf(stderr, "ERROR: Malformed edit: %s", line);
+            exit(EXIT_FAILURE);
+        }
+
+        if (offset == length) {
+            edit->inserted = create_token_list();
+        } else {
+            FILE *lexemes = fmemopen(&line[offset], length - offset, "r");
+            if (lexemes == NULL) {
+                fprintf(stderr, "ERROR: Could not read edit from memory\n");
+                exit(EXIT_FAILURE);
+            }
+            edit->inserted = read_token_list(lexemes);
+            fclose(lexemes);
+            // Drop the sentinel read_token_list appends
+            (edit->inserted->size)--;
+        }
+
+        free(line);
+        return true;
+    }
+
+    free(line);
+    return false;
+}
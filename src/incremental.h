@@ -0,0 +1,144 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+/**
+ * @file incremental.h
+ * @brief Keeps a program compiled across edits, reparsing only what changed
+ *
+ * A session keeps the token list, the unoptimized IR and the symbol table
+ * of the program as last parsed. An edit replaces a range of tokens. If the
+ * range lies in the statements of the main block's begin statement, only the
+ * top-level statements around it are parsed again, from the first one the
+ * edit touches until parsing reaches the end of a statement the edit left
+ * alone. The new statements replace the old ones in the IR. Parsing a
+ * statement only depends on the symbols declared before it, so the IR and
+ * any error are the same as when parsing the edited tokens from scratch.
+ *
+ * Optimization and lowering look at the whole program, so code is only
+ * generated when asked for, after any number of edits. Errors parsing an
+ * edit are not reported, but kept in the session's parser until the next
+ * edit, since an editor passes through malformed programs on the way to a
+ * well formed one. The caller decides when to report them, while errors
+ * generating code, such as exceeding MAX_CODE_LENGTH, are reported once the
+ * code is asked for.
+ *
+ * Edits touching declarations, procedures or anything outside of the main
+ * block's statements, and edits removing or inserting const, var or
+ * procedure, may change the symbols and are parsed from scratch. So is
+ * every edit once as many tokens were reparsed as the program holds, to
+ * free the IR of replaced statements, and every edit of a program with
+ * errors, so the errors kept are those of the whole edited program.
+ *
+ */
+
+#include "parser.h"
+#include "token_list.h"
+#include "options.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/**
+ * @brief Tokens a top-level statement was parsed from
+ *
+ * Kept apart from the IR, so shifting the statements after an edit only
+ * touches a dense array.
+ */
+typedef struct statement_span {
+    int first_token;
+    int end_token;          // One past the last token
+} statement_span;
+
+/**
+ * @brief Replacement of a range of tokens
+ */
+typedef struct token_edit {
+    int first;                  // Index of the first token replaced
+    int removed;                // Number of tokens replaced
+    token_list_t *inserted;     // Tokens put in their place
+} token_edit;
+
+typedef struct incremental_t {
+    parser_t parser;            // Tokens, IR and code of the program
+    symbol_table_t declared;    // Symbols as parsing left them
+    ir_node *begin;             // Main block's begin statement, or NULL
+    ir_node **statements;       // Statements of the begin statement
+    statement_span *spans;      // Tokens of each of the statements
+    int num_statements;
+    int statements_capacity;
+    ir_arena_t scratch;         // Copy of the IR being optimized
+    bool generated;             // Whether the code is that of the IR
+    int reparsed_tokens;        // Tokens reparsed since the last full parse
+    long incremental_updates;   // Edits reparsing top-level statements only
+    long full_parses;         // Parses from scratch, the first included
+} incremental_t;
+
+/**
+ * @brief Parse a program, keeping what later edits need
+ *
+ * Errors in the program are kept in session->parser.diagnostics, in the
+ * order parse_program finds them, and can be reported by
+ * report_diagnostics.
+ *
+ * @param session The session to start
+ * @param tokens Tokens of the program, changed by edits, owned by the caller
+ * @param options Options to compile the program with
+ * @return int Number of errors in the program
+ */
+int start_incremental(incremental_t *session, token_list_t *tokens,
+    compile_options_t *options);
+
+/**
+ * @brief Apply an edit to the tokens and parse the program again
+ *
+ * Errors in the edited program replace those kept before, like by
+ * start_incremental. The session can be edited further whether or not the
+ * program has errors. If the edit's range is not inside of the tokens, an
+ * error is logged to stderr and the program is exited with EXIT_FAILURE.
+ *
+ * @param session The session to edit
+ * @param edit The edit to apply, its tokens are copied
+ * @return int Number of errors in the edited program
+ */
+int update_incremental(incremental_t *session, token_edit *edit);
+
+/**
+ * @brief Returns the code of the program as last edited
+ *
+ * The code is generated if an edit changed the program since it last was.
+ * The program must have no errors. Errors generating it are reported like
+ * by parse_program.
+ *
+ * @param session The session whose code to generate
+ * @return code_generator_t* Generator holding the code, owned by the session
+ */
+code_generator_t *incremental_code(incremental_t *session);
+
+/**
+ * @brief Free the IR and statements of a session
+ *
+ * The token list is owned by the caller and is not freed.
+ *
+ * @param session The session to free
+ */
+void free_incremental(incremental_t *session);
+
+/**
+ * @brief Read the next edit of an edit list
+ *
+ * Every line of an edit list holds one edit: the index of the first token
+ * replaced, the number of tokens replaced, and the tokens inserted as a
+ * lexeme list, e.g. "12 3 2 y 4 3 5" replaces tokens 12 to 14 by "y + 5".
+ * Blank lines are skipped.
+ *
+ * If the line is malformed, an error is logged to stderr and the program
+ * is exited with EXIT_FAILURE.
+ *
+ * @param in Stream to read the edit from
+ * @param edit Set to the edit read, its inserted tokens to be freed by the
+ * caller
+ * @return bool False at the end of the list
+ */
+bool read_edit(FILE *in, token_edit *edit);
+
+#endif /* INCREMENTAL_H */
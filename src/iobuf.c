@@ -0,0 +1,178 @@
+// read is POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
+
+#include "iobuf.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Longest text value: sign, 10 digits and a newline
+#define MAX_TEXT_LENGTH 12
+
+static char *allocate_buffer(void) {
+    char *data = (char *)malloc(IO_BUFFER_SIZE);
+    if (data == NULL) {
+        fprintf(stderr, "Could not allocate an I/O buffer\n");
+        exit(EXIT_FAILURE);
+    }
+    return data;
+}
+
+void init_output_buffer(output_buffer_t *buffer, FILE *stream,
+    io_format format) {
+    buffer->stream = stream;
+    buffer->format = format;
+    buffer->data = NULL;
+    buffer->length = 0;
+}
+
+void write_buffered_int(output_buffer_t *buffer, int value) {
+    if (buffer->data == NULL) buffer->data = allocate_buffer();
+    if (buffer->length + MAX_TEXT_LENGTH > IO_BUFFER_SIZE) {
+        flush_output_buffer(buffer);
+    }
+
+    char *out = &(buffer->data[buffer->length]);
+
+    if (buffer->format == IO_BINARY) {
+        memcpy(out, &value, sizeof(int));
+        buffer->length += sizeof(int);
+        return;
+    }
+
+    // Digits come out backwards, so build them at the end of a scratch area
+    char digits[MAX_TEXT_LENGTH];
+    int n = MAX_TEXT_LENGTH;
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value :
+        (unsigned int)value;
+
+    digits[--n] = '\n';
+    do {
+        digits[--n] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0) digits[--n] = '-';
+
+    memcpy(out, &digits[n], MAX_TEXT_LENGTH - n);
+    buffer->length += MAX_TEXT_LENGTH - n;
+}
+
+void flush_output_buffer(output_buffer_t *buffer) {
+    if (buffer->length > 0) {
+        fwrite(buffer->data, 1, buffer->length, buffer->stream);
+        buffer->length = 0;
+    }
+    fflush(buffer->stream);
+}
+
+void free_output_buffer(output_buffer_t *buffer) {
+    if (buffer->data != NULL) flush_output_buffer(buffer);
+    free(buffer->data);
+    buffer->data = NULL;
+}
+
+void init_input_buffer(input_buffer_t *buffer, FILE *stream, io_format format,
+    output_buffer_t *tied) {
+    buffer->stream = stream;
+    buffer->format = format;
+    buffer->data = NULL;
+    buffer->length = 0;
+    buffer->cursor = 0;
+    buffer->end_of_input = false;
+    buffer->tied = tied;
+}
+
+// Read more bytes after the unparsed ones, returns false at end of input
+static bool refill(input_buffer_t *buffer) {
+    if (buffer->end_of_input) return false;
+    if (buffer->data == NULL) buffer->data = allocate_buffer();
+    if (buffer->tied != NULL) flush_output_buffer(buffer->tied);
+
+    // Keep the bytes of a value cut off by the end of the buffer
+    int kept = buffer->length - buffer->cursor;
+    memmove(buffer->data, &(buffer->data[buffer->cursor]), kept);
+    buffer->length = kept;
+    buffer->cursor = 0;
+
+    ssize_t count;
+    do {
+        count = read(fileno(buffer->stream), &(buffer->data[kept]),
+            IO_BUFFER_SIZE - kept);
+    } while (count < 0 && errno == EINTR);
+
+    if (count <= 0) {
+        buffer->end_of_input = true;
+        return false;
+    }
+    buffer->length += count;
+    return true;
+}
+
+// Next byte without consuming it, or -1 at end of input
+static int peek(input_buffer_t *buffer) {
+    if (buffer->cursor == buffer->length && !refill(buffer)) return -1;
+    return (unsigned char)buffer->data[buffer->cursor];
+}
+
+static bool is_space(int c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' ||
+        c == '\f';
+}
+
+bool read_buffered_int(input_buffer_t *buffer, int *value) {
+    if (buffer->format == IO_BINARY) {
+        while (buffer->length - buffer->cursor < (int)sizeof(int)) {
+            if (!refill(buffer)) return false;
+        }
+        memcpy(value, &(buffer->data[buffer->cursor]), sizeof(int));
+        buffer->cursor += sizeof(int);
+        return true;
+    }
+
+    int c;
+    while (is_space(c = peek(buffer))) (buffer->cursor)++;
+
+    bool negative = c == '-';
+    if (c == '-' || c == '+') {
+        (buffer->cursor)++;
+        c = peek(buffer);
+    }
+    if (c < '0' || c > '9') return false;
+
+    unsigned int magnitude = 0;
+    while (c >= '0' && c <= '9') {
+        magnitude = magnitude * 10 + (unsigned int)(c - '0');
+        (buffer->cursor)++;
+        c = peek(buffer);
+    }
+
+    *value = (int)(negative ? 0u - magnitude : magnitude);
+    return true;
+}
+
+void free_input_buffer(input_buffer_t *buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+}
+
+char *read_whole_stream(FILE *in, size_t *size, const char *what) {
+    size_t capacity = IO_BUFFER_SIZE;
+    char *data = (char *)malloc(capacity);
+    *size = 0;
+
+    // One byte is kept for the NUL
+    while (data != NULL) {
+        *size += fread(&data[*size], 1, capacity - 1 - *size, in);
+        if (*size < capacity - 1) break;
+        capacity *= 2;
+        data = (char *)realloc(data, capacity);
+    }
+    if (data == NULL) {
+        fprintf(stderr, "ERROR: Could not read %s into memory\n", what);
+        exit(EXIT_FAILURE);
+    }
+    data[*size] = '\0';
+    return data;
+}
@@ -0,0 +1,128 @@
+#ifndef IOBUF_H
+#define IOBUF_H
+
+/**
+ * @file iobuf.h
+ * @brief Buffered integer input and output for the virtual machine
+ *
+ * Values are parsed and formatted by hand in large buffers, so reading or
+ * writing a value is a few byte operations rather than a call into stdio,
+ * and the operating system is only asked for data once a buffer runs empty
+ * or full.
+ *
+ * In text mode values are decimal integers separated by whitespace on
+ * input, and one per line on output. In binary mode every value is a raw
+ * 32 bit integer in the host's byte order.
+ *
+ * Readers that parse a whole stream at once, such as those of lexeme lists
+ * and listings, load it with read_whole_stream.
+ *
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Bytes held by a buffer, allocated on first use
+#define IO_BUFFER_SIZE 65536
+
+typedef enum io_format {
+    IO_TEXT = 0,
+    IO_BINARY
+} io_format;
+
+typedef struct output_buffer_t {
+    FILE *stream;       // Stream the buffer is flushed to
+    io_format format;
+    char *data;         // NULL until the first write
+    int length;         // Bytes waiting to be flushed
+} output_buffer_t;
+
+typedef struct input_buffer_t {
+    FILE *stream;       // Stream the buffer is filled from
+    io_format format;
+    char *data;         // NULL until the first read
+    int length;         // Bytes in the buffer
+    int cursor;         // Next byte to parse
+    bool end_of_input;  // Whether the stream has no more bytes
+    output_buffer_t *tied;  // Flushed before waiting for more input, or NULL
+} input_buffer_t;
+
+/**
+ * @brief Initialize an empty output buffer
+ *
+ * @param buffer The buffer to initialize
+ * @param stream Stream to flush to
+ * @param format How values are written
+ */
+void init_output_buffer(output_buffer_t *buffer, FILE *stream,
+    io_format format);
+
+/**
+ * @brief Append a value, flushing first if the buffer is full
+ *
+ * @param buffer Buffer to write to
+ * @param value Value to write
+ */
+void write_buffered_int(output_buffer_t *buffer, int value);
+
+/**
+ * @brief Write everything buffered to the stream
+ *
+ * @param buffer Buffer to flush
+ */
+void flush_output_buffer(output_buffer_t *buffer);
+
+/**
+ * @brief Flush and free the memory of an output buffer
+ *
+ * @param buffer Buffer to free
+ */
+void free_output_buffer(output_buffer_t *buffer);
+
+/**
+ * @brief Initialize an empty input buffer
+ *
+ * The buffer reads the stream's file descriptor directly, so nothing else
+ * should read the stream through stdio.
+ *
+ * @param buffer The buffer to initialize
+ * @param stream Stream to read from
+ * @param format How values are read
+ * @param tied Output to flush before blocking on input, or NULL
+ */
+void init_input_buffer(input_buffer_t *buffer, FILE *stream, io_format format,
+    output_buffer_t *tied);
+
+/**
+ * @brief Read the next value
+ *
+ * Text values wrap around like unsigned arithmetic if they do not fit.
+ *
+ * @param buffer Buffer to read from
+ * @param value Set to the value read
+ * @return bool False if the input ended or holds something else
+ */
+bool read_buffered_int(input_buffer_t *buffer, int *value);
+
+/**
+ * @brief Free the memory of an input buffer
+ *
+ * @param buffer Buffer to free
+ */
+void free_input_buffer(input_buffer_t *buffer);
+
+/**
+ * @brief Read all of a stream into memory, NUL terminated
+ *
+ * If the memory cannot be allocated, an error naming what was read is
+ * logged to stderr and the program is exited with EXIT_FAILURE.
+ *
+ * @param in Stream to read
+ * @param size Set to the number of bytes read, without the NUL
+ * @param what What the stream holds, for the error message
+ * @return char* The bytes read, to be freed by the caller
+ */
+char *read_whole_stream(FILE *in, size_t *size, const char *what);
+
+#endif /* IOBUF_H */
@@ -0,0 +1,225 @@
+#include "ir.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void init_ir_arena(ir_arena_t *arena) {
+    arena->current = NULL;
+    // Forces a block to be allocated on the first node
+    arena->used = IR_ARENA_BLOCK_SIZE;
+}
+
+void free_ir_arena(ir_arena_t *arena) {
+    while (arena->current != NULL) {
+        ir_arena_block *previous = arena->current->previous;
+        free(arena->current);
+        arena->current = previous;
+    }
+    arena->used = IR_ARENA_BLOCK_SIZE;
+}
+
+void clear_ir_arena(ir_arena_t *arena) {
+    if (arena->current == NULL) return;
+
+    while (arena->current->previous != NULL) {
+        ir_arena_block *previous = arena->current->previous;
+        arena->current->previous = previous->previous;
+        free(previous);
+    }
+    arena->used = 0;
+}
+
+ir_node *create_ir_node(ir_arena_t *arena, ir_kind kind) {
+    if (arena->used == IR_ARENA_BLOCK_SIZE) {
+        ir_arena_block *block = (ir_arena_block *)malloc(
+            sizeof(ir_arena_block));
+
+        if (block == NULL) {
+            fprintf(stderr, "ERROR: IR arena allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+
+        block->previous = arena->current;
+        arena->current = block;
+        arena->used = 0;
+    }
+
+    ir_node *node = &(arena->current->nodes[(arena->used)++]);
+    memset(node, 0, sizeof(ir_node));
+    node->kind = kind;
+    return node;
+}
+
+ir_node *ir_number(ir_arena_t *arena, int value) {
+    ir_node *node = create_ir_node(arena, IR_NUMBER);
+    node->value = value;
+    return node;
+}
+
+ir_node *ir_variable(ir_arena_t *arena, symbol *sym) {
+    ir_node *node = create_ir_node(arena, IR_VARIABLE);
+    node->sym = sym;
+    return node;
+}
+
+ir_node *ir_operation(ir_arena_t *arena, opcode op, ir_node *left,
+    ir_node *right) {
+    ir_node *node = create_ir_node(arena, right == NULL ? IR_UNARY : IR_BINARY);
+    node->op = op;
+    node->left = left;
+    node->right = right;
+    return node;
+}
+
+ir_node *ir_statement(ir_arena_t *arena, ir_kind kind, symbol *sym,
+    ir_node *left, ir_node *right) {
+    ir_node *node = create_ir_node(arena, kind);
+    node->sym = sym;
+    node->left = left;
+    node->right = right;
+    return node;
+}
+
+// Whether a node is part of an expression rather than a statement
+static bool is_expression(ir_node *node) {
+    return node->kind == IR_NUMBER || node->kind == IR_VARIABLE ||
+        node->kind == IR_UNARY || node->kind == IR_BINARY;
+}
+
+// Copy an expression without recursing, its nodes are listed in order
+static ir_node *copy_expression(ir_arena_t *arena, ir_node *node,
+    ir_order_t *order) {
+    list_expression(order, node);
+
+    // Copies of the operands not yet used, the listing's stack is free
+    ir_node **copies = order->pending;
+    int num_copies = 0;
+
+    for (int i = 0; i < order->size; i++) {
+        ir_node *copy = create_ir_node(arena, order->nodes[i]->kind);
+
+        *copy = *(order->nodes[i]);
+        if (copy->kind == IR_BINARY) copy->right = copies[--num_copies];
+        if (copy->kind == IR_BINARY || copy->kind == IR_UNARY) {
+            copy->left = copies[--num_copies];
+        }
+        copies[num_copies++] = copy;
+    }
+    return copies[0];
+}
+
+static ir_node *copy_nodes(ir_arena_t *arena, ir_node *node,
+    ir_order_t *order) {
+    ir_node *first = NULL;
+    ir_node *last = NULL;
+
+    // Chains of statements can be long, so they are copied in a loop
+    for (; node != NULL; node = node->next) {
+        ir_node *copy;
+
+        if (is_expression(node)) {
+            copy = copy_expression(arena, node, order);
+        } else {
+            copy = create_ir_node(arena, node->kind);
+            *copy = *node;
+            copy->left = copy_nodes(arena, node->left, order);
+            copy->right = copy_nodes(arena, node->right, order);
+        }
+        copy->next = NULL;
+
+        if (first == NULL) first = copy;
+        else last->next = copy;
+        last = copy;
+    }
+    return first;
+}
+
+ir_node *copy_ir(ir_arena_t *arena, ir_node *node) {
+    ir_order_t order;
+
+    init_ir_order(&order);
+    ir_node *copy = copy_nodes(arena, node, &order);
+    free_ir_order(&order);
+    return copy;
+}
+
+void init_ir_order(ir_order_t *order) {
+    order->nodes = NULL;
+    order->sizes = NULL;
+    order->values = NULL;
+    order->marks = NULL;
+    order->pending = NULL;
+    order->size = 0;
+    order->capacity = 0;
+}
+
+void free_ir_order(ir_order_t *order) {
+    free(order->nodes);
+    free(order->sizes);
+    free(order->values);
+    free(order->marks);
+    free(order->pending);
+    init_ir_order(order);
+}
+
+static void grow_order(ir_order_t *order) {
+    int capacity = order->capacity > 0 ? order->capacity * 2 : 64;
+
+    order->nodes = (ir_node **)realloc(order->nodes,
+        sizeof(ir_node *) * capacity);
+    order->sizes = (int *)realloc(order->sizes, sizeof(int) * capacity);
+    order->values = (int *)realloc(order->values, sizeof(int) * capacity);
+    order->marks = (bool *)realloc(order->marks, sizeof(bool) * capacity);
+    order->pending = (ir_node **)realloc(order->pending,
+        sizeof(ir_node *) * capacity);
+    if (order->nodes == NULL || order->sizes == NULL ||
+        order->values == NULL || order->marks == NULL ||
+        order->pending == NULL) {
+        fprintf(stderr, "ERROR: IR walk allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    order->capacity = capacity;
+}
+
+void list_expression(ir_order_t *order, ir_node *node) {
+    int num_pending = 0;
+
+    // Listing the root, then the right operand, then the left one, gives
+    // the order wanted backwards
+    order->size = 0;
+    if (order->capacity == 0) grow_order(order);
+    order->pending[num_pending++] = node;
+    while (num_pending > 0) {
+        // Everything pending is listed eventually, so the list never
+        // holds more than the nodes it still has room for
+        if (order->size + num_pending + 2 > order->capacity) {
+            grow_order(order);
+        }
+
+        ir_node *n = order->pending[--num_pending];
+        order->nodes[(order->size)++] = n;
+        if (n->kind == IR_UNARY || n->kind == IR_BINARY) {
+            order->pending[num_pending++] = n->left;
+        }
+        if (n->kind == IR_BINARY) order->pending[num_pending++] = n->right;
+    }
+
+    for (int i = 0, j = order->size - 1; i < j; i++, j--) {
+        ir_node *swap = order->nodes[i];
+        order->nodes[i] = order->nodes[j];
+        order->nodes[j] = swap;
+    }
+
+    for (int i = 0; i < order->size; i++) {
+        ir_node *n = order->nodes[i];
+
+        order->sizes[i] = 1;
+        if (n->kind == IR_UNARY || n->kind == IR_BINARY) {
+            order->sizes[i] += order->sizes[i - 1];
+        }
+        if (n->kind == IR_BINARY) {
+            order->sizes[i] += order->sizes[i - 1 - order->sizes[i - 1]];
+        }
+    }
+}
@@ -0,0 +1,210 @@
+#ifndef IR_H
+#define IR_H
+
+/**
+ * @file ir.h
+ * @brief Tree intermediate representation built by the parser
+ *
+ * The parser builds one tree per program, which is then optimized and
+ * lowered into instructions. Nodes are allocated from an arena and freed all
+ * at once, so passes may freely create and drop nodes.
+ *
+ * Expressions can be nested arbitrarily deep, so passes over them never
+ * recurse. They walk the nodes listed by list_expression, or keep an explicit
+ * stack of their own.
+ *
+ */
+
+#include "codegen.h"
+#include "symbol.h"
+
+#include <stdbool.h>
+
+// Number of nodes allocated at a time by an arena
+#define IR_ARENA_BLOCK_SIZE 256
+
+/**
+ * @brief Kind of IR node
+ */
+typedef enum ir_kind {
+    IR_BLOCK = 1,   // value: number of variables, left: statement,
+                    // right: first IR_PROCEDURE, chained through next
+    IR_NUMBER,      // value: literal
+    IR_VARIABLE,    // sym: variable read
+    IR_UNARY,       // op: NEG or ODD, left: operand
+    IR_BINARY,      // op: arithmetic or relational opcode, left, right
+                    // SHL and SHR: right is the IR_NUMBER shift amount
+    IR_ASSIGN,      // sym: target variable, left: expression
+    IR_BEGIN,       // left: first statement, chained through next
+    IR_IF,          // left: condition, right: statement
+    IR_WHILE,       // left: condition, right: statement
+    IR_READ,        // sym: target variable
+    IR_WRITE,       // left: expression to write
+    IR_EMPTY,       // Empty statement
+    IR_PROCEDURE,   // sym: procedure declared, left: IR_BLOCK of its body
+    IR_CALL         // sym: procedure called
+} ir_kind;
+
+typedef struct ir_node {
+    ir_kind kind;
+    opcode op;
+    int value;
+    symbol *sym;
+    struct ir_node *left;
+    struct ir_node *right;
+    struct ir_node *next;   // Next statement in a begin statement
+    int registers;          // Registers needed to evaluate, set by lowering
+    // Tokens a statement of a begin statement was parsed from, the first
+    // one and one past the last
+    int first_token;
+    int end_token;
+} ir_node;
+
+/**
+ * @brief Chunk of nodes owned by an arena
+ */
+typedef struct ir_arena_block {
+    ir_node nodes[IR_ARENA_BLOCK_SIZE];
+    struct ir_arena_block *previous;
+} ir_arena_block;
+
+typedef struct ir_arena_t {
+    ir_arena_block *current;    // Block new nodes are taken from
+    int used;                   // Nodes taken from the current block
+} ir_arena_t;
+
+/**
+ * @brief Nodes of an expression, every node listed after its operands
+ *
+ * The root of the expression comes last. The only operand of the unary node
+ * at index i is at i - 1, as is the right operand of a binary node, whose
+ * left operand is at i - 1 - sizes[i - 1]. Walking the list forwards visits
+ * operands before the operations using them, walking it backwards the
+ * other way around.
+ */
+typedef struct ir_order_t {
+    ir_node **nodes;
+    int *sizes;         // Nodes of the subexpression rooted at each node
+    int *values;        // Free for the pass walking the list, one per node
+    bool *marks;        // Free for the pass walking the list, one per node
+    ir_node **pending;  // Nodes still to be listed, while listing
+    int size;           // Nodes listed
+    int capacity;       // Room in each of the arrays
+} ir_order_t;
+
+/**
+ * @brief Initialize an empty arena
+ *
+ * @param arena The arena to initialize
+ */
+void init_ir_arena(ir_arena_t *arena);
+
+/**
+ * @brief Frees every node allocated from the arena
+ *
+ * @param arena The arena to free
+ */
+void free_ir_arena(ir_arena_t *arena);
+
+/**
+ * @brief Frees every node allocated from the arena, keeping one block to
+ * allocate the next nodes from
+ *
+ * @param arena The arena to clear
+ */
+void clear_ir_arena(ir_arena_t *arena);
+
+/**
+ * @brief Allocate a node with every field cleared
+ *
+ * If the allocation fails, an error will be logged to stderr and the
+ * program will exit with EXIT_FAILURE.
+ *
+ * @param arena Arena to allocate from
+ * @param kind Kind of the node
+ * @return ir_node* The allocated node
+ */
+ir_node *create_ir_node(ir_arena_t *arena, ir_kind kind);
+
+/**
+ * @brief Create a number node
+ *
+ * @param arena Arena to allocate from
+ * @param value Value of the literal
+ * @return ir_node* The created node
+ */
+ir_node *ir_number(ir_arena_t *arena, int value);
+
+/**
+ * @brief Create a variable read node
+ *
+ * @param arena Arena to allocate from
+ * @param sym Symbol of the variable
+ * @return ir_node* The created node
+ */
+ir_node *ir_variable(ir_arena_t *arena, symbol *sym);
+
+/**
+ * @brief Create an operation node
+ *
+ * Unary operations (NEG, ODD) have no right operand.
+ *
+ * @param arena Arena to allocate from
+ * @param op Opcode of the operation
+ * @param left Left, or only, operand
+ * @param right Right operand, NULL for unary operations
+ * @return ir_node* The created node
+ */
+ir_node *ir_operation(ir_arena_t *arena, opcode op, ir_node *left,
+    ir_node *right);
+
+/**
+ * @brief Create a statement node
+ *
+ * @param arena Arena to allocate from
+ * @param kind Kind of statement
+ * @param sym Variable assigned, read or NULL
+ * @param left First child, see ir_kind
+ * @param right Second child, see ir_kind
+ * @return ir_node* The created node
+ */
+ir_node *ir_statement(ir_arena_t *arena, ir_kind kind, symbol *sym,
+    ir_node *left, ir_node *right);
+
+/**
+ * @brief Copy a node, its children and the nodes chained to it
+ *
+ * Symbols are shared with the original.
+ *
+ * @param arena Arena to allocate the copies from
+ * @param node Node to copy, or NULL
+ * @return ir_node* The copy, NULL if node is
+ */
+ir_node *copy_ir(ir_arena_t *arena, ir_node *node);
+
+/**
+ * @brief Initialize an empty list, its arrays allocated on first use
+ *
+ * @param order The list to initialize
+ */
+void init_ir_order(ir_order_t *order);
+
+/**
+ * @brief Frees the arrays of a list
+ *
+ * @param order The list to free
+ */
+void free_ir_order(ir_order_t *order);
+
+/**
+ * @brief List the nodes of an expression, replacing what the list held
+ *
+ * If the list cannot grow, an error will be logged to stderr and the
+ * program will exit with EXIT_FAILURE.
+ *
+ * @param order List to fill
+ * @param node Root of the expression
+ */
+void list_expression(ir_order_t *order, ir_node *node);
+
+#endif /* IR_H */
@@ -0,0 +1,56 @@
+// mkdtemp and dlopen are POSIX, not C99
+#define _XOPEN_SOURCE 700
+
+#include "jit.h"
+#include "cbackend.h"
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Name of the function every compiled loop is exported as
+#define NATIVE_LOOP_NAME "pl0_loop"
+
+native_loop compile_native_loop(cg_instruction *code, int code_size,
+    int start, int end) {
+    static code_generator_t generator;
+    char directory[] = "/tmp/pl0-jit-XXXXXX";
+    char source[sizeof(directory) + 16];
+    char object[sizeof(directory) + 16];
+    char command[2 * sizeof(object) + 256];
+    native_loop loop = NULL;
+
+    if (mkdtemp(directory) == NULL) return NULL;
+    snprintf(source, sizeof(source), "%s/loop.c", directory);
+    snprintf(object, sizeof(object), "%s/loop.so", directory);
+
+    memcpy(generator.code, code, sizeof(cg_instruction) * code_size);
+    generator.code_size = code_size;
+
+    FILE *out = fopen(source, "w");
+    if (out != NULL) {
+        write_c_loop(&generator, start, end, NATIVE_LOOP_NAME, out);
+        fclose(out);
+
+        char *cc = getenv("CC");
+        snprintf(command, sizeof(command),
+            "%s -O2 -shared -fPIC -o %s %s >/dev/null 2>&1",
+            cc != NULL ? cc : "cc", object, source);
+
+        if (system(command) == 0) {
+            // The handle is never closed, the loop is used until exit
+            void *handle = dlopen(object, RTLD_NOW | RTLD_LOCAL);
+            if (handle != NULL) {
+                *(void **)(&loop) = dlsym(handle, NATIVE_LOOP_NAME);
+            }
+        }
+    }
+
+    // The loaded object stays mapped after its file is gone
+    remove(source);
+    remove(object);
+    rmdir(directory);
+    return loop;
+}
@@ -0,0 +1,41 @@
+#ifndef JIT_H
+#define JIT_H
+
+/**
+ * @file jit.h
+ * @brief Native compilation of hot loops for the virtual machine
+ *
+ * Loops are translated to C by the C backend, built into a shared object by
+ * the host C compiler and loaded back into the running process. The
+ * compiler is taken from the CC environment variable, or cc if it is unset.
+ *
+ */
+
+#include "codegen.h"
+
+/**
+ * @brief Natively compiled loop, see write_c_loop
+ *
+ * Runs on the virtual machine's registers, stack, stack pointer and base
+ * pointer, and returns the index of the next instruction to interpret. The
+ * instructions it executed are stored in retired. Once it has executed
+ * budget of them, it returns at the next backward jump.
+ */
+typedef int (*native_loop)(int *registers, int *stack, int *sp, int *bp,
+    long *retired, long budget);
+
+/**
+ * @brief Compile a range of instructions into a native function
+ *
+ * Compiled code stays loaded until the process exits.
+ *
+ * @param code Instructions of the program
+ * @param code_size Number of instructions in the program
+ * @param start First instruction of the loop, where the function starts
+ * @param end One past the last instruction of the loop
+ * @return native_loop The compiled loop, or NULL if compiling failed
+ */
+native_loop compile_native_loop(cg_instruction *code, int code_size,
+    int start, int end);
+
+#endif /* JIT_H */
@@ -0,0 +1,291 @@
+// fmemopen is POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
+
+#include "lexeme_reader.h"
+#include "iobuf.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Smallest chunk worth a thread of its own
+#define MIN_CHUNK_SIZE (256 * 1024)
+// Longest name or number read_token_list reads as a single lexeme
+#define MAX_LEXEME_LENGTH 31
+// Longest token type accepted without falling back, avoids overflow
+#define MAX_TYPE_DIGITS 9
+
+/**
+ * @brief What a reading of a chunk expects its next lexeme to be
+ */
+typedef enum expectation {
+    EXPECT_TYPE, EXPECT_NAME, EXPECT_NUMBER, EXPECT_NOTHING
+} expectation;
+
+/**
+ * @brief Tokens of a chunk, read both ways its first lexeme can be taken
+ *
+ * Reading 0 starts a token at the first lexeme, reading 1 takes the first
+ * lexeme as the name or number of the previous chunk's last token. Each
+ * list keeps its own identifier IDs.
+ */
+typedef struct chunk_t {
+    const char *start;
+    const char *end;
+    token_list_t *prefixes[2];  // Tokens of each reading until they meet
+    token_list_t *tail;         // Tokens after the readings met
+    bool met;
+    // Lexeme each reading expects after the chunk, EXPECT_NOTHING if the
+    // reading hit a lexeme read_token_list would not accept
+    expectation ends[2];
+    char first[MAX_LEXEME_LENGTH + 1];  // First lexeme, for reading 1
+    bool empty;                 // Whether the chunk holds no lexeme at all
+} chunk_t;
+
+// Whitespace as fscanf sees it
+static bool is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' ||
+        c == '\f';
+}
+
+// Take the next lexeme of one reading, returns what it expects afterwards
+static expectation take_lexeme(token_list_t *tokens, expectation expected,
+    const char *lexeme, int length) {
+    char buffer[MAX_LEXEME_LENGTH + 1];
+
+    if (expected == EXPECT_TYPE) {
+        int type = 0;
+
+        // fscanf would accept signs and split off trailing characters,
+        // leave such input to read_token_list
+        if (length > MAX_TYPE_DIGITS) return EXPECT_NOTHING;
+        for (int i = 0; i < length; i++) {
+            if (lexeme[i] < '0' || lexeme[i] > '9') return EXPECT_NOTHING;
+            type = type * 10 + (lexeme[i] - '0');
+        }
+        // Unknown types are left to read_token_list to report
+        if (type < nulsym || type > readsym) return EXPECT_NOTHING;
+
+        add_token(tokens, (token_type)type, 0);
+        if (type == identsym) return EXPECT_NAME;
+        if (type == numbersym) return EXPECT_NUMBER;
+        return EXPECT_TYPE;
+    }
+
+    // Longer lexemes are split in two by fscanf, and a NUL ends a string
+    if (length > MAX_LEXEME_LENGTH || memchr(lexeme, '\0', length) != NULL) {
+        return EXPECT_NOTHING;
+    }
+    memcpy(buffer, lexeme, length);
+    buffer[length] = '\0';
+
+    tokens->payloads[tokens->size - 1] = expected == EXPECT_NAME ?
+        intern_name(tokens, buffer) : atoi(buffer);
+    return EXPECT_TYPE;
+}
+
+static void *read_chunk(void *argument) {
+    chunk_t *chunk = (chunk_t *)argument;
+    expectation expected[2] = { EXPECT_TYPE, EXPECT_TYPE };
+    const char *c = chunk->start;
+    bool first = true;
+
+    chunk->prefixes[0] = create_token_list();
+    chunk->prefixes[1] = create_token_list();
+    chunk->tail = create_token_list();
+    chunk->met = false;
+    chunk->empty = true;
+
+    while (c < chunk->end) {
+        while (c < chunk->end && is_space(*c)) c++;
+        if (c == chunk->end) break;
+
+        const char *lexeme = c;
+        while (c < chunk->end && !is_space(*c)) c++;
+        int length = (int)(c - lexeme);
+        chunk->empty = false;
+
+        if (first) {
+            // Reading 1 leaves the first lexeme to the previous chunk
+            first = false;
+            int kept = length < MAX_LEXEME_LENGTH ? length : MAX_LEXEME_LENGTH;
+            memcpy(chunk->first, lexeme, kept);
+            chunk->first[kept] = '\0';
+            // Joining checks the lexeme like take_lexeme would
+            if (length > MAX_LEXEME_LENGTH ||
+                memchr(lexeme, '\0', length) != NULL) {
+                expected[1] = EXPECT_NOTHING;
+            }
+            expected[0] = take_lexeme(chunk->prefixes[0], expected[0],
+                lexeme, length);
+            continue;
+        }
+
+        if (chunk->met) {
+            expected[0] = take_lexeme(chunk->tail, expected[0], lexeme,
+                length);
+            if (expected[0] == EXPECT_NOTHING) break;
+            continue;
+        }
+
+        // The readings agree from the first token they both start on
+        if (expected[0] == EXPECT_TYPE && expected[1] == EXPECT_TYPE) {
+            chunk->met = true;
+            expected[0] = take_lexeme(chunk->tail, expected[0], lexeme,
+                length);
+            if (expected[0] == EXPECT_NOTHING) break;
+            continue;
+        }
+        for (int r = 0; r < 2; r++) {
+            if (expected[r] != EXPECT_NOTHING) {
+                expected[r] = take_lexeme(chunk->prefixes[r], expected[r],
+                    lexeme, length);
+            }
+        }
+        if (expected[0] == EXPECT_NOTHING && expected[1] == EXPECT_NOTHING) {
+            break;
+        }
+    }
+
+    chunk->ends[0] = expected[0];
+    chunk->ends[1] = chunk->met ? expected[0] : expected[1];
+    return NULL;
+}
+
+// Append the tokens of a chunk's list, renumbering its identifier IDs
+static void append_tokens(token_list_t *l, token_list_t *tokens) {
+    int *ids = (int *)malloc(sizeof(int) * (tokens->num_names + 1));
+    if (ids == NULL) {
+        fprintf(stderr, "ERROR: List reallocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int id = 0; id < tokens->num_names; id++) ids[id] = -1;
+
+    reserve_tokens(l, tokens->size);
+    memcpy(&(l->types[l->size]), tokens->types, tokens->size);
+    for (int i = 0; i < tokens->size; i++) {
+        int payload = tokens->payloads[i];
+
+        // Interned on first use, so IDs follow the order of the whole input
+        if (tokens->types[i] == identsym) {
+            if (ids[payload] == -1) {
+                ids[payload] = intern_name(l, tokens->names[payload]);
+            }
+            payload = ids[payload];
+        }
+        l->payloads[l->size + i] = payload;
+    }
+    l->size += tokens->size;
+    free(ids);
+}
+
+// Join the chunks in order, returns NULL if read_token_list has to be used
+static token_list_t *join_chunks(chunk_t *chunks, int num_chunks) {
+    token_list_t *l = create_token_list();
+    expectation expected = EXPECT_TYPE;
+
+    for (int k = 0; k < num_chunks; k++) {
+        chunk_t *chunk = &chunks[k];
+        if (chunk->empty) continue;
+
+        int reading = expected == EXPECT_TYPE ? 0 : 1;
+        if (chunk->ends[reading] == EXPECT_NOTHING) {
+            free_token_list(l);
+            return NULL;
+        }
+
+        // The first lexeme is the name or number of the last token
+        if (reading == 1) {
+            l->payloads[l->size - 1] = expected == EXPECT_NAME ?
+                intern_name(l, chunk->first) : atoi(chunk->first);
+        }
+        append_tokens(l, chunk->prefixes[reading]);
+        if (chunk->met) append_tokens(l, chunk->tail);
+        expected = chunk->ends[reading];
+    }
+
+    // A token is missing its name or number
+    if (expected != EXPECT_TYPE) {
+        free_token_list(l);
+        return NULL;
+    }
+
+    // Sentinel so the parser never reads past the end of the list
+    add_token(l, nulsym, 0);
+    return l;
+}
+
+// Read the input serially, from memory
+static token_list_t *read_serially(char *data, size_t size) {
+    if (size == 0) {
+        token_list_t *l = create_token_list();
+        add_token(l, nulsym, 0);
+        return l;
+    }
+
+    FILE *in = fmemopen(data, size, "r");
+    if (in == NULL) {
+        fprintf(stderr, "ERROR: Could not read lexeme list from memory\n");
+        exit(EXIT_FAILURE);
+    }
+    token_list_t *l = read_token_list(in);
+    fclose(in);
+    return l;
+}
+
+token_list_t *read_token_list_parallel(FILE *in, int num_threads) {
+    size_t size;
+    char *data = read_whole_stream(in, &size, "lexeme list");
+
+    int num_chunks = (int)(size / MIN_CHUNK_SIZE);
+    if (num_chunks > num_threads) num_chunks = num_threads;
+    if (num_chunks < 2) {
+        token_list_t *l = read_serially(data, size);
+        free(data);
+        return l;
+    }
+
+    chunk_t *chunks = (chunk_t *)malloc(sizeof(chunk_t) * num_chunks);
+    pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * num_chunks);
+    if (chunks == NULL || threads == NULL) {
+        fprintf(stderr, "ERROR: Could not allocate lexeme chunks\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Chunks end at whitespace, or at the end of the input
+    const char *end = data + size;
+    const char *start = data;
+    for (int k = 0; k < num_chunks; k++) {
+        const char *stop = k == num_chunks - 1 ? end :
+            data + size / num_chunks * (k + 1);
+        if (stop < start) stop = start;
+        while (stop < end && !is_space(*stop)) stop++;
+
+        chunks[k].start = start;
+        chunks[k].end = stop;
+        start = stop;
+    }
+
+    int started = 0;
+    for (; started < num_chunks; started++) {
+        if (pthread_create(&threads[started], NULL, read_chunk,
+            &chunks[started]) != 0) break;
+    }
+    // Whatever could not get a thread is read on this one
+    for (int k = started; k < num_chunks; k++) read_chunk(&chunks[k]);
+    for (int k = 0; k < started; k++) pthread_join(threads[k], NULL);
+
+    token_list_t *l = join_chunks(chunks, num_chunks);
+    if (l == NULL) l = read_serially(data, size);
+
+    for (int k = 0; k < num_chunks; k++) {
+        free_token_list(chunks[k].prefixes[0]);
+        free_token_list(chunks[k].prefixes[1]);
+        free_token_list(chunks[k].tail);
+    }
+    free(chunks);
+    free(threads);
+    free(data);
+    return l;
+}
@@ -0,0 +1,40 @@
+#ifndef LEXEME_READER_H
+#define LEXEME_READER_H
+
+/**
+ * @file lexeme_reader.h
+ * @brief Reads large lexeme lists on several threads
+ *
+ * The input is read into memory and split into chunks at whitespace, so no
+ * lexeme is cut in two. A token and its identifier name or number can still
+ * end up in different chunks. A chunk cannot tell whether its first lexeme
+ * starts a token or ends the previous chunk's last token, so it is read both
+ * ways until the two readings reach the same lexeme at the start of a token,
+ * which they usually do within a few tokens. From there on a single reading
+ * is kept. The chunks' tokens are then joined in order, using the reading
+ * the previous chunk's last token selects.
+ *
+ * Identifier IDs are handed out in the order names first appear, and any
+ * input the chunks do not accept, such as malformed lists, is read again
+ * by read_token_list, so the result and error messages are the same as
+ * reading the input serially.
+ *
+ */
+
+#include "token_list.h"
+
+#include <stdio.h>
+
+/**
+ * @brief Read a lexeme list produced by the lexical analyzer on threads
+ *
+ * Behaves exactly like read_token_list, see there.
+ *
+ * @param in Stream to read the lexemes from
+ * @param num_threads Most threads to read on, inputs too small to be worth
+ * splitting are read on one
+ * @return token_list_t* The list of tokens read, to be freed by the caller
+ */
+token_list_t *read_token_list_parallel(FILE *in, int num_threads);
+
+#endif /* LEXEME_READER_H */
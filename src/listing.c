@@ -0,0 +1,231 @@
+#include "listing.h"
+#include "iobuf.h"
+#include "verify.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Longest line: a label, the longest mnemonic and four 11 character fields
+#define MAX_LINE_LENGTH 64
+// Column symbolic instructions start in, wide enough for "L199:" and a space
+#define LABEL_WIDTH 6
+// Most digits of an int
+#define MAX_DIGITS 10
+
+// Append the decimal digits of a value, returns where they end
+static char *format_int(char *out, int value) {
+    char digits[MAX_DIGITS];
+    int n = 0;
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value :
+        (unsigned int)value;
+
+    if (value < 0) *out++ = '-';
+    do {
+        digits[n++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    while (n > 0) *out++ = digits[--n];
+    return out;
+}
+
+static char *format_label(char *out, int index) {
+    *out++ = 'L';
+    return format_int(out, index);
+}
+
+static bool has_target(opcode op) {
+    return op == JMP || op == JPC || op == CAL;
+}
+
+void write_listing(code_generator_t *generator, FILE *out, bool symbolic) {
+    static bool targeted[MAX_CODE_LENGTH];
+    int size = generator->code_size;
+
+    char *buffer = (char *)malloc((size_t)size * MAX_LINE_LENGTH + 1);
+    if (buffer == NULL) {
+        fprintf(stderr, "Could not allocate the listing\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Only instructions something jumps to get a label
+    if (symbolic) {
+        memset(targeted, 0, sizeof(targeted));
+        for (int i = 0; i < size; i++) {
+            cg_instruction *c = &(generator->code[i]);
+            if (has_target(c->op) && c->modifier >= 0 && c->modifier < size) {
+                targeted[c->modifier] = true;
+            }
+        }
+    }
+
+    char *end = buffer;
+    for (int i = 0; i < size; i++) {
+        cg_instruction *c = &(generator->code[i]);
+
+        if (!symbolic) {
+            end = format_int(end, c->op);
+            *end++ = ' ';
+            end = format_int(end, c->regiser_num);
+            *end++ = ' ';
+            end = format_int(end, c->lex_level);
+            *end++ = ' ';
+            end = format_int(end, c->modifier);
+            *end++ = '\n';
+            continue;
+        }
+
+        char *line = end;
+        if (targeted[i]) {
+            end = format_label(end, i);
+            *end++ = ':';
+        }
+        do {
+            *end++ = ' ';
+        } while (end - line < LABEL_WIDTH);
+
+        char *mnemonic = c->op > 0 && c->op < NUM_OPCODES ?
+            opcode_to_string(c->op) : NULL;
+        if (mnemonic != NULL) {
+            size_t length = strlen(mnemonic);
+            memcpy(end, mnemonic, length);
+            end += length;
+        } else {
+            end = format_int(end, c->op);
+        }
+        *end++ = ' ';
+        end = format_int(end, c->regiser_num);
+        *end++ = ' ';
+        end = format_int(end, c->lex_level);
+        *end++ = ' ';
+        end = has_target(c->op) && c->modifier >= 0 && c->modifier < size ?
+            format_label(end, c->modifier) : format_int(end, c->modifier);
+        *end++ = '\n';
+    }
+
+    size_t length = (size_t)(end - buffer);
+    bool written = fwrite(buffer, 1, length, out) == length;
+    free(buffer);
+    if (!written || fflush(out) != 0) {
+        fprintf(stderr, "Could not write the listing\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void malformed(int line, char *problem) {
+    fprintf(stderr, "ERROR: Listing line %d: %s\n", line, problem);
+    exit(EXIT_FAILURE);
+}
+
+// Blanks separating the fields of a line
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Parse a decimal int, returns where it ends or NULL if there is none
+static char *parse_int(char *c, int *value) {
+    bool negative = *c == '-';
+    long long magnitude = 0;
+    int digits = 0;
+
+    if (negative) c++;
+    for (; is_digit(*c); c++) {
+        if (++digits > MAX_DIGITS) return NULL;
+        magnitude = magnitude * 10 + (*c - '0');
+    }
+    if (digits == 0 || magnitude > (long long)INT_MAX + negative) return NULL;
+
+    *value = (int)(negative ? -magnitude : magnitude);
+    return c;
+}
+
+// Parse "L" followed by an index, returns where it ends or NULL
+static char *parse_label(char *c, int *index) {
+    if (*c != 'L' || !is_digit(c[1])) return NULL;
+    return parse_int(c + 1, index);
+}
+
+// Parse an opcode given by number or mnemonic
+static char *parse_opcode(char *c, int *op) {
+    if (is_digit(*c)) return parse_int(c, op);
+
+    for (int o = LIT; o < NUM_OPCODES; o++) {
+        char *mnemonic = opcode_to_string((opcode)o);
+        size_t length = strlen(mnemonic);
+
+        if (strncmp(c, mnemonic, length) == 0 &&
+            (is_blank(c[length]) || c[length] == '\n' || c[length] == '\0')) {
+            *op = o;
+            return c + length;
+        }
+    }
+    return NULL;
+}
+
+static char *skip_blanks(char *c) {
+    while (is_blank(*c)) c++;
+    return c;
+}
+
+void read_listing(FILE *in, code_generator_t *generator) {
+    size_t size;
+    char *data = read_whole_stream(in, &size, "listing");
+    char *c = data;
+    int line = 0;
+
+    init_code_generator(generator);
+    if (memchr(data, '\0', size) != NULL) malformed(1, "NUL character");
+
+    while (*c != '\0') {
+        line++;
+        c = skip_blanks(c);
+        if (*c == '\n') {
+            c++;
+            continue;
+        }
+        if (*c == '\0') break;
+
+        int index = generator->code_size;
+        int fields[4];
+
+        // A label only names the instruction it is in front of
+        char *after = parse_label(c, &fields[0]);
+        if (after != NULL && *after == ':') {
+            if (fields[0] != index) malformed(line, "label does not match");
+            c = skip_blanks(after + 1);
+        }
+
+        if (index == MAX_CODE_LENGTH) malformed(line, "too many instructions");
+        if ((c = parse_opcode(c, &fields[0])) == NULL) {
+            malformed(line, "expected an opcode");
+        }
+        for (int f = 1; f < 4; f++) {
+            if (!is_blank(*c)) malformed(line, "expected four fields");
+            c = skip_blanks(c);
+            after = f == 3 && *c == 'L' ? parse_label(c, &fields[f]) :
+                parse_int(c, &fields[f]);
+            if (after == NULL) malformed(line, "expected a number");
+            c = after;
+        }
+
+        c = skip_blanks(c);
+        if (*c != '\n' && *c != '\0') malformed(line, "trailing characters");
+        if (*c == '\n') c++;
+
+        generator->code[index] = create_instruction((opcode)fields[0],
+            fields[1], fields[2], fields[3]);
+        (generator->code_size)++;
+    }
+    free(data);
+
+    for (int i = 0; i < generator->code_size; i++) {
+        if (!check_instruction(&(generator->code[i]), generator->code_size)) {
+            fprintf(stderr, "ERROR: Listing instruction %d is malformed\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
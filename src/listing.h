@@ -0,0 +1,55 @@
+#ifndef LISTING_H
+#define LISTING_H
+
+/**
+ * @file listing.h
+ * @brief Writes generated code as text listings and reads them back
+ *
+ * A listing has one instruction per line. Plain listings are the output
+ * the specification asks for, the four fields of each instruction as
+ * decimal integers: "op r l m", e.g. "3 0 0 4". Symbolic listings name the
+ * opcode by its mnemonic and the targets of JMP, JPC and CAL by label,
+ * where the label of instruction i is "Li" and is written in front of it:
+ *
+ *     L3:   JPC 0 0 L9
+ *
+ * Both are formatted by hand into a single buffer that is written at once,
+ * and read from memory without going through scanf, so listing a program
+ * takes a fraction of the time compiling it does.
+ *
+ */
+
+#include "codegen.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/**
+ * @brief Write the code held by a generator as a listing
+ *
+ * If writing fails, an error is logged to stderr and the program is exited
+ * with EXIT_FAILURE.
+ *
+ * @param generator Generator holding the code
+ * @param out Stream to write to
+ * @param symbolic Whether to write mnemonics and labels instead of numbers
+ */
+void write_listing(code_generator_t *generator, FILE *out, bool symbolic);
+
+/**
+ * @brief Read a plain or symbolic listing into a generator
+ *
+ * Opcodes and jump targets may be given as numbers or symbolically, line
+ * by line. A label in front of an instruction has to match its index.
+ * Blank lines are skipped.
+ *
+ * If the listing is malformed, holds more than MAX_CODE_LENGTH
+ * instructions or an instruction check_instruction rejects, an error is
+ * logged to stderr and the program is exited with EXIT_FAILURE.
+ *
+ * @param in Stream to read the listing from
+ * @param generator Generator to set to the code read
+ */
+void read_listing(FILE *in, code_generator_t *generator);
+
+#endif /* LISTING_H */
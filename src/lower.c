@@ -0,0 +1,724 @@
+#include "lower.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Uses inside a loop count this many times more than uses outside of it
+#define LOOP_USE_WEIGHT 8
+// Deeper loops are not weighted any further, to avoid overflowing
+#define MAX_WEIGHTED_LOOP_DEPTH 6
+
+static void lower_block(lowering_t *lowering, ir_node *block);
+static void prepare_statement(lowering_t *lowering, ir_node *node);
+static void lower_statement(lowering_t *lowering, ir_node *node);
+static int lower_expression(lowering_t *lowering, ir_node *root, int target);
+static void promote_variables(lowering_t *lowering, ir_node *program);
+
+// Emit the procedures a block declares, jumped over to the block's own code
+static void lower_procedures(lowering_t *lowering, ir_node *block) {
+    code_generator_t *generator = lowering->code_generator;
+    int skip = -1;
+
+    if (block->right != NULL) {
+        // Jump over the code of the procedures to the block's own code
+        skip = generator->code_size;
+        emit_instruction(generator, JMP, 0, 0, 0);
+    }
+
+    for (ir_node *p = block->right; p != NULL; p = p->next) {
+        // Known before the body is lowered, so it can call itself
+        p->sym->address = generator->code_size;
+
+        (lowering->level)++;
+        lower_block(lowering, p->left);
+        (lowering->level)--;
+    }
+
+    if (skip >= 0) set_modifier(generator, skip, generator->code_size);
+}
+
+// Emit a block, preceded by the procedures it declares
+static void lower_block(lowering_t *lowering, ir_node *block) {
+    code_generator_t *generator = lowering->code_generator;
+
+    lower_procedures(lowering, block);
+
+    // Spill slots come after the block's variables in its frame
+    lowering->spill_base = 4 + block->value;
+    lowering->spill_depth = 0;
+    lowering->num_spill_slots = 0;
+    prepare_statement(lowering, block->left);
+
+    // Allocate space on the stack for FV, SL, DL, and RA
+    emit_instruction(generator, INC, 0, 0, 4);
+
+    if (block->value + lowering->num_spill_slots >= 1) {
+        // Allocate space on the stack for the variables and spill slots
+        emit_instruction(
+            generator,
+            INC,
+            0,
+            0,
+            block->value + lowering->num_spill_slots
+        );
+    }
+
+    lower_statement(lowering, block->left);
+
+    if (lowering->level == 0) {
+        // End of program instruction
+        emit_instruction(generator, SIO_END, 0, 0, 3);
+    } else {
+        // Return to the caller, popping the frame
+        emit_instruction(generator, RTN, 0, 0, 0);
+    }
+}
+
+static void init_lowering(lowering_t *lowering, symbol_table_t *table,
+    code_generator_t *generator) {
+    lowering->code_generator = generator;
+    lowering->symbol_table = table;
+    lowering->level = 0;
+    lowering->register_cursor = 0;
+    lowering->num_temporaries = NUM_REGISTERS;
+    lowering->home = (int *)malloc(sizeof(int) * table->capacity);
+    if (lowering->home == NULL) {
+        fprintf(stderr, "ERROR: Could not allocate register homes\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < table->num_symbols; i++) lowering->home[i] = -1;
+    init_ir_order(&(lowering->order));
+    lowering->frames = NULL;
+    lowering->frames_capacity = 0;
+}
+
+static void free_lowering(lowering_t *lowering) {
+    free(lowering->home);
+    free_ir_order(&(lowering->order));
+    free(lowering->frames);
+}
+
+void lower_program(ir_node *program, symbol_table_t *table,
+    code_generator_t *generator, compile_options_t *options) {
+    lowering_t lowering;
+
+    init_lowering(&lowering, table, generator);
+    if (options->optimization_level >= 1) {
+        promote_variables(&lowering, program);
+    }
+
+    lower_block(&lowering, program);
+    free_lowering(&lowering);
+}
+
+void start_lowering(lowering_t *lowering, ir_node *block,
+    symbol_table_t *table, code_generator_t *generator) {
+    init_lowering(lowering, table, generator);
+    lower_procedures(lowering, block);
+
+    lowering->spill_base = 4 + block->value;
+    lowering->spill_depth = 0;
+    lowering->num_spill_slots = 0;
+    lowering->num_variables = block->value;
+
+    // Allocate space on the stack for FV, SL, DL, and RA
+    emit_instruction(generator, INC, 0, 0, 4);
+
+    // Spill slots are added once every statement was lowered
+    lowering->frame_instruction = generator->code_size;
+    emit_instruction(generator, INC, 0, 0, block->value);
+}
+
+void lower_top_statement(lowering_t *lowering, ir_node *statement) {
+    // Spill slots of earlier statements are free again, so the frame
+    // needs as many as the statement needing the most
+    prepare_statement(lowering, statement);
+    lower_statement(lowering, statement);
+}
+
+void finish_lowering(lowering_t *lowering) {
+    code_generator_t *generator = lowering->code_generator;
+
+    if (lowering->num_spill_slots > 0) {
+        set_modifier(generator, lowering->frame_instruction,
+            lowering->num_variables + lowering->num_spill_slots);
+    }
+
+    // End of program instruction
+    emit_instruction(generator, SIO_END, 0, 0, 3);
+    free_lowering(lowering);
+}
+
+// Levels between the block lowered and the one declaring a symbol
+static int level_difference(lowering_t *lowering, symbol *sym) {
+    return lowering->level - sym->level;
+}
+
+// Register a variable lives in, or -1 if it lives on the stack
+static int home_register(lowering_t *lowering, symbol *sym) {
+    return lowering->home[sym - lowering->symbol_table->symbols];
+}
+
+// Whether the value of an expression is already held in a register
+static bool in_home(lowering_t *lowering, ir_node *node) {
+    return node->kind == IR_VARIABLE && home_register(lowering, node->sym) >= 0;
+}
+
+// Shifts take their amount from the instruction, not from a register
+static bool is_shift(ir_node *node) {
+    return node->kind == IR_BINARY && (node->op == SHL || node->op == SHR);
+}
+
+// Label an expression with the temporary registers needed to evaluate it
+static int label_expression(lowering_t *lowering, ir_node *root) {
+    ir_order_t *order = &(lowering->order);
+
+    // Operands are labeled before the operations using them
+    list_expression(order, root);
+    for (int i = 0; i < order->size; i++) {
+        ir_node *node = order->nodes[i];
+
+        if (is_shift(node)) {
+            // Shifts write a register of their own, so need at least one
+            node->registers = node->left->registers;
+            if (node->registers == 0) node->registers = 1;
+            continue;
+        }
+
+        switch (node->kind) {
+            case IR_NUMBER:
+                node->registers = 1;
+                break;
+            case IR_VARIABLE:
+                node->registers = in_home(lowering, node) ? 0 : 1;
+                break;
+            case IR_UNARY:
+                // Unary operations work in place, so never on a home register
+                node->registers = node->left->registers;
+                if (node->registers == 0) node->registers = 1;
+                break;
+            default: { // IR_BINARY
+                int left = node->left->registers;
+                int right = node->right->registers;
+
+                // Equal operands keep one register busy while the other is
+                // built
+                if (left == right) node->registers = left + 1;
+                else node->registers = left > right ? left : right;
+                break;
+            }
+        }
+    }
+    return root->registers;
+}
+
+// Start evaluating an operation on top of the frames in use, returns its
+// frame
+static expression_frame *push_frame(lowering_t *lowering, int *depth,
+    ir_node *node, int target) {
+    if (*depth == lowering->frames_capacity) {
+        int capacity = *depth > 0 ? *depth * 2 : 32;
+        expression_frame *frames = (expression_frame *)realloc(
+            lowering->frames, sizeof(expression_frame) * capacity);
+        if (frames == NULL) {
+            fprintf(stderr, "ERROR: Could not allocate expression frames\n");
+            exit(EXIT_FAILURE);
+        }
+        lowering->frames = frames;
+        lowering->frames_capacity = capacity;
+    }
+
+    expression_frame *frame = &(lowering->frames[(*depth)++]);
+    frame->node = node;
+    frame->stage = 0;
+    frame->target = target;
+    frame->base = 0;
+    frame->first = 0;
+    frame->slot = -1;
+    return frame;
+}
+
+// Operand of a binary node that lower_expression evaluates first
+static ir_node *first_operand(ir_node *node) {
+    if (node->right->registers > node->left->registers) return node->right;
+    return node->left;
+}
+
+static ir_node *second_operand(ir_node *node) {
+    if (node->right->registers > node->left->registers) return node->left;
+    return node->right;
+}
+
+// Whether the second operand no longer fits once the first one is computed
+static bool must_spill(lowering_t *lowering, ir_node *second, int base) {
+    return base + 1 + second->registers > lowering->num_temporaries;
+}
+
+// Spill slots used at once when evaluating a labeled expression at base.
+// Frames stand in for the calls of a recursive walk, each operation taking
+// its operands in the order lower_expression does.
+static int count_spill_slots(lowering_t *lowering, ir_node *root, int base) {
+    int depth = 0;
+    int slots = 0;  // Result of the frame popped last
+
+    push_frame(lowering, &depth, root, -1)->base = base;
+    while (depth > 0) {
+        // Pushing may move the frames, so this one is not used after it
+        expression_frame *frame = &(lowering->frames[depth - 1]);
+        ir_node *node = frame->node;
+        int node_base = frame->base;
+
+        if (node->kind != IR_UNARY && node->kind != IR_BINARY) {
+            slots = 0;
+            depth--;
+        } else if (node->kind == IR_UNARY || is_shift(node)) {
+            // The operand's slots are the operation's
+            if (frame->stage++ == 0) {
+                push_frame(lowering, &depth, node->left, -1)->base = node_base;
+            } else {
+                depth--;
+            }
+        } else if (frame->stage == 0) {
+            frame->stage = 1;
+            push_frame(lowering, &depth, first_operand(node), -1)->base =
+                node_base;
+        } else if (frame->stage == 1) {
+            ir_node *first = first_operand(node);
+            ir_node *second = second_operand(node);
+            int second_base = node_base;
+
+            // Slot counts the spilled first operand, 0 or 1
+            frame->first = slots;
+            frame->stage = 2;
+            frame->slot = 0;
+            if (in_home(lowering, first)) {
+                second_base = node_base;
+            } else if (must_spill(lowering, second, node_base)) {
+                frame->slot = 1;
+            } else {
+                second_base = node_base + 1;
+            }
+            push_frame(lowering, &depth, second, -1)->base = second_base;
+        } else {
+            int second_slots = frame->slot + slots;
+            if (frame->first > second_slots) slots = frame->first;
+            else slots = second_slots;
+            depth--;
+        }
+    }
+    return slots;
+}
+
+// Label an expression evaluated at the start of a statement
+static void prepare_expression(lowering_t *lowering, ir_node *node) {
+    label_expression(lowering, node);
+
+    int slots = count_spill_slots(lowering, node, 0);
+    if (slots > lowering->num_spill_slots) lowering->num_spill_slots = slots;
+}
+
+// Label every expression and find how many spill slots to reserve
+static void prepare_statement(lowering_t *lowering, ir_node *node) {
+    switch (node->kind) {
+        case IR_ASSIGN:
+        case IR_WRITE:
+            prepare_expression(lowering, node->left);
+            break;
+        case IR_BEGIN:
+            for (ir_node *s = node->left; s != NULL; s = s->next) {
+                prepare_statement(lowering, s);
+            }
+            break;
+        case IR_IF:
+        case IR_WHILE:
+            prepare_expression(lowering, node->left);
+            prepare_statement(lowering, node->right);
+            break;
+        default: // IR_READ, IR_CALL, IR_EMPTY
+            break;
+    }
+}
+
+/**
+ * @brief Variable use counts gathered for register promotion
+ */
+typedef struct use_counts {
+    long *uses;         // Indexed like symbols
+    int max_registers;  // Most temporaries needed by any expression
+} use_counts;
+
+static void count_expression_uses(lowering_t *lowering, use_counts *counts,
+    ir_node *node, long weight) {
+    ir_order_t *order = &(lowering->order);
+
+    if (node == NULL) return;
+
+    list_expression(order, node);
+    for (int i = 0; i < order->size; i++) {
+        ir_node *n = order->nodes[i];
+        if (n->kind == IR_VARIABLE) {
+            counts->uses[n->sym - lowering->symbol_table->symbols] += weight;
+        }
+    }
+}
+
+static void count_statement_uses(lowering_t *lowering, use_counts *counts,
+    ir_node *node, long weight, int depth) {
+    symbol *symbols = lowering->symbol_table->symbols;
+
+    switch (node->kind) {
+        case IR_ASSIGN:
+        case IR_READ:
+            counts->uses[node->sym - symbols] += weight;
+            if (node->left != NULL) {
+                count_expression_uses(lowering, counts, node->left, weight);
+            }
+            break;
+        case IR_WRITE:
+            count_expression_uses(lowering, counts, node->left, weight);
+            break;
+        case IR_BEGIN:
+            for (ir_node *s = node->left; s != NULL; s = s->next) {
+                count_statement_uses(lowering, counts, s, weight, depth);
+            }
+            break;
+        case IR_IF:
+            count_expression_uses(lowering, counts, node->left, weight);
+            count_statement_uses(lowering, counts, node->right, weight, depth);
+            break;
+        case IR_WHILE:
+            if (depth < MAX_WEIGHTED_LOOP_DEPTH) {
+                weight *= LOOP_USE_WEIGHT;
+                depth++;
+            }
+            count_expression_uses(lowering, counts, node->left, weight);
+            count_statement_uses(lowering, counts, node->right, weight, depth);
+            break;
+        default: // IR_CALL, IR_EMPTY
+            break;
+    }
+
+    if (node->kind == IR_ASSIGN || node->kind == IR_WRITE ||
+        node->kind == IR_IF || node->kind == IR_WHILE) {
+        int registers = label_expression(lowering, node->left);
+        if (registers > counts->max_registers) {
+            counts->max_registers = registers;
+        }
+    }
+}
+
+// Count the uses in a block and in every procedure nested in it
+static void count_block_uses(lowering_t *lowering, use_counts *counts,
+    ir_node *block) {
+    count_statement_uses(lowering, counts, block->left, 1, 0);
+    for (ir_node *p = block->right; p != NULL; p = p->next) {
+        count_block_uses(lowering, counts, p->left);
+    }
+}
+
+/**
+ * @brief Give the most used variables a register of their own
+ *
+ * Registers not needed for evaluating the program's largest expression are
+ * handed out to variables by use count, where uses inside of loops weigh
+ * more. At least two temporaries are always kept, so any expression can be
+ * evaluated by spilling.
+ *
+ * Promoted variables are never loaded from or stored to the stack. Calls 
+ * leave registers alone, so procedures use the same homes.
+ */
+static void promote_variables(lowering_t *lowering, ir_node *program) {
+    use_counts counts = { NULL, 0 };
+
+    counts.uses = (long *)calloc(lowering->symbol_table->capacity,
+        sizeof(long));
+    if (counts.uses == NULL) {
+        fprintf(stderr, "ERROR: Could not allocate use counts\n");
+        exit(EXIT_FAILURE);
+    }
+    count_block_uses(lowering, &counts, program);
+
+    int temporaries = counts.max_registers;
+    if (temporaries < 2) temporaries = 2;
+    if (temporaries > NUM_REGISTERS) temporaries = NUM_REGISTERS;
+    lowering->num_temporaries = temporaries;
+
+    // Homes are handed out from the top of the register file down
+    for (int r = NUM_REGISTERS - 1; r >= temporaries; r--) {
+        int best = -1;
+        for (int i = 0; i < lowering->symbol_table->num_symbols; i++) {
+            if (lowering->home[i] >= 0 || counts.uses[i] == 0) continue;
+            // Variables of procedures exist once per active call
+            if (lowering->symbol_table->symbols[i].level != 0) continue;
+            if (best < 0 || counts.uses[i] > counts.uses[best]) best = i;
+        }
+
+        if (best < 0) break;
+        lowering->home[best] = r;
+    }
+    free(counts.uses);
+}
+
+// Copy a register into another, there is no move instruction
+static void emit_move(code_generator_t *cg, int destination, int source) {
+    if (destination == source) return;
+    emit_instruction(cg, LIT, destination, 0, 0);
+    emit_instruction(cg, ADD, destination, destination, source);
+}
+
+static void lower_statement(lowering_t *lowering, ir_node *node) {
+    code_generator_t *cg = lowering->code_generator;
+
+    switch (node->kind) {
+        case IR_ASSIGN: {
+            int home = home_register(lowering, node->sym);
+
+            // Promoted variables receive the result directly
+            int result = lower_expression(lowering, node->left, home);
+
+            if (home < 0) {
+                // Store the result of the expression in variable's address
+                emit_instruction(
+                    cg,
+                    STO,
+                    result,
+                    level_difference(lowering, node->sym),
+                    node->sym->address
+                );
+            }
+
+            // Done using the temporary registers
+            lowering->register_cursor = 0;
+            break;
+        }
+        case IR_BEGIN:
+            for (ir_node *s = node->left; s != NULL; s = s->next) {
+                lower_statement(lowering, s);
+            }
+            break;
+        case IR_IF: {
+            int condition = lower_expression(lowering, node->left, -1);
+
+            // Save current code spot
+            int start = cg->code_size;
+            // Emit the conditional jump instruction
+            emit_instruction(cg, JPC, condition, 0, 0);
+
+            // Condition value is no longer needed after the jump
+            lowering->register_cursor = 0;
+
+            lower_statement(lowering, node->right);
+
+            // Modify the conditional jump to jump after statement
+            set_modifier(cg, start, cg->code_size);
+            break;
+        }
+        case IR_WHILE: {
+            // Get condition evaluation code line
+            int condition = cg->code_size;
+
+            int result = lower_expression(lowering, node->left, -1);
+
+            // Get loop start line
+            int loop = cg->code_size;
+            // Generate conditional jump out of loop
+            emit_instruction(
+                cg,
+                JPC,
+                result,
+                0,
+                0   // Temporary until end of loop instruction is found
+            );
+
+            // Condition value is no longer needed after the jump
+            lowering->register_cursor = 0;
+
+            lower_statement(lowering, node->right);
+
+            // Generate unconditional jump to loop condition evaluation
+            emit_instruction(cg, JMP, 0, 0, condition);
+
+            // Modify jump line of conditional jump
+            set_modifier(cg, loop, cg->code_size);
+            break;
+        }
+        case IR_READ: {
+            int home = home_register(lowering, node->sym);
+
+            if (home >= 0) {
+                // Read straight into the variable's register
+                emit_instruction(cg, SIO_READ, home, 0, 0);
+                break;
+            }
+
+            // Read value into next available register
+            emit_instruction(cg, SIO_READ, lowering->register_cursor, 0, 0);
+
+            // Immediately store the value into the variable's address
+            emit_instruction(
+                cg,
+                STO,
+                lowering->register_cursor,
+                level_difference(lowering, node->sym),
+                node->sym->address
+            );
+            break;
+        }
+        case IR_CALL:
+            // The static link is the frame of the block declaring it
+            emit_instruction(
+                cg,
+                CAL,
+                0,
+                level_difference(lowering, node->sym),
+                node->sym->address
+            );
+            break;
+        case IR_WRITE: {
+            int result = lower_expression(lowering, node->left, -1);
+
+            // Emit write command from the register holding the value
+            emit_instruction(cg, SIO_WRITE, result, 0, 0);
+
+            lowering->register_cursor = 0;
+            break;
+        }
+        default: // IR_EMPTY
+            break;
+    }
+}
+
+/**
+ * @brief Emit the instructions evaluating an expression
+ *
+ * Temporaries are taken from the register cursor up. Without a target, the
+ * result is left in the temporary at the cursor, which is then advanced, or
+ * in the home register of a promoted variable, which leaves the cursor as is.
+ *
+ * @param lowering Lowering state
+ * @param root Labeled expression to evaluate
+ * @param target Register to leave the result in, or -1 for any
+ * @return int Register holding the result
+ */
+static int lower_expression(lowering_t *lowering, ir_node *root, int target) {
+    code_generator_t *cg = lowering->code_generator;
+    int depth = 0;
+    int result = -1;    // Register of the frame popped last
+
+    // Frames stand in for the calls of a recursive walk, each one resumed
+    // with the result of the operand it pushed
+    push_frame(lowering, &depth, root, target);
+    while (depth > 0) {
+        // Pushing may move the frames, so this one is not used after it
+        expression_frame *frame = &(lowering->frames[depth - 1]);
+        ir_node *node = frame->node;
+
+        if (frame->stage == 0) frame->base = lowering->register_cursor;
+        int base = frame->base;
+        int destination = frame->target >= 0 ? frame->target : base;
+
+        switch (node->kind) {
+            case IR_NUMBER:
+                emit_instruction(cg, LIT, destination, 0, node->value);
+                break;
+            case IR_VARIABLE: {
+                int home = home_register(lowering, node->sym);
+
+                if (home >= 0) {
+                    // The cursor is left as is
+                    if (frame->target >= 0) emit_move(cg, frame->target, home);
+                    result = frame->target >= 0 ? frame->target : home;
+                    depth--;
+                    continue;
+                }
+
+                emit_instruction(
+                    cg,
+                    LOD,
+                    destination,
+                    level_difference(lowering, node->sym),
+                    node->sym->address
+                );
+                break;
+            }
+            case IR_UNARY:
+                if (frame->stage == 0) {
+                    frame->stage = 1;
+                    push_frame(lowering, &depth, node->left, frame->target);
+                    continue;
+                }
+
+                // Unary operations work in place
+                lowering->register_cursor = base;
+                emit_move(cg, destination, result);
+                emit_instruction(cg, node->op, destination, 0, 0);
+                break;
+            default: { // IR_BINARY
+                if (is_shift(node)) {
+                    if (frame->stage == 0) {
+                        frame->stage = 1;
+                        push_frame(lowering, &depth, node->left, -1);
+                        continue;
+                    }
+                    emit_instruction(cg, node->op, destination, result,
+                        node->right->value);
+                    break;
+                }
+
+                ir_node *first = first_operand(node);
+                ir_node *second = second_operand(node);
+
+                if (frame->stage == 0) {
+                    frame->stage = 1;
+                    push_frame(lowering, &depth, first, -1);
+                    continue;
+                }
+
+                if (frame->stage == 1) {
+                    frame->first = result;
+                    frame->stage = 2;
+                    if (result == base && must_spill(lowering, second, base)) {
+                        frame->slot = lowering->spill_base +
+                            (lowering->spill_depth)++;
+
+                        // Free every register for the second operand
+                        emit_instruction(cg, STO, base, 0, frame->slot);
+                        lowering->register_cursor = base;
+                    }
+                    push_frame(lowering, &depth, second, -1);
+                    continue;
+                }
+
+                int first_register = frame->first;
+                int second_register = result;
+
+                if (frame->slot >= 0) {
+                    // Bring the first operand back next to the second
+                    first_register = lowering->register_cursor;
+                    emit_instruction(cg, LOD, first_register, 0, frame->slot);
+                    (lowering->spill_depth)--;
+                }
+
+                // Operands may have been evaluated out of order, so name
+                // them explicitly to keep non-commutative operations correct
+                bool left_first = first == node->left;
+                emit_instruction(
+                    cg,
+                    node->op,
+                    destination,
+                    left_first ? first_register : second_register,
+                    left_first ? second_register : first_register
+                );
+                break;
+            }
+        }
+
+        // Operations squash their operands into one value
+        lowering->register_cursor = frame->target >= 0 ? base : base + 1;
+        result = destination;
+        depth--;
+    }
+    return result;
+}
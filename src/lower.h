@@ -0,0 +1,108 @@
+#ifndef LOWER_H
+#define LOWER_H
+
+/**
+ * @file lower.h
+ * @brief Lowers the parser's IR into code generator instructions
+ *
+ * Expressions are evaluated in Sethi-Ullman order: the operand needing more
+ * registers is evaluated first, so that its registers are free again while
+ * the other operand is evaluated. When an operand still does not fit in the
+ * register file, the value already computed is spilled to a stack slot
+ * reserved after the program's variables.
+ *
+ * From optimization level 1, the most used variables are promoted into
+ * registers of their own for the whole program, and the remaining registers
+ * are used as temporaries. Only variables of the main program are promoted,
+ * since every other variable has an instance per active call of its
+ * procedure.
+ *
+ * The code of the procedures a block declares comes before the block's own
+ * code, which starts with a JMP over them.
+ *
+ */
+
+#include "ir.h"
+#include "codegen.h"
+#include "symbol.h"
+#include "options.h"
+
+/**
+ * @brief An operation part way through evaluation, see lower_expression
+ */
+typedef struct expression_frame {
+    ir_node *node;
+    int stage;              // Operands handled so far
+    int target;             // Register the result goes to, -1 for any
+    int base;               // Register cursor, or spill base, at the start
+    int first;              // What the operand handled first gave
+    int slot;               // Spill slot of the first operand, -1 if none
+} expression_frame;
+
+typedef struct lowering_t {
+    code_generator_t *code_generator;
+    symbol_table_t *symbol_table;
+    int level;              // Lexicographical level of the block lowered
+    int register_cursor;    // Next free temporary register, used as a stack
+    int num_temporaries;    // Registers below this are temporaries
+    int *home;              // Register of every symbol, -1 if none
+    int spill_base;         // Address of the first spill slot of the frame
+    int spill_depth;        // Spill slots currently in use
+    int num_spill_slots;    // Spill slots reserved in the frame
+    ir_order_t order;       // Nodes of the expression labeled or counted
+    expression_frame *frames;   // Operations being evaluated, innermost last
+    int frames_capacity;
+    int num_variables;      // Variables of the main block, when streamed
+    int frame_instruction;  // INC sizing the main block's frame, likewise
+} lowering_t;
+
+/**
+ * @brief Emit the instructions of a whole program
+ * 
+ * @param program IR_BLOCK node of the program
+ * @param table Symbol table the program's IR refers to
+ * @param generator Generator to emit into
+ * @param options Options the program is compiled with
+ */
+void lower_program(ir_node *program, symbol_table_t *table,
+    code_generator_t *generator, compile_options_t *options);
+
+/**
+ * @brief Start lowering a program one top-level statement at a time
+ *
+ * Emits the procedures of the main block and the start of its frame. The
+ * main block's statement is left out, so the block may hold no statement
+ * yet. Each statement of the main block's begin statement is then lowered
+ * by lower_top_statement and the program ended by finish_lowering, so its
+ * IR need not be kept once lowered. Only for programs compiled at
+ * optimization level 0, where no pass looks at the whole program, and
+ * whose main block declares variables, so its frame is sized by an INC
+ * whatever the statements need.
+ *
+ * @param lowering Lowering to start
+ * @param block IR_BLOCK node of the program
+ * @param table Symbol table the program's IR refers to
+ * @param generator Generator to emit into
+ */
+void start_lowering(lowering_t *lowering, ir_node *block,
+    symbol_table_t *table, code_generator_t *generator);
+
+/**
+ * @brief Emit the instructions of a statement of the main block
+ *
+ * @param lowering Lowering started by start_lowering
+ * @param statement Next statement of the main block's begin statement
+ */
+void lower_top_statement(lowering_t *lowering, ir_node *statement);
+
+/**
+ * @brief End a program lowered one statement at a time
+ *
+ * Sizes the main block's frame for the spill slots its statements need
+ * and frees the lowering.
+ *
+ * @param lowering Lowering started by start_lowering
+ */
+void finish_lowering(lowering_t *lowering);
+
+#endif /* LOWER_H */
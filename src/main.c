@@ -1,6 +1,497 @@
+#include "parser.h"
+#include "token_list.h"
+#include "vm.h"
+#include "opstats.h"
+#include "cfg.h"
+#include "cbackend.h"
+#include "scheduler.h"
+#include "cache.h"
+#include "lexeme_reader.h"
+#include "listing.h"
+#include "incremental.h"
+#include "batch.h"
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+// Number of pairs and triples shown by -s
+#define NUM_SHOWN_NGRAMS 10
+// Instructions a program runs before being preempted, unless -b is given
+#define DEFAULT_BUDGET 10000
+// Kilobytes the cache takes up before entries are evicted, unless -k is given
+#define DEFAULT_CACHE_SIZE 4096
+
+/**
+ * @brief Directives given to the compiler driver
+ */
+typedef struct driver_options {
+    bool print_code;        // -a
+    bool print_symbolic;    // -A
+    bool print_cfg;         // -g
+    bool print_c;           // -c
+    bool run;               // -v
+    bool print_dispatches;  // -d
+    bool print_ngrams;      // -s
+    int superinstructions;  // -f
+    int tiering_threshold;  // -j
+    bool binary_io;         // -B
+    bool use_display;       // -D
+    int workers;            // -p, 0 to run programs one after another
+    long budget;            // -b
+    char *cache_directory;  // -C, NULL to always compile
+    long cache_size;        // -k
+    int read_threads;       // -t
+    bool stream_code;       // -o
+    bool read_listings;     // -l
+    bool apply_edits;       // -e
+    bool run_records;       // -x
+    compile_options_t compile;  // -O
+} driver_options;
+
+static void usage(void) {
+    fprintf(stderr,
+        "Usage: compile [-a] [-A] [-g] [-c] [-v] [-d] [-s] [-B] [-D] [-f list] "
+        "[-j count] [-p workers] [-b budget] [-C directory] [-k size] "
+        "[-t threads] [-o] [-l] [-e] [-x] [-R] [-O level] <lexeme file>...\n"
+        "  -a       print the generated code\n"
+        "  -A       print the generated code with mnemonics and labels\n"
+        "  -g       print the control flow graph in Graphviz dot format\n"
+        "  -c       print the generated code translated to a C program\n"
+        "  -v       run the generated code on the virtual machine\n"
+        "  -d       print instruction and dispatch counts after running\n"
+        "  -s       print opcode pair and triple frequencies of all inputs\n"
+        "  -f list  fuse the comma separated superinstructions, or \"all\"\n"
+        "  -B       read and write raw 32 bit integers instead of text\n"
+        "  -D       find the frames of enclosing procedures by display\n"
+        "  -j count compile loops to native code after count iterations\n"
+        "  -p workers run the programs concurrently on worker threads,\n"
+        "           reading the input of each from <lexeme file>.in\n"
+        "  -b budget instructions a program runs before others get a turn\n"
+        "  -C directory reuse code compiled from identical input and options,\n"
+        "           kept in directory\n"
+        "  -k size  kilobytes the cache keeps, evicting the least recently\n"
+        "           used code beyond that\n"
+        "  -t threads read large lexeme lists on this many threads\n"
+        "  -o       stream the code of each file into <lexeme file>.code as\n"
+        "           it is generated, instead of any of the above\n"
+        "  -l       read code listings as printed by -a or -A instead of\n"
+        "           lexeme lists\n"
+        "  -e       apply the edits in <lexeme file>.edits one after another,\n"
+        "           reparsing only the statements they touch, then generate\n"
+        "           the code of the edited program\n"
+        "  -x       run the generated code once for every line of\n"
+        "           <lexeme file>.records, many lines at a time in lockstep\n"
+        "  -R       parse expressions by recursive descent\n"
+        "  -O level optimization level, from 0 (default) to %d\n",
+        MAX_OPTIMIZATION_LEVEL);
+    exit(EXIT_FAILURE);
+}
+
+static int parse_superinstructions(char *list) {
+    if (strcmp(list, "all") == 0) return SUPER_ALL;
+
+    int mask = SUPER_NONE;
+    for (char *name = strtok(list, ","); name != NULL;
+        name = strtok(NULL, ",")) {
+        int flag = string_to_superinstruction(name);
+        if (flag == SUPER_NONE) {
+            fprintf(stderr, "Unknown superinstruction: %s\n", name);
+            exit(EXIT_FAILURE);
+        }
+        mask |= flag;
+    }
+    return mask;
+}
+
+static void print_verification(char *path, verification_t *verification) {
+    if (verification->verified) {
+        fprintf(stderr, "%s: verified, %d registers, stack depth %d\n", path,
+            verification->max_register + 1, verification->max_stack);
+    } else {
+        fprintf(stderr, "%s: not verified, instruction %d: %s\n", path,
+            verification->error_index, verification->error);
+    }
+}
+
+// Read every integer of a file, returns how many were read
+static int read_input_file(char *path, int **values) {
+    char name[FILENAME_MAX];
+    int count = 0, capacity = 16, value;
+
+    *values = (int *)malloc(sizeof(int) * capacity);
+    if (*values == NULL) {
+        fprintf(stderr, "Could not allocate memory for the input\n");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(name, sizeof(name), "%s.in", path);
+    FILE *in = fopen(name, "r");
+    if (in == NULL) return 0;
+
+    while (fscanf(in, "%d", &value) == 1) {
+        if (count == capacity) {
+            capacity *= 2;
+            int *grown = (int *)realloc(*values, sizeof(int) * capacity);
+            if (grown == NULL) {
+                fprintf(stderr, "Could not allocate memory for the input\n");
+                exit(EXIT_FAILURE);
+            }
+            *values = grown;
+        }
+        (*values)[count++] = value;
+    }
+    fclose(in);
+    return count;
+}
+
+// Run every program added to the scheduler, returns whether all succeeded
+static bool run_concurrently(scheduler_t *scheduler, char **paths) {
+    bool success = true;
+
+    start_scheduler(scheduler);
+
+    // Programs reaching a read before their input arrives wait for it
+    for (int id = 0; id < scheduler->num_contexts; id++) {
+        int *values;
+        int count = read_input_file(paths[id], &values);
+        give_input(scheduler, id, values, count, true);
+        free(values);
+    }
+
+    // Outputs keep the order of the files, each is printed as soon as it
+    // and those before it are complete, whatever the later programs do
+    for (int id = 0; id < scheduler->num_contexts; id++) {
+        wait_context(scheduler, id);
+        vm_context *context = get_context(scheduler, id);
+
+        fwrite(context->output, 1, context->output_size, stdout);
+        fflush(stdout);
+        if (context->vm.error != NULL) {
+            fprintf(stderr, "%s: VM Error: %s\n", paths[id],
+                context->vm.error);
+            success = false;
+        }
+    }
+    wait_scheduler(scheduler);
+    return success;
+}
+
+// Compile a file's tokens straight into <path>.code
+static void stream_file(char *path, token_list_t *tokens,
+    driver_options *options) {
+    static parser_t parser;
+    char name[FILENAME_MAX];
+
+    snprintf(name, sizeof(name), "%s.code", path);
+    FILE *out = fopen(name, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "Could not open %s\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    init_parser(&parser, tokens, &(options->compile));
+    stream_code(&(parser.code_generator), out);
+    stream_program(&parser);
+    finish_code_stream(&(parser.code_generator));
+
+    if (fclose(out) != 0) {
+        fprintf(stderr, "Could not write %s\n", name);
+        exit(EXIT_FAILURE);
+    }
+    free_parser(&parser);
+}
+
+// Parse a file's tokens, then parse them again after every edit of
+// <path>.edits. Only the errors of the program as last edited are reported.
+static void edit_file(char *path, token_list_t *tokens,
+    driver_options *options, incremental_t *session) {
+    char name[FILENAME_MAX];
+    token_edit edit;
+
+    snprintf(name, sizeof(name), "%s.edits", path);
+    FILE *in = fopen(name, "r");
+    if (in == NULL) {
+        fprintf(stderr, "Could not open %s\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    start_incremental(session, tokens, &(options->compile));
+    while (read_edit(in, &edit)) {
+        update_incremental(session, &edit);
+        free_token_list(edit.inserted);
+    }
+    fclose(in);
+
+    if (options->print_dispatches) {
+        fprintf(stderr, "%s: %ld edits reparsed incrementally, "
+            "%ld parsed from scratch\n", path,
+            session->incremental_updates, session->full_parses);
+    }
+
+    // No code is generated for a program with errors
+    report_diagnostics(&(session->parser));
+}
+
+// Run the code once for every record of <path>.records, returns whether
+// every record halted without an error
+static bool run_records_file(char *path, code_generator_t *generator,
+    driver_options *options) {
+    char name[FILENAME_MAX];
+    batch_stats stats = { 0, 0, 0, 0 };
+    int num_records;
+    bool success = true;
+
+    snprintf(name, sizeof(name), "%s.records", path);
+    FILE *in = fopen(name, "r");
+    if (in == NULL) {
+        fprintf(stderr, "Could not open %s\n", name);
+        exit(EXIT_FAILURE);
+    }
+    batch_record *records = read_batch_records(in, &num_records);
+    fclose(in);
+
+    run_batch(generator, records, num_records, &stats);
+    print_batch_records(records, num_records, stdout);
+    for (int k = 0; k < num_records; k++) {
+        if (records[k].error != NULL) success = false;
+    }
+    free_batch_records(records, num_records);
+
+    if (options->print_dispatches) {
+        fprintf(stderr, "%s: %d records, %ld lockstep steps retiring %ld "
+            "instructions (%.2f of %d lanes busy)\n", path, num_records,
+            stats.steps, stats.lane_instructions, stats.steps > 0 ?
+            (double)stats.lane_instructions / stats.steps : 0.0, BATCH_LANES);
+        fprintf(stderr, "%s: %ld records finished on the scalar interpreter, "
+            "%ld instructions\n", path, stats.scalar_records,
+            stats.scalar_instructions);
+    }
+    return success;
+}
+
+// Compile a file and do with its code what the options ask, returns false
+// if running it with -x failed
+static bool compile_file(char *path, driver_options *options,
+    opcode_stats_t *stats, scheduler_t *scheduler, compile_cache_t *cache) {
+    static parser_t parser;
+    static code_generator_t cached;
+    static incremental_t session;
+    static vm_t vm;
+
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        fprintf(stderr, "Could not open %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    // A listing is loaded as is, like code found in the cache
+    code_generator_t *generator = &cached;
+    token_list_t *tokens = NULL;
+    if (options->read_listings) {
+        read_listing(in, &cached);
+    } else {
+        tokens = options->read_threads > 1 ?
+            read_token_list_parallel(in, options->read_threads) :
+            read_token_list(in);
+    }
+    fclose(in);
+
+    if (options->stream_code) {
+        stream_file(path, tokens, options);
+        free_token_list(tokens);
+        return true;
+    }
+
+    // A hit skips parsing, optimization and lowering altogether
+    bool parsed = false;
+    bool edited = false;
+    uint64_t key = 0;
+    if (cache != NULL) {
+        key = hash_compilation(tokens, &(options->compile));
+    }
+    if (tokens != NULL && options->apply_edits) {
+        edit_file(path, tokens, options, &session);
+        generator = incremental_code(&session);
+        edited = true;
+    } else if (tokens != NULL &&
+        (cache == NULL || !lookup_compiled(cache, key, &cached))) {
+        init_parser(&parser, tokens, &(options->compile));
+        parse_program(&parser);
+        generator = &(parser.code_generator);
+        parsed = true;
+        if (cache != NULL) store_compiled(cache, key, generator);
+    }
+
+    if (options->print_code) write_listing(generator, stdout, false);
+    if (options->print_symbolic) write_listing(generator, stdout, true);
+    if (options->print_cfg) {
+        static cfg_t cfg;
+        build_cfg(&cfg, generator);
+        write_cfg_dot(&cfg, generator, stdout);
+    }
+    if (options->print_c) write_c_program(generator, stdout);
+    if (options->print_ngrams) {
+        count_opcode_ngrams(stats, generator);
+    }
+
+    if (options->run && options->workers > 0) {
+        int id = add_context(scheduler, generator,
+            options->superinstructions);
+        if (options->use_display) {
+            enable_display(&(get_context(scheduler, id)->vm));
+        }
+    } else if (options->run) {
+        static input_buffer_t binary_input;
+        init_vm(&vm);
+        if (options->use_display) enable_display(&vm);
+        if (options->binary_io) {
+            // Every program reads from the same buffer, like standard_input
+            if (binary_input.stream == NULL) {
+                init_input_buffer(&binary_input, stdin, IO_BINARY, NULL);
+            }
+            set_vm_io(&vm, &binary_input, stdout, IO_BINARY);
+        }
+        load_program(&vm, generator,
+            options->superinstructions);
+        enable_tiering(&vm, options->tiering_threshold);
+        run_vm(&vm);
+        free_vm(&vm);
+
+        if (options->print_dispatches) {
+            fprintf(stderr, "%s: %ld instructions, %ld dispatches\n",
+                path, vm.instructions, vm.dispatches);
+            fprintf(stderr, "%s: %ld static links followed\n", path,
+                vm.links_followed);
+            print_verification(path, &(vm.verification));
+            if (options->tiering_threshold > 0) {
+                fprintf(stderr, "%s: %d loops compiled, entered %ld times\n",
+                    path, vm.num_compiled, vm.native_entries);
+            }
+        }
+    }
+
+    bool success = true;
+    if (options->run_records) {
+        success = run_records_file(path, generator, options);
+    }
+
+    if (parsed) free_parser(&parser);
+    if (edited) free_incremental(&session);
+    if (tokens != NULL) free_token_list(tokens);
+    return success;
+}
+
+int main(int argc, char **argv) {
+    static opcode_stats_t stats;
+    static scheduler_t scheduler;
+    static compile_cache_t cache;
+    driver_options options = {
+        false, false, false, false, false, false, false, SUPER_NONE, 0, false,
+        false, 0, DEFAULT_BUDGET, NULL, DEFAULT_CACHE_SIZE, 1, false, false,
+        false, false, default_compile_options()
+    };
+    int first_file = 1;
+
+    for (; first_file < argc && argv[first_file][0] == '-'; first_file++) {
+        char *arg = argv[first_file];
+
+        if (strcmp(arg, "-a") == 0) options.print_code = true;
+        else if (strcmp(arg, "-A") == 0) options.print_symbolic = true;
+        else if (strcmp(arg, "-g") == 0) options.print_cfg = true;
+        else if (strcmp(arg, "-c") == 0) options.print_c = true;
+        else if (strcmp(arg, "-v") == 0) options.run = true;
+        else if (strcmp(arg, "-d") == 0) options.print_dispatches = true;
+        else if (strcmp(arg, "-s") == 0) options.print_ngrams = true;
+        else if (strcmp(arg, "-B") == 0) options.binary_io = true;
+        else if (strcmp(arg, "-D") == 0) options.use_display = true;
+        else if (strcmp(arg, "-f") == 0 && first_file + 1 < argc) {
+            options.superinstructions =
+                parse_superinstructions(argv[++first_file]);
+        }
+        else if (strcmp(arg, "-j") == 0 && first_file + 1 < argc) {
+            options.tiering_threshold = atoi(argv[++first_file]);
+            if (options.tiering_threshold < 1) usage();
+        }
+        else if (strcmp(arg, "-p") == 0 && first_file + 1 < argc) {
+            options.workers = atoi(argv[++first_file]);
+            if (options.workers < 1) usage();
+        }
+        else if (strcmp(arg, "-b") == 0 && first_file + 1 < argc) {
+            options.budget = atol(argv[++first_file]);
+            if (options.budget < 1) usage();
+        }
+        else if (strcmp(arg, "-C") == 0 && first_file + 1 < argc) {
+            options.cache_directory = argv[++first_file];
+        }
+        else if (strcmp(arg, "-k") == 0 && first_file + 1 < argc) {
+            options.cache_size = atol(argv[++first_file]);
+            if (options.cache_size < 1) usage();
+        }
+        else if (strcmp(arg, "-t") == 0 && first_file + 1 < argc) {
+            options.read_threads = atoi(argv[++first_file]);
+            if (options.read_threads < 1) usage();
+        }
+        else if (strcmp(arg, "-o") == 0) options.stream_code = true;
+        else if (strcmp(arg, "-l") == 0) options.read_listings = true;
+        else if (strcmp(arg, "-e") == 0) options.apply_edits = true;
+        else if (strcmp(arg, "-x") == 0) options.run_records = true;
+        else if (strcmp(arg, "-R") == 0) {
+            options.compile.recursive_expressions = true;
+        }
+        else if (strcmp(arg, "-O") == 0 && first_file + 1 < argc) {
+            int level = atoi(argv[++first_file]);
+            if (level < 0 || level > MAX_OPTIMIZATION_LEVEL) usage();
+            options.compile.optimization_level = level;
+        }
+        else usage();
+    }
+    if (first_file == argc) usage();
+    // Streamed code is gone by the time the program is parsed
+    if (options.stream_code && (options.print_code ||
+        options.print_symbolic || options.print_cfg ||
+        options.print_c || options.run || options.print_ngrams ||
+        options.run_records || options.cache_directory != NULL)) {
+        usage();
+    }
+    // Listings are neither compiled nor cached, and edits change the tokens
+    // the cache and streamed code are keyed by and generated from
+    if ((options.read_listings || options.apply_edits) &&
+        (options.stream_code || options.cache_directory != NULL)) {
+        usage();
+    }
+    if (options.read_listings && options.apply_edits) usage();
+    // Records are the input, they cannot share stdin with -v
+    if (options.run_records && options.run) usage();
+    // Concurrent programs read text from their own files and are only
+    // interpreted
+    if (options.workers > 0 &&
+        (options.binary_io || options.tiering_threshold > 0)) {
+        usage();
+    }
+
+    init_opcode_stats(&stats);
+    init_scheduler(&scheduler, options.workers, options.budget);
+    if (options.cache_directory != NULL) {
+        init_compile_cache(&cache, options.cache_directory,
+            options.cache_size * 1024);
+    }
+    bool success = true;
+    for (int i = first_file; i < argc; i++) {
+        success = compile_file(argv[i], &options, &stats, &scheduler,
+            options.cache_directory != NULL ? &cache : NULL) && success;
+    }
+
+    if (options.run && options.workers > 0) {
+        success = run_concurrently(&scheduler, &argv[first_file]);
+    }
+    free_scheduler(&scheduler);
+
+    if (options.print_ngrams) {
+        print_opcode_stats(&stats, stdout, NUM_SHOWN_NGRAMS);
+    }
+    if (options.cache_directory != NULL && options.print_dispatches) {
+        print_cache_stats(&cache, stderr);
+    }
 
-int main(void) {
-    printf("PL/0 Parser / Code Generator\n");
-    return 0;
+    return success ? 0 : EXIT_FAILURE;
 }
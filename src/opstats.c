@@ -0,0 +1,105 @@
+#include "opstats.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief An n-gram and how often it occurred, used for sorting
+ */
+typedef struct ngram_count {
+    opcode ops[3];
+    long count;
+} ngram_count;
+
+void init_opcode_stats(opcode_stats_t *stats) {
+    memset(stats, 0, sizeof(opcode_stats_t));
+}
+
+static bool transfers_control(opcode op) {
+    return op == JMP || op == JPC || op == CAL || op == RTN || op == SIO_END;
+}
+
+void count_opcode_ngrams(opcode_stats_t *stats, code_generator_t *generator) {
+    cg_instruction *code = generator->code;
+    bool is_target[MAX_CODE_LENGTH] = { false };
+
+    for (int i = 0; i < generator->code_size; i++) {
+        opcode op = code[i].op;
+        if ((op == JMP || op == JPC || op == CAL) &&
+            code[i].modifier >= 0 && code[i].modifier < MAX_CODE_LENGTH) {
+            is_target[code[i].modifier] = true;
+        }
+    }
+
+    // Length of the straight-line run ending at the current instruction
+    int run = 0;
+    for (int i = 0; i < generator->code_size; i++) {
+        opcode op = code[i].op;
+
+        if (is_target[i]) run = 0;
+        run++;
+
+        stats->unigrams[op]++;
+        if (run >= 2) stats->bigrams[code[i - 1].op][op]++;
+        if (run >= 3) stats->trigrams[code[i - 2].op][code[i - 1].op][op]++;
+
+        if (transfers_control(op)) run = 0;
+    }
+
+    stats->num_programs++;
+}
+
+static int compare_ngram_counts(const void *a, const void *b) {
+    long difference = ((ngram_count *)b)->count - ((ngram_count *)a)->count;
+    return (difference > 0) - (difference < 0);
+}
+
+static void print_ngrams(ngram_count *counts, int num_counts, int n,
+    long total, FILE *out, int top) {
+    qsort(counts, num_counts, sizeof(ngram_count), compare_ngram_counts);
+
+    for (int i = 0; i < num_counts && i < top && counts[i].count > 0; i++) {
+        fprintf(out, "  %8ld  %5.1f%%  ", counts[i].count,
+            100.0 * counts[i].count / total);
+        for (int k = 0; k < n; k++) {
+            fprintf(out, "%s%s", k > 0 ? "+" : "",
+                opcode_to_string(counts[i].ops[k]));
+        }
+        fprintf(out, "\n");
+    }
+}
+
+void print_opcode_stats(opcode_stats_t *stats, FILE *out, int top) {
+    static ngram_count counts[NUM_OPCODES * NUM_OPCODES * NUM_OPCODES];
+    long total = 0;
+    int num_counts = 0;
+
+    for (int a = 1; a < NUM_OPCODES; a++) total += stats->unigrams[a];
+    // Avoid dividing by zero on an empty corpus
+    if (total == 0) total = 1;
+
+    fprintf(out, "Programs: %ld, instructions: %ld\n", stats->num_programs,
+        total);
+
+    for (int a = 1; a < NUM_OPCODES; a++) {
+        for (int b = 1; b < NUM_OPCODES; b++) {
+            ngram_count c = { { a, b, 0 }, stats->bigrams[a][b] };
+            counts[num_counts++] = c;
+        }
+    }
+    fprintf(out, "Most frequent pairs:\n");
+    print_ngrams(counts, num_counts, 2, total, out, top);
+
+    num_counts = 0;
+    for (int a = 1; a < NUM_OPCODES; a++) {
+        for (int b = 1; b < NUM_OPCODES; b++) {
+            for (int c = 1; c < NUM_OPCODES; c++) {
+                ngram_count t = { { a, b, c }, stats->trigrams[a][b][c] };
+                counts[num_counts++] = t;
+            }
+        }
+    }
+    fprintf(out, "Most frequent triples:\n");
+    print_ngrams(counts, num_counts, 3, total, out, top);
+}
@@ -0,0 +1,49 @@
+#ifndef OPSTATS_H
+#define OPSTATS_H
+
+/**
+ * @file opstats.h
+ * @brief Opcode n-gram frequencies over a corpus of generated programs
+ *
+ * Used to decide which instruction sequences are worth fusing into
+ * superinstructions. Sequences never span a jump target or follow a control
+ * transfer, since those could not be fused at load time anyway.
+ *
+ */
+
+#include "codegen.h"
+
+#include <stdio.h>
+
+typedef struct opcode_stats_t {
+    long unigrams[NUM_OPCODES];
+    long bigrams[NUM_OPCODES][NUM_OPCODES];
+    long trigrams[NUM_OPCODES][NUM_OPCODES][NUM_OPCODES];
+    long num_programs;
+} opcode_stats_t;
+
+/**
+ * @brief Initialize the given statistics with zero counts
+ * 
+ * @param stats The statistics to initialize
+ */
+void init_opcode_stats(opcode_stats_t *stats);
+
+/**
+ * @brief Add the n-grams of a generated program to the statistics
+ * 
+ * @param stats Statistics to add to
+ * @param generator Generator holding the program's code
+ */
+void count_opcode_ngrams(opcode_stats_t *stats, code_generator_t *generator);
+
+/**
+ * @brief Print the most frequent pairs and triples, most frequent first
+ * 
+ * @param stats Statistics to print
+ * @param out Stream to print to
+ * @param top Maximum number of pairs and of triples to print
+ */
+void print_opcode_stats(opcode_stats_t *stats, FILE *out, int top);
+
+#endif /* OPSTATS_H */
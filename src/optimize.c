@@ -0,0 +1,1056 @@
+#include "optimize.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+/**
+ * @brief What is known about a variable at a point in the program
+ */
+typedef enum value_state {
+    VALUE_UNREACHED = 0,    // No path reaches this point yet
+    VALUE_CONSTANT,         // Holds value on every path
+    VALUE_VARYING           // Holds different or unknown values
+} value_state;
+
+typedef struct known_value {
+    value_state state;
+    int value;
+} known_value;
+
+/**
+ * @brief Known values of every symbol at a point in the program
+ */
+typedef struct constant_env {
+    symbol *symbols;                            // Start of the symbol table
+    int num_symbols;
+    bool *escaped;                              // Variables calls may change
+    ir_order_t *order;                          // For walking expressions
+    known_value values[];                       // Indexed like symbols
+} constant_env;
+
+void optimize_program(ir_node *program, symbol_table_t *table,
+    ir_arena_t *arena, compile_options_t *options) {
+    if (options->optimization_level >= 1) {
+        propagate_constants(program, table);
+        eliminate_dead_code(program, table);
+    }
+    if (options->optimization_level >= 2) {
+        hoist_invariants(program, table, arena);
+    }
+    if (options->optimization_level >= 3) {
+        reduce_strength(program, arena);
+    }
+}
+
+/**
+ * @brief Find the variables used outside of the block declaring them
+ * 
+ * Only procedures nested in a variable's block can read or assign it, so a 
+ * call leaves every other variable as it was. Statements are walked with 
+ * the level of the block they belong to.
+ * 
+ * @param node Node to walk, along with the nodes chained to it
+ * @param level Lexicographical level of the block holding the node
+ * @param symbols Start of the symbol table
+ * @param escaped Set for every variable used by a nested procedure
+ * @param order List to walk expressions with
+ */
+static void find_escaped(ir_node *node, int level, symbol *symbols,
+    bool *escaped, ir_order_t *order) {
+    for (; node != NULL; node = node->next) {
+        if ((node->kind == IR_ASSIGN || node->kind == IR_READ) &&
+            node->sym->level != level) {
+            escaped[node->sym - symbols] = true;
+        }
+
+        if (node->kind == IR_NUMBER || node->kind == IR_VARIABLE ||
+            node->kind == IR_UNARY || node->kind == IR_BINARY) {
+            list_expression(order, node);
+            for (int i = 0; i < order->size; i++) {
+                ir_node *n = order->nodes[i];
+                if (n->kind == IR_VARIABLE && n->sym->level != level) {
+                    escaped[n->sym - symbols] = true;
+                }
+            }
+            continue;
+        }
+
+        int inner = node->kind == IR_PROCEDURE ? level + 1 : level;
+        find_escaped(node->left, inner, symbols, escaped, order);
+        find_escaped(node->right, level, symbols, escaped, order);
+    }
+}
+
+// Variables used outside of the block declaring them, indexed like symbols
+// and with room for every symbol the table can hold
+static bool *escaped_variables(ir_node *program, symbol_table_t *table,
+    ir_order_t *order) {
+    bool *escaped = (bool *)calloc(table->capacity, sizeof(bool));
+    if (escaped == NULL) {
+        fprintf(stderr, "ERROR: Could not allocate optimization state\n");
+        exit(EXIT_FAILURE);
+    }
+
+    find_escaped(program, 0, table->symbols, escaped, order);
+    return escaped;
+}
+
+// Apply an operation to constants, returns false if it cannot be folded
+static bool fold_operation(opcode op, int a, int b, int *result) {
+    // Wrap around like the virtual machine instead of overflowing
+    unsigned int ua = (unsigned int)a;
+    unsigned int ub = (unsigned int)b;
+
+    switch (op) {
+        case NEG: *result = (int)(0u - ua); break;
+        case ODD: *result = a % 2; break;
+        case ADD: *result = (int)(ua + ub); break;
+        case SUB: *result = (int)(ua - ub); break;
+        case MUL: *result = (int)(ua * ub); break;
+        case DIV:
+        case MOD:
+            // Leave traps for the virtual machine to report
+            if (b == 0) return false;
+            // Dividing by -1 negates, INT_MIN / -1 wraps around
+            if (b == -1) *result = op == DIV ? (int)(0u - ua) : 0;
+            else *result = op == DIV ? a / b : a % b;
+            break;
+        case EQL: *result = a == b; break;
+        case NEQ: *result = a != b; break;
+        case LSS: *result = a < b; break;
+        case LEQ: *result = a <= b; break;
+        case GTR: *result = a > b; break;
+        case GEQ: *result = a >= b; break;
+        case SHL: *result = (int)(ua << b); break;
+        case SHR: *result = a >> b; break;
+        case MULH: *result = (int)(((long long)a * b) >> 32); break;
+        default: return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Evaluate an expression as far as the known values allow
+ * 
+ * @param node Expression to evaluate
+ * @param env Known values of the variables
+ * @param rewrite Whether to replace constant subexpressions in the IR
+ * @param value Set to the value of the expression if it is constant
+ * @return bool Whether the expression is constant
+ */
+static bool fold_expression(ir_node *node, constant_env *env, bool rewrite,
+    int *value) {
+    ir_order_t *order = env->order;
+
+    // Operands are folded before the operations using them, every node
+    // marked if constant, with its value
+    list_expression(order, node);
+    for (int i = 0; i < order->size; i++) {
+        ir_node *n = order->nodes[i];
+        bool constant = false;
+        int result = 0;
+
+        switch (n->kind) {
+            case IR_NUMBER:
+                constant = true;
+                result = n->value;
+                break;
+            case IR_VARIABLE: {
+                known_value *known = &(env->values[n->sym - env->symbols]);
+                constant = known->state == VALUE_CONSTANT;
+                result = known->value;
+                break;
+            }
+            case IR_UNARY:
+                constant = order->marks[i - 1] &&
+                    fold_operation(n->op, order->values[i - 1], 0, &result);
+                break;
+            default: { // IR_BINARY
+                int left = i - 1 - order->sizes[i - 1];
+                constant = order->marks[left] && order->marks[i - 1] &&
+                    fold_operation(n->op, order->values[left],
+                    order->values[i - 1], &result);
+                break;
+            }
+        }
+
+        order->marks[i] = constant;
+        order->values[i] = result;
+        if (constant && rewrite && n->kind != IR_NUMBER) {
+            n->kind = IR_NUMBER;
+            n->value = result;
+            n->sym = NULL;
+            n->left = NULL;
+            n->right = NULL;
+        }
+    }
+
+    *value = order->values[order->size - 1];
+    return order->marks[order->size - 1];
+}
+
+static void set_varying(constant_env *env, symbol *sym) {
+    env->values[sym - env->symbols].state = VALUE_VARYING;
+}
+
+// Merge the values of another path into env
+static void meet(constant_env *env, constant_env *other) {
+    for (int i = 0; i < env->num_symbols; i++) {
+        known_value *a = &(env->values[i]);
+        known_value *b = &(other->values[i]);
+
+        if (b->state == VALUE_UNREACHED) continue;
+        if (a->state == VALUE_UNREACHED) {
+            *a = *b;
+        } else if (a->state == VALUE_CONSTANT && (b->state == VALUE_VARYING ||
+            a->value != b->value)) {
+            a->state = VALUE_VARYING;
+        }
+    }
+}
+
+static bool same_env(constant_env *a, constant_env *b) {
+    for (int i = 0; i < a->num_symbols; i++) {
+        known_value *x = &(a->values[i]);
+        known_value *y = &(b->values[i]);
+
+        if (x->state != y->state) return false;
+        if (x->state == VALUE_CONSTANT && x->value != y->value) return false;
+    }
+    return true;
+}
+
+static size_t env_size(constant_env *env) {
+    return sizeof(constant_env) + sizeof(known_value) * env->num_symbols;
+}
+
+// Environment for the symbols of a table, values left uninitialized
+static constant_env *create_env(symbol_table_t *table, bool *escaped,
+    ir_order_t *order) {
+    constant_env *env = (constant_env *)malloc(sizeof(constant_env) +
+        sizeof(known_value) * table->num_symbols);
+    if (env == NULL) {
+        fprintf(stderr, "ERROR: Could not allocate optimization state\n");
+        exit(EXIT_FAILURE);
+    }
+    env->symbols = table->symbols;
+    env->num_symbols = table->num_symbols;
+    env->escaped = escaped;
+    env->order = order;
+    return env;
+}
+
+static constant_env *copy_env(constant_env *env) {
+    constant_env *copy = (constant_env *)malloc(env_size(env));
+    if (copy == NULL) {
+        fprintf(stderr, "ERROR: Could not allocate optimization state\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(copy, env, env_size(env));
+    return copy;
+}
+
+/**
+ * @brief Update env to the known values after a statement
+ * 
+ * @param node Statement to analyze
+ * @param env Known values before the statement, updated in place
+ * @param rewrite Whether to replace constant expressions in the IR
+ */
+static void propagate_statement(ir_node *node, constant_env *env,
+    bool rewrite) {
+    int value;
+
+    switch (node->kind) {
+        case IR_ASSIGN: {
+            known_value *known = &(env->values[node->sym - env->symbols]);
+            if (fold_expression(node->left, env, rewrite, &value)) {
+                known->state = VALUE_CONSTANT;
+                known->value = value;
+            } else {
+                known->state = VALUE_VARYING;
+            }
+            break;
+        }
+        case IR_READ:
+            set_varying(env, node->sym);
+            break;
+        case IR_CALL:
+            for (int i = 0; i < env->num_symbols; i++) {
+                if (env->escaped[i] && env->values[i].state == VALUE_CONSTANT) {
+                    env->values[i].state = VALUE_VARYING;
+                }
+            }
+            break;
+        case IR_WRITE:
+            fold_expression(node->left, env, rewrite, &value);
+            break;
+        case IR_BEGIN:
+            for (ir_node *s = node->left; s != NULL; s = s->next) {
+                propagate_statement(s, env, rewrite);
+            }
+            break;
+        case IR_IF: {
+            bool constant = fold_expression(node->left, env, rewrite, &value);
+
+            // The statement never runs, so nothing changes
+            if (constant && value == 0) break;
+
+            constant_env *taken = copy_env(env);
+            propagate_statement(node->right, taken, rewrite);
+
+            if (constant) memcpy(env, taken, env_size(env));
+            else meet(env, taken);
+
+            free(taken);
+            break;
+        }
+        case IR_WHILE: {
+            // Values at the condition, on entry and after every iteration
+            constant_env *head = copy_env(env);
+            constant_env *body = copy_env(env);
+
+            while (true) {
+                bool constant = fold_expression(node->left, head, false,
+                    &value);
+                if (constant && value == 0) break;
+
+                memcpy(body, head, env_size(env));
+                propagate_statement(node->right, body, false);
+
+                // Values reaching the condition through the back-edge
+                meet(body, env);
+                if (same_env(body, head)) break;
+                memcpy(head, body, env_size(env));
+            }
+
+            if (rewrite) {
+                fold_expression(node->left, head, true, &value);
+                memcpy(body, head, env_size(env));
+                propagate_statement(node->right, body, true);
+            }
+
+            // The loop is left from its condition
+            memcpy(env, head, env_size(env));
+            free(head);
+            free(body);
+            break;
+        }
+        default: // IR_EMPTY
+            break;
+    }
+}
+
+// Propagate through a block and every procedure nested in it
+static void propagate_block(ir_node *block, constant_env *env) {
+    for (ir_node *p = block->right; p != NULL; p = p->next) {
+        propagate_block(p->left, env);
+    }
+
+    // Nothing is known about any variable when a block starts
+    for (int i = 0; i < env->num_symbols; i++) {
+        env->values[i].state = VALUE_VARYING;
+        env->values[i].value = 0;
+    }
+    propagate_statement(block->left, env, true);
+}
+
+void propagate_constants(ir_node *program, symbol_table_t *table) {
+    ir_order_t order;
+
+    init_ir_order(&order);
+    constant_env *env = create_env(table,
+        escaped_variables(program, table, &order), &order);
+
+    propagate_block(program, env);
+    free(env->escaped);
+    free(env);
+    free_ir_order(&order);
+}
+
+/**
+ * @brief Variables that may be read before they are next assigned
+ */
+typedef struct live_set {
+    symbol *symbols;                    // Start of the symbol table
+    int num_symbols;
+    bool *escaped;                      // Variables calls may read
+    ir_order_t *order;                  // For walking expressions
+    bool live[];                        // Indexed like symbols
+} live_set;
+
+static size_t live_set_size(live_set *set) {
+    return sizeof(live_set) + sizeof(bool) * set->num_symbols;
+}
+
+// Set for the symbols of a table, live variables left uninitialized
+static live_set *create_live_set(symbol_table_t *table, bool *escaped,
+    ir_order_t *order) {
+    live_set *set = (live_set *)malloc(sizeof(live_set) +
+        sizeof(bool) * table->num_symbols);
+    if (set == NULL) {
+        fprintf(stderr, "ERROR: Could not allocate optimization state\n");
+        exit(EXIT_FAILURE);
+    }
+    set->symbols = table->symbols;
+    set->num_symbols = table->num_symbols;
+    set->escaped = escaped;
+    set->order = order;
+    return set;
+}
+
+static live_set *copy_live_set(live_set *set) {
+    live_set *copy = (live_set *)malloc(live_set_size(set));
+    if (copy == NULL) {
+        fprintf(stderr, "ERROR: Could not allocate optimization state\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(copy, set, live_set_size(set));
+    return copy;
+}
+
+// Whether the operation itself may stop the virtual machine
+static bool traps(ir_node *node) {
+    return node->kind == IR_BINARY && (node->op == DIV || node->op == MOD) &&
+        (node->right->kind != IR_NUMBER || node->right->value == 0);
+}
+
+// Whether evaluating the expression may stop the virtual machine
+static bool may_trap(ir_order_t *order, ir_node *node) {
+    list_expression(order, node);
+    for (int i = 0; i < order->size; i++) {
+        if (traps(order->nodes[i])) return true;
+    }
+    return false;
+}
+
+static void add_uses(live_set *set, ir_node *node) {
+    ir_order_t *order = set->order;
+
+    list_expression(order, node);
+    for (int i = 0; i < order->size; i++) {
+        ir_node *n = order->nodes[i];
+        if (n->kind == IR_VARIABLE) set->live[n->sym - set->symbols] = true;
+    }
+}
+
+// Add the variables of other to set, returns whether set changed
+static bool add_live(live_set *set, live_set *other) {
+    bool changed = false;
+    for (int i = 0; i < set->num_symbols; i++) {
+        if (other->live[i] && !set->live[i]) {
+            set->live[i] = true;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+static void make_empty(ir_node *node) {
+    node->kind = IR_EMPTY;
+    node->sym = NULL;
+    node->left = NULL;
+    node->right = NULL;
+}
+
+// Replace node by the statement it always runs, keeping its place in a list
+static void inline_statement(ir_node *node, ir_node *statement) {
+    ir_node *next = node->next;
+    *node = *statement;
+    node->next = next;
+}
+
+// Remove or inline branches whose condition is a constant
+static void remove_unreachable(ir_node *node) {
+    switch (node->kind) {
+        case IR_BEGIN:
+            for (ir_node *s = node->left; s != NULL; s = s->next) {
+                remove_unreachable(s);
+            }
+            break;
+        case IR_IF:
+            remove_unreachable(node->right);
+            if (node->left->kind != IR_NUMBER) break;
+
+            if (node->left->value == 0) make_empty(node);
+            else inline_statement(node, node->right);
+            break;
+        case IR_WHILE:
+            remove_unreachable(node->right);
+            if (node->left->kind == IR_NUMBER && node->left->value == 0) {
+                make_empty(node);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void live_statement(ir_node *node, live_set *set, bool rewrite);
+
+// Walk a list of statements from last to first
+static void live_statement_list(ir_node *first, live_set *set,
+    bool rewrite) {
+    int count = 0;
+
+    for (ir_node *s = first; s != NULL; s = s->next) count++;
+    if (count == 0) return;
+
+    // Lists can be long, so they are walked backwards from an array
+    ir_node **statements = (ir_node **)malloc(sizeof(ir_node *) * count);
+    if (statements == NULL) {
+        fprintf(stderr, "ERROR: Could not allocate optimization state\n");
+        exit(EXIT_FAILURE);
+    }
+    count = 0;
+    for (ir_node *s = first; s != NULL; s = s->next) statements[count++] = s;
+
+    while (count > 0) live_statement(statements[--count], set, rewrite);
+    free(statements);
+}
+
+/**
+ * @brief Update set to the variables live before a statement
+ * 
+ * @param node Statement to analyze
+ * @param set Variables live after the statement, updated in place
+ * @param rewrite Whether to remove dead assignments from the IR
+ */
+static void live_statement(ir_node *node, live_set *set, bool rewrite) {
+    switch (node->kind) {
+        case IR_ASSIGN: {
+            int index = node->sym - set->symbols;
+
+            if (!set->live[index] && !may_trap(set->order, node->left)) {
+                if (rewrite) make_empty(node);
+                break;
+            }
+
+            set->live[index] = false;
+            add_uses(set, node->left);
+            break;
+        }
+        case IR_READ:
+            // Still consumes input, so it is never removed
+            set->live[node->sym - set->symbols] = false;
+            break;
+        case IR_CALL:
+            for (int i = 0; i < set->num_symbols; i++) {
+                if (set->escaped[i]) set->live[i] = true;
+            }
+            break;
+        case IR_WRITE:
+            add_uses(set, node->left);
+            break;
+        case IR_BEGIN:
+            live_statement_list(node->left, set, rewrite);
+            break;
+        case IR_IF: {
+            live_set *taken = copy_live_set(set);
+
+            live_statement(node->right, taken, rewrite);
+            add_live(set, taken);
+            add_uses(set, node->left);
+
+            // Nothing left to do when the condition is true
+            if (rewrite && node->right->kind == IR_EMPTY &&
+                !may_trap(set->order, node->left)) {
+                make_empty(node);
+            }
+            free(taken);
+            break;
+        }
+        case IR_WHILE: {
+            // Variables live at the condition, grown until stable
+            live_set *head = copy_live_set(set);
+            live_set *body = copy_live_set(set);
+
+            add_uses(head, node->left);
+            do {
+                memcpy(body, head, live_set_size(set));
+                live_statement(node->right, body, false);
+            } while (add_live(head, body));
+
+            if (rewrite) {
+                memcpy(body, head, live_set_size(set));
+                live_statement(node->right, body, true);
+            }
+
+            memcpy(set, head, live_set_size(set));
+            free(head);
+            free(body);
+            break;
+        }
+        default: // IR_EMPTY
+            break;
+    }
+}
+
+// Remove dead code from a block and every procedure nested in it
+static void eliminate_block(ir_node *block, live_set *set, int level) {
+    for (ir_node *p = block->right; p != NULL; p = p->next) {
+        eliminate_block(p->left, set, level + 1);
+    }
+
+    remove_unreachable(block->left);
+
+    // Nothing is read after the program ends, but the caller of a procedure
+    // may read any variable used by a procedure
+    for (int i = 0; i < set->num_symbols; i++) {
+        set->live[i] = level > 0 && set->escaped[i];
+    }
+    live_statement(block->left, set, true);
+}
+
+void eliminate_dead_code(ir_node *program, symbol_table_t *table) {
+    ir_order_t order;
+
+    init_ir_order(&order);
+    live_set *set = create_live_set(table,
+        escaped_variables(program, table, &order), &order);
+
+    eliminate_block(program, set, 0);
+    free(set->escaped);
+    free(set);
+    free_ir_order(&order);
+}
+
+/**
+ * @brief Variables assigned somewhere inside of a loop
+ */
+typedef struct assigned_set {
+    bool *assigned;                         // Indexed like symbols
+    symbol *symbols;                        // Start of the symbol table
+    int num_symbols;
+    bool *escaped;                          // Variables calls may assign
+} assigned_set;
+
+/**
+ * @brief State of the loop invariant code motion pass
+ */
+typedef struct hoisting {
+    ir_node *block;         // Block whose frame holds the new variables
+    int level;              // Lexicographical level of the block
+    symbol_table_t *table;
+    ir_arena_t *arena;
+    bool *escaped;          // Indexed like symbols, temporaries included
+    ir_node *first;         // First assignment of the loop's preheader
+    ir_node *last;          // Last assignment of the loop's preheader
+    int num_temporaries;    // Variables created to hold hoisted values
+    ir_order_t order;       // Expression hoisted from
+    ir_order_t compared[2]; // Expressions compared with each other
+} hoisting;
+
+static void find_assigned(ir_node *node, assigned_set *set) {
+    switch (node->kind) {
+        case IR_ASSIGN:
+        case IR_READ:
+            set->assigned[node->sym - set->symbols] = true;
+            break;
+        case IR_CALL:
+            for (int i = 0; i < set->num_symbols; i++) {
+                if (set->escaped[i]) set->assigned[i] = true;
+            }
+            break;
+        case IR_BEGIN:
+            for (ir_node *s = node->left; s != NULL; s = s->next) {
+                find_assigned(s, set);
+            }
+            break;
+        case IR_IF:
+        case IR_WHILE:
+            find_assigned(node->right, set);
+            break;
+        default: // IR_WRITE, IR_EMPTY
+            break;
+    }
+}
+
+// Listings of two expressions match node for node only if the expressions
+// do, the kind of each node telling how many operands it has
+static bool same_expression(hoisting *h, ir_node *a, ir_node *b) {
+    ir_order_t *x = &(h->compared[0]);
+    ir_order_t *y = &(h->compared[1]);
+
+    list_expression(x, a);
+    list_expression(y, b);
+    if (x->size != y->size) return false;
+
+    for (int i = 0; i < x->size; i++) {
+        ir_node *m = x->nodes[i];
+        ir_node *n = y->nodes[i];
+
+        if (m->kind != n->kind || m->op != n->op || m->value != n->value ||
+            m->sym != n->sym) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Variable holding the value of an invariant expression, NULL if none left
+static symbol *hoisted_variable(hoisting *h, ir_node *node) {
+    // Expressions hoisted twice share a variable
+    for (ir_node *s = h->first; s != NULL; s = s->next) {
+        if (same_expression(h, s->left, node)) return s->sym;
+    }
+
+    // Identifiers cannot start with $, so the name never clashes
+    char name[12];
+    snprintf(name, sizeof(name), "$%d", h->num_temporaries);
+    symbol temporary = create_var_symbol(name, h->level);
+    if (!insert_symbol(h->table, &temporary)) return NULL;
+    (h->num_temporaries)++;
+
+    // The variable goes after the others in the block's frame
+    symbol *sym = &(h->table->symbols[h->table->num_symbols - 1]);
+    sym->address = 4 + (h->block->value)++;
+    ir_node *copy = create_ir_node(h->arena, IR_NUMBER);
+    *copy = *node;
+
+    ir_node *assignment = ir_statement(h->arena, IR_ASSIGN, sym, copy, NULL);
+    if (h->first == NULL) h->first = assignment;
+    else h->last->next = assignment;
+    h->last = assignment;
+    return sym;
+}
+
+/**
+ * @brief Replace the largest invariant operations of an expression
+ * 
+ * @param h Hoisting state of the loop
+ * @param node Expression inside of the loop
+ * @param set Variables assigned in the loop
+ * @param always_run Whether the expression runs whenever the loop is reached
+ */
+static void hoist_expression(hoisting *h, ir_node *node, assigned_set *set,
+    bool always_run) {
+    ir_order_t *order = &(h->order);
+
+    // Mark the subexpressions reading none of the variables assigned in the
+    // loop. Hoisting runs them even if the loop body never does, so they
+    // must not be able to stop the machine either.
+    list_expression(order, node);
+    for (int i = 0; i < order->size; i++) {
+        ir_node *n = order->nodes[i];
+        bool hoistable = (always_run || !traps(n)) &&
+            !(n->kind == IR_VARIABLE && set->assigned[n->sym - set->symbols]);
+
+        if (n->kind == IR_UNARY || n->kind == IR_BINARY) {
+            hoistable = hoistable && order->marks[i - 1];
+        }
+        if (n->kind == IR_BINARY) {
+            hoistable = hoistable && order->marks[i - 1 - order->sizes[i - 1]];
+        }
+        order->marks[i] = hoistable;
+    }
+
+    // Operations are visited from the root down, left operands first, and
+    // nothing below a hoisted one. Indices to visit are kept in values.
+    int *pending = order->values;
+    int num_pending = 0;
+
+    pending[num_pending++] = order->size - 1;
+    while (num_pending > 0) {
+        int i = pending[--num_pending];
+        ir_node *n = order->nodes[i];
+
+        if (n->kind != IR_UNARY && n->kind != IR_BINARY) continue;
+
+        if (order->marks[i]) {
+            symbol *sym = hoisted_variable(h, n);
+            if (sym != NULL) {
+                n->kind = IR_VARIABLE;
+                n->sym = sym;
+                n->left = NULL;
+                n->right = NULL;
+            }
+            continue;
+        }
+
+        if (n->kind == IR_BINARY) {
+            pending[num_pending++] = i - 1;
+            pending[num_pending++] = i - 1 - order->sizes[i - 1];
+        } else {
+            pending[num_pending++] = i - 1;
+        }
+    }
+}
+
+static void hoist_statement(hoisting *h, ir_node *node, assigned_set *set) {
+    switch (node->kind) {
+        case IR_ASSIGN:
+        case IR_WRITE:
+            hoist_expression(h, node->left, set, false);
+            break;
+        case IR_BEGIN:
+            for (ir_node *s = node->left; s != NULL; s = s->next) {
+                hoist_statement(h, s, set);
+            }
+            break;
+        case IR_IF:
+        case IR_WHILE:
+            hoist_expression(h, node->left, set, false);
+            hoist_statement(h, node->right, set);
+            break;
+        default: // IR_READ, IR_CALL, IR_EMPTY
+            break;
+    }
+}
+
+// Hoist out of every loop, innermost loops first
+static void hoist_loops(hoisting *h, ir_node *node) {
+    switch (node->kind) {
+        case IR_BEGIN:
+            for (ir_node *s = node->left; s != NULL; s = s->next) {
+                hoist_loops(h, s);
+            }
+            return;
+        case IR_IF:
+            hoist_loops(h, node->right);
+            return;
+        case IR_WHILE:
+            break;
+        default:
+            return;
+    }
+
+    hoist_loops(h, node->right);
+
+    // Temporaries hoisted out of this loop are looked up in it too
+    static assigned_set set;
+    set.assigned = (bool *)calloc(h->table->capacity, sizeof(bool));
+    if (set.assigned == NULL) {
+        fprintf(stderr, "ERROR: Could not allocate optimization state\n");
+        exit(EXIT_FAILURE);
+    }
+    set.symbols = h->table->symbols;
+    set.num_symbols = h->table->num_symbols;
+    set.escaped = h->escaped;
+    find_assigned(node->right, &set);
+
+    h->first = NULL;
+    h->last = NULL;
+    // The condition runs at least once, the body maybe never
+    hoist_expression(h, node->left, &set, true);
+    hoist_statement(h, node->right, &set);
+    free(set.assigned);
+    if (h->first == NULL) return;
+
+    // The loop becomes a begin statement running the preheader first
+    ir_node *loop = create_ir_node(h->arena, IR_WHILE);
+    *loop = *node;
+    loop->next = NULL;
+    h->last->next = loop;
+
+    node->kind = IR_BEGIN;
+    node->left = h->first;
+    node->right = NULL;
+}
+
+// Hoist out of the loops of a block and of every procedure nested in it
+static void hoist_block(hoisting *h, ir_node *block, int level) {
+    for (ir_node *p = block->right; p != NULL; p = p->next) {
+        hoist_block(h, p->left, level + 1);
+    }
+
+    h->block = block;
+    h->level = level;
+    hoist_loops(h, block->left);
+}
+
+void hoist_invariants(ir_node *program, symbol_table_t *table,
+    ir_arena_t *arena) {
+    static hoisting h;
+
+    h.table = table;
+    h.arena = arena;
+    h.num_temporaries = 0;
+    init_ir_order(&(h.order));
+    init_ir_order(&(h.compared[0]));
+    init_ir_order(&(h.compared[1]));
+    h.escaped = escaped_variables(program, table, &(h.order));
+    hoist_block(&h, program, 0);
+    free(h.escaped);
+    free_ir_order(&(h.order));
+    free_ir_order(&(h.compared[0]));
+    free_ir_order(&(h.compared[1]));
+}
+
+// Whether value is a power of two, setting exponent to its logarithm
+static bool is_power_of_two(unsigned int value, int *exponent) {
+    if (value == 0 || (value & (value - 1)) != 0) return false;
+
+    *exponent = 0;
+    while (value > 1) {
+        value >>= 1;
+        (*exponent)++;
+    }
+    return true;
+}
+
+/**
+ * @brief Find the magic number dividing by d through a multiply-high
+ * 
+ * Signed division by a constant, as in Hacker's Delight, chapter 10. The 
+ * quotient of n / d, rounded down for nonnegative n, is the high word of 
+ * n * multiplier (plus n when the multiplier is negative) shifted right by 
+ * shift.
+ * 
+ * @param d Divisor, at least 2
+ * @param multiplier Set to the magic multiplier
+ * @param shift Set to the shift applied after multiplying
+ */
+static void find_magic(int d, int *multiplier, int *shift) {
+    const unsigned int two31 = 0x80000000u;
+    unsigned int ad = (unsigned int)d;
+    unsigned int anc = two31 - 1 - two31 % ad;    // Absolute value of nc
+    unsigned int q1 = two31 / anc, r1 = two31 - q1 * anc;
+    unsigned int q2 = two31 / ad, r2 = two31 - q2 * ad;
+    unsigned int delta;
+    int p = 31;
+
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad) {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    *multiplier = (int)(q2 + 1);
+    *shift = p - 32;
+}
+
+static ir_node *shift_node(ir_arena_t *arena, opcode op, ir_node *operand,
+    int amount) {
+    return ir_operation(arena, op, operand, ir_number(arena, amount));
+}
+
+// Multiplication by a constant as shifts and additions, NULL if not cheaper
+static ir_node *reduce_multiplication(ir_arena_t *arena, ir_node *operand,
+    int constant) {
+    if (constant == INT_MIN) return NULL;
+
+    unsigned int magnitude = constant < 0 ? -constant : constant;
+    ir_node *product;
+    int k;
+
+    if (magnitude < 2) return NULL;
+
+    if (is_power_of_two(magnitude, &k)) {
+        product = shift_node(arena, SHL, operand, k);
+    } else if (operand->kind != IR_VARIABLE) {
+        // Only variables are cheap enough to read twice
+        return NULL;
+    } else if (is_power_of_two(magnitude - 1, &k)) {
+        product = ir_operation(arena, ADD, shift_node(arena, SHL, operand, k),
+            ir_variable(arena, operand->sym));
+    } else if (is_power_of_two(magnitude + 1, &k)) {
+        product = ir_operation(arena, SUB, shift_node(arena, SHL, operand, k),
+            ir_variable(arena, operand->sym));
+    } else {
+        return NULL;
+    }
+
+    if (constant < 0) product = ir_operation(arena, NEG, product, NULL);
+    return product;
+}
+
+// Division of a variable by a constant through a multiply-high, or NULL
+static ir_node *reduce_division(ir_arena_t *arena, ir_node *dividend,
+    int divisor) {
+    if (dividend->kind != IR_VARIABLE) return NULL;
+    if (divisor == INT_MIN || (divisor >= -1 && divisor <= 1)) return NULL;
+
+    symbol *sym = dividend->sym;
+    int multiplier, shift;
+    find_magic(divisor < 0 ? -divisor : divisor, &multiplier, &shift);
+
+    ir_node *quotient = ir_operation(arena, MULH, dividend,
+        ir_number(arena, multiplier));
+    if (multiplier < 0) {
+        quotient = ir_operation(arena, ADD, quotient, ir_variable(arena, sym));
+    }
+    if (shift > 0) quotient = shift_node(arena, SHR, quotient, shift);
+
+    // Negative dividends were rounded down, subtracting -1 rounds to zero
+    quotient = ir_operation(arena, SUB, quotient,
+        shift_node(arena, SHR, ir_variable(arena, sym), 31));
+
+    if (divisor < 0) quotient = ir_operation(arena, NEG, quotient, NULL);
+    return quotient;
+}
+
+static void reduce_expression(ir_node *node, ir_arena_t *arena,
+    ir_order_t *order) {
+    // Operands are reduced before the operations using them, nodes created
+    // by a reduction are not reduced again
+    list_expression(order, node);
+    for (int i = 0; i < order->size; i++) {
+        ir_node *n = order->nodes[i];
+        if (n->kind != IR_BINARY) continue;
+
+        ir_node *reduced = NULL;
+        if (n->op == MUL && n->right->kind == IR_NUMBER) {
+            reduced = reduce_multiplication(arena, n->left, n->right->value);
+        } else if (n->op == MUL && n->left->kind == IR_NUMBER) {
+            reduced = reduce_multiplication(arena, n->right, n->left->value);
+        } else if (n->op == DIV && n->right->kind == IR_NUMBER) {
+            reduced = reduce_division(arena, n->left, n->right->value);
+        }
+
+        if (reduced != NULL) *n = *reduced;
+    }
+}
+
+static void reduce_statement(ir_node *node, ir_arena_t *arena,
+    ir_order_t *order) {
+    switch (node->kind) {
+        case IR_ASSIGN:
+        case IR_WRITE:
+            reduce_expression(node->left, arena, order);
+            break;
+        case IR_BEGIN:
+            for (ir_node *s = node->left; s != NULL; s = s->next) {
+                reduce_statement(s, arena, order);
+            }
+            break;
+        case IR_IF:
+        case IR_WHILE:
+            reduce_expression(node->left, arena, order);
+            reduce_statement(node->right, arena, order);
+            break;
+        default: // IR_READ, IR_CALL, IR_EMPTY
+            break;
+    }
+}
+
+// Reduce a block and every procedure nested in it
+static void reduce_block(ir_node *block, ir_arena_t *arena,
+    ir_order_t *order) {
+    for (ir_node *p = block->right; p != NULL; p = p->next) {
+        reduce_block(p->left, arena, order);
+    }
+    reduce_statement(block->left, arena, order);
+}
+
+void reduce_strength(ir_node *program, ir_arena_t *arena) {
+    ir_order_t order;
+
+    init_ir_order(&order);
+    reduce_block(program, arena, &order);
+    free_ir_order(&order);
+}
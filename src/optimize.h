@@ -0,0 +1,100 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+/**
+ * @file optimize.h
+ * @brief Optimization passes over the parser's IR
+ *
+ */
+
+#include "ir.h"
+#include "symbol.h"
+#include "options.h"
+
+/**
+ * @brief Run the passes enabled by the options over a program
+ * 
+ * @param program IR_BLOCK node of the program, modified in place
+ * @param table Symbol table the program's IR refers to
+ * @param arena Arena the program's IR was allocated from
+ * @param options Options the program is compiled with
+ */
+void optimize_program(ir_node *program, symbol_table_t *table,
+    ir_arena_t *arena, compile_options_t *options);
+
+/**
+ * @brief Replace reads of variables known to hold a constant
+ * 
+ * A forward dataflow pass over the program's statements. Each variable is 
+ * tracked as holding a known constant or not, the states of both paths are 
+ * merged after an if statement, and while loops are iterated until the 
+ * state at the loop condition no longer changes. Reads of variables holding 
+ * a constant are replaced by the constant, and every expression is folded 
+ * as far as possible.
+ * 
+ * Variables are not assumed to start at zero. Every block, including the 
+ * body of every procedure, is analyzed on its own starting with nothing 
+ * known, and a call forgets the values of the variables used by procedures 
+ * other than the one declaring them.
+ * 
+ * @param program IR_BLOCK node of the program, modified in place
+ * @param table Symbol table the program's IR refers to
+ */
+void propagate_constants(ir_node *program, symbol_table_t *table);
+
+/**
+ * @brief Remove statements that can have no effect on the program
+ * 
+ * Branches of if and while statements whose condition folded to a constant 
+ * are removed or inlined. A backward liveness analysis over the remaining 
+ * statements, iterated to a fixed point over while loops, then finds 
+ * assignments to variables that are overwritten or never read afterwards, 
+ * and removes them.
+ * 
+ * Expressions that may divide by zero are kept, so the virtual machine 
+ * still reports the error.
+ * 
+ * Calls may read, and procedures leave behind for their caller, any variable 
+ * used by a procedure other than the one declaring it.
+ * 
+ * @param program IR_BLOCK node of the program, modified in place
+ * @param table Symbol table the program's IR refers to
+ */
+void eliminate_dead_code(ir_node *program, symbol_table_t *table);
+
+/**
+ * @brief Compute expressions that do not change in a loop before the loop
+ * 
+ * Operations in a while loop's condition or body that read no variable 
+ * assigned or read into inside of the loop are assigned to a new variable 
+ * before the loop, and the loop reads that variable instead. Inner loops 
+ * are handled first, so values invariant in several nested loops move out 
+ * one loop at a time.
+ * 
+ * Expressions in the body that may divide by zero are only hoisted out of 
+ * the condition, which runs at least once. A call in a loop counts as an 
+ * assignment to every variable used by a procedure other than the one 
+ * declaring it.
+ * 
+ * @param program IR_BLOCK node of the program, modified in place
+ * @param table Symbol table the new variables are added to
+ * @param arena Arena to allocate the new nodes from
+ */
+void hoist_invariants(ir_node *program, symbol_table_t *table,
+    ir_arena_t *arena);
+
+/**
+ * @brief Replace multiplications and divisions by constants
+ * 
+ * Multiplying by a power of two becomes a left shift, and multiplying a 
+ * variable by one more or one less than a power of two becomes a shift and 
+ * an addition or subtraction. Dividing a variable by a constant becomes a 
+ * multiply-high by the constant's magic number followed by shifts, 
+ * corrected to round towards zero like DIV for negative dividends.
+ * 
+ * @param program IR_BLOCK node of the program, modified in place
+ * @param arena Arena to allocate the new nodes from
+ */
+void reduce_strength(ir_node *program, ir_arena_t *arena);
+
+#endif /* OPTIMIZE_H */
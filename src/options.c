@@ -0,0 +1,6 @@
+#include "options.h"
+
+compile_options_t default_compile_options(void) {
+    compile_options_t options = { 0, false };
+    return options;
+}
@@ -0,0 +1,38 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+/**
+ * @file options.h
+ * @brief Options controlling how a program is compiled
+ *
+ * Optimization levels are cumulative:
+ *  0: Code exactly as described by the specification
+ *  1: Frequently used variables are kept in registers, constants are
+ *     propagated across statements, and dead code is removed
+ *  2: Values still held in registers are reused within basic blocks, and
+ *     loop invariant expressions are computed once before the loop. Jump
+ *     chains are collapsed and while loops rotated
+ *  3: Multiplications and divisions by constants become shifts and
+ *     multiply-highs
+ *
+ */
+
+#include <stdbool.h>
+
+#define MAX_OPTIMIZATION_LEVEL 3
+
+typedef struct compile_options_t {
+    int optimization_level;
+    // Parse expressions by recursive descent instead of precedence climbing,
+    // both build the same IR
+    bool recursive_expressions;
+} compile_options_t;
+
+/**
+ * @brief Returns the options used when none are given
+ *
+ * @return compile_options_t Options producing unoptimized code
+ */
+compile_options_t default_compile_options(void);
+
+#endif /* OPTIONS_H */
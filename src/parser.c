@@ -2,601 +2,993 @@
 #include "symbol.h"
 #include "codegen.h"
 #include "error.h"
+#include "ir.h"
+#include "lower.h"
+#include "optimize.h"
+#include "codeopt.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 
-void init_parser(parser_t *parser, token_list_t *token_list) {
+// Tokens starting a declaration
+#define DECLARATION_START (TOKEN_SET(constsym) | TOKEN_SET(varsym) | \
+    TOKEN_SET(procsym))
+// Keywords starting a statement, identifiers start assignments
+#define STATEMENT_KEYWORDS (TOKEN_SET(beginsym) | TOKEN_SET(ifsym) | \
+    TOKEN_SET(whilesym) | TOKEN_SET(callsym) | TOKEN_SET(readsym) | \
+    TOKEN_SET(writesym))
+#define STATEMENT_START (STATEMENT_KEYWORDS | TOKEN_SET(identsym))
+#define FACTOR_START (TOKEN_SET(identsym) | TOKEN_SET(numbersym) | \
+    TOKEN_SET(lparentsym))
+#define RELATIONAL_OPERATORS (TOKEN_SET(eqsym) | TOKEN_SET(neqsym) | \
+    TOKEN_SET(lessym) | TOKEN_SET(leqsym) | TOKEN_SET(gtrsym) | \
+    TOKEN_SET(geqsym))
+#define ADDING_OPERATORS (TOKEN_SET(plussym) | TOKEN_SET(minussym))
+#define MULTIPLYING_OPERATORS (TOKEN_SET(multsym) | TOKEN_SET(slashsym))
+
+static ir_node *parse_declarations(parser_t *parser, token_set follow);
+static ir_node *parse_begin(parser_t *parser, token_set follow,
+    lowering_t *lowering);
+
+// Declared identifiers follow const, var, procedure or a comma, so this
+// bounds the number of symbols the tokens can declare
+static int count_declarations(token_list_t *tokens) {
+    int count = 0;
+
+    for (int i = 1; i < tokens->size; i++) {
+        token_type previous = (token_type)tokens->types[i - 1];
+        if (tokens->types[i] == identsym && (previous == constsym ||
+            previous == varsym || previous == procsym ||
+            previous == commasym)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+void init_parser(parser_t *parser, token_list_t *token_list,
+    compile_options_t *options) {
     parser->token_list = token_list;
     parser->token_cursor = 0;
-    init_symbol_table(&(parser->symbol_table));
-    parser->register_cursor = 0;
+    // Leaves room for the variables optimization adds
+    init_symbol_table(&(parser->symbol_table),
+        count_declarations(token_list) + MAX_SYMBOL_TABLE_SIZE);
+    parser->level = 0;
+    init_ir_arena(&(parser->arena));
+    parser->program = NULL;
     init_code_generator(&(parser->code_generator));
+    parser->options = *options;
+    parser->operands = NULL;
+    parser->num_operands = 0;
+    parser->operands_capacity = 0;
+    parser->operators = NULL;
+    parser->num_operators = 0;
+    parser->operators_capacity = 0;
+    parser->diagnostics = NULL;
+    parser->num_diagnostics = 0;
+    parser->diagnostics_capacity = 0;
+}
+
+void free_parser(parser_t *parser) {
+    free_symbol_table(&(parser->symbol_table));
+    free_ir_arena(&(parser->arena));
+    parser->program = NULL;
+    free(parser->operands);
+    free(parser->operators);
+    parser->operands = NULL;
+    parser->operators = NULL;
+    parser->operands_capacity = 0;
+    parser->operators_capacity = 0;
+    free(parser->diagnostics);
+    parser->diagnostics = NULL;
+    parser->num_diagnostics = 0;
+    parser->diagnostics_capacity = 0;
 }
 
 void add_code(parser_t *parser, cg_instruction *i) {
     emit_prepared_instruction(&(parser->code_generator), i);
 }
 
-token *current_token(parser_t *parser) {
+token current_token(parser_t *parser) {
     return get_token(parser->token_list, parser->token_cursor);
 }
 
-token *next_token(parser_t *parser) {
+token next_token(parser_t *parser) {
     return get_token(parser->token_list, ++(parser->token_cursor));
 }
 
+token_type current_type(parser_t *parser) {
+    return get_token_type(parser->token_list, parser->token_cursor);
+}
+
+token_type next_type(parser_t *parser) {
+    return get_token_type(parser->token_list, ++(parser->token_cursor));
+}
+
+static bool in_set(token_set set, token_type type) {
+    // Readers reject other types, but a set has no bit for them anyway
+    if (type < nulsym || type > readsym) return false;
+    return (set & TOKEN_SET(type)) != 0;
+}
+
+// Skip tokens up to one in the set, or the end of the tokens
+static void skip_to(parser_t *parser, token_set set) {
+    while (!in_set(set | TOKEN_SET(nulsym), current_type(parser))) {
+        next_type(parser);
+    }
+}
+
+void report_error(parser_t *parser, error_type e) {
+    int n = parser->num_diagnostics;
+
+    if (n > 0 && parser->diagnostics[n - 1].token == parser->token_cursor) {
+        return;
+    }
+    if (n == parser->diagnostics_capacity) {
+        parser->diagnostics_capacity = n > 0 ? n * 2 : 16;
+        parser->diagnostics = (diagnostic *)realloc(parser->diagnostics,
+            sizeof(diagnostic) * parser->diagnostics_capacity);
+        if (parser->diagnostics == NULL) {
+            fprintf(stderr, "ERROR: Diagnostic allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    diagnostic *d = &(parser->diagnostics[n]);
+    d->type = e;
+    d->token = parser->token_cursor;
+    d->found = current_type(parser);
+    parser->num_diagnostics = n + 1;
+}
+
+void report_diagnostics(parser_t *parser) {
+    if (parser->num_diagnostics == 0) return;
+
+    for (int i = 0; i < parser->num_diagnostics; i++) {
+        print_diagnostic(&(parser->diagnostics[i]));
+    }
+    exit(parser->diagnostics[0].type);
+}
+
+// Check for the period ending the program, then report any error
+static void end_program(parser_t *parser) {
+    if (current_type(parser) != periodsym) {
+        report_error(parser, PERIOD_EXPECTED);
+    }
+
+    // No code is generated for a program with errors
+    report_diagnostics(parser);
+}
+
 void parse_program(parser_t *parser) {
-    // Allocate space on the stack for FV, SL, DL, and RA
-    emit_instruction(
-        &(parser->code_generator),
-        INC,
-        0,
-        0,
-        4
-    );
+    parser->program = parse_block(parser, TOKEN_SET(periodsym));
+    end_program(parser);
+
+    generate_program(parser, parser->program, &(parser->arena));
+}
 
-    parse_block(parser);
-    if (current_token(parser)->name != periodsym) {
-        error(PERIOD_EXPECTED);
+void stream_program(parser_t *parser) {
+    token_set follow = TOKEN_SET(periodsym);
+    ir_node *block = parse_declarations(parser, follow);
+    token_set statement_follow = follow | TOKEN_SET(semicolonsym) |
+        TOKEN_SET(endsym);
+
+    // Without variables the frame may or may not need an INC of its own,
+    // known only once every statement was lowered
+    if (parser->options.optimization_level > 0 || block->value == 0 ||
+        current_type(parser) != beginsym || parser->num_diagnostics > 0) {
+        block->left = parse_statement(parser, statement_follow);
+        parser->program = block;
+        end_program(parser);
+
+        generate_program(parser, parser->program, &(parser->arena));
+        return;
     }
 
-    // End of program instruction
-    emit_instruction(
+    lowering_t lowering;
+    start_lowering(&lowering, block, &(parser->symbol_table),
+        &(parser->code_generator));
+    parse_begin(parser, statement_follow, &lowering);
+    end_program(parser);
+    finish_lowering(&lowering);
+}
+
+void generate_program(parser_t *parser, ir_node *program,
+    ir_arena_t *arena) {
+    optimize_program(
+        program,
+        &(parser->symbol_table),
+        arena,
+        &(parser->options)
+    );
+
+    lower_program(
+        program,
+        &(parser->symbol_table),
         &(parser->code_generator),
-        SIO_END,
-        0,
-        0,
-        3
+        &(parser->options)
     );
+
+    // Code already streamed out cannot be rewritten
+    if (parser->code_generator.stream == NULL) {
+        optimize_code(&(parser->code_generator), &(parser->options));
+    }
 }
 
-void parse_block(parser_t *parser) {
-    parse_const_declaration(parser);
-    parse_var_declaration(parser);
-    parse_statement(parser);
+// Parse the declarations of a block, leaving its statement to the caller
+static ir_node *parse_declarations(parser_t *parser, token_set follow) {
+    ir_node *block = create_ir_node(&(parser->arena), IR_BLOCK);
+    // A malformed declaration is given up on at whatever comes after it
+    token_set declarations_follow = follow | DECLARATION_START |
+        STATEMENT_KEYWORDS;
+
+    parse_const_declaration(parser, declarations_follow);
+    block->value = parse_var_declaration(parser, declarations_follow);
+    block->right = parse_procedure_declaration(parser, follow);
+
+    return block;
 }
 
-void parse_const_declaration(parser_t *parser) {
-    if (current_token(parser) == constsym) {
-        do {
-            // Check for identifier
-            if (next_token(parser)->type != identsym) {
-                error(IDENTIFIER_EXPECTED_CONST_DECLARATION);
-            }
-            token *identifier = current_token(parser); 
+ir_node *parse_block(parser_t *parser, token_set follow) {
+    ir_node *block = parse_declarations(parser, follow);
 
-            // Check for equals sign
-            if (next_token(parser)->type != eqsym) {
-                error(EQUALS_EXPECTED_CONST_DECLARATION);
-            }
+    block->left = parse_statement(parser, follow | TOKEN_SET(semicolonsym) |
+        TOKEN_SET(endsym));
 
-            // Check for number
-            if (next_token(parser)->type != numbersym) {
-                error(NUMBER_EXPECTED_CONST_DECLARATION);
-            }
-            token *number = current_token(parser);
+    return block;
+}
 
-            // Identifier must not be already declared on the same level
-            symbol *present = search_symbol(
-                &(parser->symbol_table),
-                identifier->name
-            );
+// Parse ident "=" number, skipping to a token that follows if malformed
+static void parse_constant(parser_t *parser, token_set follow) {
+    // Check for identifier
+    if (current_type(parser) != identsym) {
+        report_error(parser, IDENTIFIER_EXPECTED_CONST_DECLARATION);
+        skip_to(parser, follow);
+        return;
+    }
+    token identifier = current_token(parser);
 
-            if (present != NULL) {
-                error(IDENTIFIER_ALREADY_DECLARED);
-            }
+    // Check for equals sign
+    if (next_type(parser) != eqsym) {
+        report_error(parser, EQUALS_EXPECTED_CONST_DECLARATION);
+        skip_to(parser, follow);
+        return;
+    }
+
+    // Check for number
+    if (next_type(parser) != numbersym) {
+        report_error(parser, NUMBER_EXPECTED_CONST_DECLARATION);
+        skip_to(parser, follow);
+        return;
+    }
+    token number = current_token(parser);
 
-            // Add const to symbol table
-            symbol s = create_const_symbol(
-                identifier->name,
-                atoi(number->name)
-            );
-            insert_symbol(&(parser->symbol_table), &s);
-        } while (next_token(parser)->type == commasym);
+    // Identifier must not be already declared on the same level
+    symbol *present = search_symbol(
+        &(parser->symbol_table),
+        identifier.name
+    );
+
+    if (present != NULL && present->level == parser->level) {
+        report_error(parser, IDENTIFIER_ALREADY_DECLARED);
+    } else {
+        // Add const to symbol table
+        symbol s = create_const_symbol(
+            identifier.name,
+            number.value,
+            parser->level
+        );
+        if (!insert_symbol(&(parser->symbol_table), &s)) {
+            report_error(parser, SYMBOL_TABLE_FULL);
+        }
+    }
+
+    // Consume number
+    next_type(parser);
+}
+
+void parse_const_declaration(parser_t *parser, token_set follow) {
+    if (current_type(parser) == constsym) {
+        token_set constant_follow = follow | TOKEN_SET(commasym) |
+            TOKEN_SET(semicolonsym);
+
+        do {
+            // Consume const or comma
+            next_type(parser);
+            parse_constant(parser, constant_follow);
+        } while (current_type(parser) == commasym);
 
         // Check for declaration ending semicolon
         // Current token wasn't a comma, so it should be a semicolon
-        if (current_token(parser)->type != semicolonsym) {
-            error(SEMICOLON_EXPECTED_CONST_DECLARATION);
+        if (current_type(parser) != semicolonsym) {
+            report_error(parser, SEMICOLON_EXPECTED_CONST_DECLARATION);
+            return;
         }
 
         // Consume semicolon
-        next_token(parser);
+        next_type(parser);
     }
 }
 
-void parse_var_declaration(parser_t *parser) {
-    if (current_token(parser)->type == varsym) {
-        int num_vars = 0;
-        do {
-            // Check for identifier
-            if (next_token(parser)->type != identsym) {
-                error(IDENTIFIER_EXPECTED_VAR_DECLARATION);
-            }
-
-            // Identifier must not be already declared on the same level
-            symbol *present = search_symbol(
-                &(parser->symbol_table),
-                current_token(parser)->name
-            );
+// Parse a declared ident, skipping to a token that follows if there is
+// none. Returns the number of variables declared.
+static int parse_variable(parser_t *parser, token_set follow) {
+    // Check for identifier
+    if (current_type(parser) != identsym) {
+        report_error(parser, IDENTIFIER_EXPECTED_VAR_DECLARATION);
+        skip_to(parser, follow);
+        return 0;
+    }
 
-            if (present != NULL) {
-                error(IDENTIFIER_ALREADY_DECLARED);
-            }
+    // Identifier must not be already declared on the same level
+    symbol *present = search_symbol(
+        &(parser->symbol_table),
+        current_token(parser).name
+    );
 
-            // Create and insert var symbol
-            symbol s = create_var_symbol(current_token(parser)->name);
-            insert_symbol(&(parser->symbol_table), &s);
+    int declared = 0;
+    if (present != NULL && present->level == parser->level) {
+        report_error(parser, IDENTIFIER_ALREADY_DECLARED);
+    } else {
+        // Create and insert var symbol
+        symbol s = create_var_symbol(
+            current_token(parser).name,
+            parser->level
+        );
+        if (insert_symbol(&(parser->symbol_table), &s)) {
+            declared = 1;
+        } else {
+            report_error(parser, SYMBOL_TABLE_FULL);
+        }
+    }
 
-            num_vars++;
-        } while (next_token(parser)->type == commasym);
+    // Consume identifier
+    next_type(parser);
+    return declared;
+}
 
-        if (current_token(parser)->type != semicolonsym) {
-            error(SEMICOLON_EXPECTED_VAR_DECLARATION);
-        }
+int parse_var_declaration(parser_t *parser, token_set follow) {
+    int num_vars = 0;
+    if (current_type(parser) == varsym) {
+        token_set variable_follow = follow | TOKEN_SET(commasym) |
+            TOKEN_SET(semicolonsym);
 
-        if (num_vars >= 1) {
-            // Allocate space on the stack for the variables
-            emit_instruction(
-                &(parser->code_generator),
-                INC,
-                0,
-                0,
-                num_vars
-            );
+        do {
+            // Consume var or comma
+            next_type(parser);
+            num_vars += parse_variable(parser, variable_follow);
+        } while (current_type(parser) == commasym);
+
+        if (current_type(parser) != semicolonsym) {
+            report_error(parser, SEMICOLON_EXPECTED_VAR_DECLARATION);
+            return num_vars;
         }
 
         // Consume semicolon
-        next_token(parser);
+        next_type(parser);
     }
+    return num_vars;
 }
 
-void parse_statement(parser_t *parser) {
-    if (current_token(parser)->type == identsym) {
-        // Find this variable
-        symbol *s = search_symbol(
-            &(parser->symbol_table), 
-            current_token(parser)->name
-        );
+ir_node *parse_procedure_declaration(parser_t *parser, token_set follow) {
+    symbol_table_t *table = &(parser->symbol_table);
+    ir_node *first = NULL;
+    ir_node *last = NULL;
 
-        // Symbol not in symbol table
-        if (s == NULL) {
-            error(UNDECLARED_IDENTIFIER);
+    while (current_type(parser) == procsym) {
+        symbol *procedure = NULL;
+
+        // Check for identifier
+        if (next_type(parser) != identsym) {
+            report_error(parser, IDENTIFIER_EXPECTED_PROCEDURE_DECLARATION);
+        } else {
+            // Identifier must not be already declared on the same level
+            symbol *present = search_symbol(table,
+                current_token(parser).name);
+
+            if (present != NULL && present->level == parser->level) {
+                report_error(parser, IDENTIFIER_ALREADY_DECLARED);
+            } else {
+                // Inserted before the body, so the procedure can call itself
+                symbol s = create_proc_symbol(
+                    current_token(parser).name,
+                    parser->level
+                );
+                if (insert_symbol(table, &s)) {
+                    procedure = &(table->symbols[table->num_symbols - 1]);
+                } else {
+                    report_error(parser, SYMBOL_TABLE_FULL);
+                }
+            }
+
+            // Consume identifier
+            next_type(parser);
         }
 
-        if (s->kind != KIND_VAR) {
-            error(ASSIGNMENT_TO_NON_VARIABLE);
+        if (current_type(parser) != semicolonsym) {
+            report_error(parser, SEMICOLON_EXPECTED_PROCEDURE_DECLARATION);
+        } else {
+            // Consume semicolon
+            next_type(parser);
         }
 
-        if (next_token(parser)->type != becomessym) {
-            error(BECOMES_EXPECTED_ASSIGNMENT_STATEMENT);
+        // Only the first level past the limit is reported, not every one
+        // nested inside of it
+        if (parser->level + 1 == MAX_LEXI_LEVELS) {
+            report_error(parser, PROCEDURES_NESTED_TOO_DEEPLY);
         }
 
-        // Consume becomes
-        next_token(parser);
+        // The body's variables start after FV, SL, DL and RA of its frame
+        int scope = table->num_symbols;
+        int address = table->var_address_index;
+        table->var_address_index = 4;
+        (parser->level)++;
 
-        parse_expression(parser);
+        ir_node *body = parse_block(parser, follow | TOKEN_SET(semicolonsym));
 
-        // Store the result of the expression in variable's address
-        emit_instruction(
-            &(parser->code_generator),
-            STO,
-            parser->register_cursor - 1,
-            s->level,
-            s->address
-        );
+        (parser->level)--;
+        table->var_address_index = address;
 
-        // Decrement register cursor as we're done using that value
-        (parser->register_cursor)--;
-    } 
-    else if (current_token(parser)->type == beginsym) {
-        // Consume begin
-        next_token(parser);
+        // Declarations of the body go out of scope
+        close_scope(table, scope);
 
-        do {
-            parse_statement(parser);
-        } while (next_token(parser)->type == semicolonsym);
-
-        if (current_token(parser)->type != endsym) {
-            error(END_EXPECTED_BEGIN_STATEMENT);
+        if (current_type(parser) != semicolonsym) {
+            report_error(parser, SEMICOLON_EXPECTED_PROCEDURE_DECLARATION);
+        } else {
+            // Consume semicolon
+            next_type(parser);
         }
 
-        // Consume end 
-        next_token(parser);
+        ir_node *declaration = ir_statement(&(parser->arena), IR_PROCEDURE,
+            procedure, body, NULL);
+        if (first == NULL) first = declaration;
+        else last->next = declaration;
+        last = declaration;
     }
-    else if (current_token(parser)->type == ifsym) {
-        // Consume if symbol
-        next_token(parser);
+    return first;
+}
+
+// Parse a statement of a begin statement. Given a lowering, the statement
+// is lowered right away, unless an error was found, and NULL is returned
+// instead of its IR, which is freed.
+static ir_node *parse_begin_statement(parser_t *parser, token_set follow,
+    lowering_t *lowering) {
+    int start = parser->token_cursor;
+    ir_node *statement = parse_statement(parser, follow);
+    statement->first_token = start;
+    statement->end_token = parser->token_cursor;
+
+    if (lowering == NULL) return statement;
+
+    if (parser->num_diagnostics == 0) {
+        lower_top_statement(lowering, statement);
+    }
+    clear_ir_arena(&(parser->arena));
+    return NULL;
+}
 
-        parse_condition(parser);
+// Parse "begin" statement {";" statement} "end", whose statements are
+// lowered one at a time if given a lowering, and NULL returned
+static ir_node *parse_begin(parser_t *parser, token_set follow,
+    lowering_t *lowering) {
+    ir_node *begin = NULL;
+    token_set statement_follow = follow | TOKEN_SET(semicolonsym) |
+        TOKEN_SET(endsym);
+
+    if (lowering == NULL) {
+        begin = ir_statement(&(parser->arena), IR_BEGIN, NULL, NULL, NULL);
+    }
 
-        if (current_token(parser)->type != thensym) {
-            error(THEN_EXPECTED_IF_STATEMENT);
+    // Consume begin
+    next_type(parser);
+
+    ir_node *last = parse_begin_statement(parser, statement_follow,
+        lowering);
+    if (begin != NULL) begin->left = last;
+
+    while (current_type(parser) != endsym) {
+        if (current_type(parser) == semicolonsym) {
+            // Consume semicolon
+            next_type(parser);
+        } else {
+            // Go on with the statements after whatever is in the way,
+            // unless the begin statement ends before any
+            report_error(parser, END_EXPECTED_BEGIN_STATEMENT);
+            skip_to(parser, statement_follow | STATEMENT_START);
+            if (current_type(parser) == semicolonsym) continue;
+            if (!in_set(STATEMENT_START, current_type(parser))) break;
         }
 
-        // Consume then symbol
-        next_token(parser);
+        ir_node *statement = parse_begin_statement(parser, statement_follow,
+            lowering);
+        if (begin != NULL) {
+            last->next = statement;
+            last = statement;
+        }
+    }
 
-        // Save current code spot
-        int start = parser->code_generator.code_size;
-        // Emit the conditional jump instruction
-        emit_instruction(
-            &(parser->code_generator),
-            JPC,
-            0,
-            0,
-            0
+    if (current_type(parser) == endsym) {
+        // Consume end
+        next_type(parser);
+    }
+
+    return begin;
+}
+
+ir_node *parse_statement(parser_t *parser, token_set follow) {
+    ir_arena_t *arena = &(parser->arena);
+
+    if (current_type(parser) == identsym) {
+        // Find this variable
+        symbol *s = search_symbol(
+            &(parser->symbol_table),
+            current_token(parser).name
         );
 
-        parse_statement(parser);
+        // Symbol not in symbol table
+        if (s == NULL) {
+            report_error(parser, UNDECLARED_IDENTIFIER);
+        } else if (s->kind != KIND_VAR) {
+            report_error(parser, ASSIGNMENT_TO_NON_VARIABLE);
+        }
 
-        // Modify the conditional jump to jump after statement
-        code_generator_t *cg = &(parser->code_generator);
-        cg->code[start].modifier = cg->code_size;
+        // A missing becomes is taken to be there
+        if (next_type(parser) != becomessym) {
+            report_error(parser, BECOMES_EXPECTED_ASSIGNMENT_STATEMENT);
+        } else {
+            // Consume becomes
+            next_type(parser);
+        }
+
+        ir_node *expression = parse_expression(parser, follow);
+
+        // Assign the result of the expression to the variable
+        return ir_statement(arena, IR_ASSIGN, s, expression, NULL);
     }
-    else if (current_token(parser)->type == whilesym) {
-        // Consume while symbol
-        next_token(parser);
-
-        // Get condition evaluation code line
-        int condition = parser->code_generator.code_size;
-
-        parse_condition(parser);
-
-        // Get loop start line
-        int loop = parser->code_generator.code_size;
-        // Generate conditional jump out of loop
-        emit_instruction(
-            &(parser->code_generator),
-            JPC,
-            0,
-            0,
-            0   // Temporary until end of loop instruction is found
-        );
+    else if (current_type(parser) == beginsym) {
+        return parse_begin(parser, follow, NULL);
+    }
+    else if (current_type(parser) == ifsym) {
+        // Consume if symbol
+        next_type(parser);
+
+        ir_node *condition = parse_condition(parser, follow |
+            TOKEN_SET(thensym) | TOKEN_SET(dosym));
 
-        if (current_token(parser)->type != dosym) {
-            error(DO_EXPECTED_WHILE_STATEMENT);
+        if (current_type(parser) != thensym) {
+            report_error(parser, THEN_EXPECTED_IF_STATEMENT);
+        } else {
+            // Consume then symbol
+            next_type(parser);
         }
 
-        // Consume do symbol
-        next_token(parser);
+        ir_node *statement = parse_statement(parser, follow);
 
-        parse_statement(parser);
+        return ir_statement(arena, IR_IF, NULL, condition, statement);
+    }
+    else if (current_type(parser) == whilesym) {
+        // Consume while symbol
+        next_type(parser);
 
-        // Generate unconditional jump to loop condition evaluation
-        emit_instruction(
-            &(parser->code_generator),
-            JPC,
-            0,
-            0,
-            condition
-        );
+        ir_node *condition = parse_condition(parser, follow |
+            TOKEN_SET(dosym));
 
-        // Modify jump line of conditional jump
-        code_generator_t *cg = &(parser->code_generator);
-        cg->code[loop].modifier = cg->code_size;
+        if (current_type(parser) != dosym) {
+            report_error(parser, DO_EXPECTED_WHILE_STATEMENT);
+        } else {
+            // Consume do symbol
+            next_type(parser);
+        }
+
+        ir_node *statement = parse_statement(parser, follow);
+
+        return ir_statement(arena, IR_WHILE, NULL, condition, statement);
     }
-    else if (current_token(parser)->type == readsym) {
-        if (next_token(parser)->type != identsym) {
-            error(IDENTIFIER_EXPECTED_READ_STATEMENT);
+    else if (current_type(parser) == callsym) {
+        if (next_type(parser) != identsym) {
+            report_error(parser, IDENTIFIER_EXPECTED_CALL_STATEMENT);
+            return ir_statement(arena, IR_EMPTY, NULL, NULL, NULL);
         }
         // Retrieve this identifier's symbol from the table
         symbol *s = search_symbol(
-            &(parser->symbol_table), 
-            current_token(parser)->name
+            &(parser->symbol_table),
+            current_token(parser).name
         );
 
         if (s == NULL) {
-            error(READ_INTO_INVALID_IDENTIFIER);
+            report_error(parser, UNDECLARED_IDENTIFIER);
+        } else if (s->kind != KIND_PROC) {
+            report_error(parser, CALL_OF_NON_PROCEDURE);
         }
 
-        if (s->kind != KIND_VAR) {
-            error(READ_INTO_NON_VARIABLE);
+        // Consume identifier
+        next_type(parser);
+
+        return ir_statement(arena, IR_CALL, s, NULL, NULL);
+    }
+    else if (current_type(parser) == readsym) {
+        if (next_type(parser) != identsym) {
+            report_error(parser, IDENTIFIER_EXPECTED_READ_STATEMENT);
+            return ir_statement(arena, IR_EMPTY, NULL, NULL, NULL);
         }
-        
-        // Read value into next available register
-        emit_instruction(
-            &(parser->code_generator),
-            SIO_READ,
-            parser->register_cursor,
-            0,
-            0
+        // Retrieve this identifier's symbol from the table
+        symbol *s = search_symbol(
+            &(parser->symbol_table),
+            current_token(parser).name
         );
 
-        // Immediately store the value into the variable's address
-        emit_instruction(
-            &(parser->code_generator),
-            STO,
-            parser->register_cursor,
-            s->level,
-            s->address
-        );
+        if (s == NULL) {
+            report_error(parser, READ_INTO_INVALID_IDENTIFIER);
+        } else if (s->kind != KIND_VAR) {
+            report_error(parser, READ_INTO_NON_VARIABLE);
+        }
 
         // Consume identifier
-        next_token(parser);
+        next_type(parser);
+
+        return ir_statement(arena, IR_READ, s, NULL, NULL);
     }
-    else if (current_token(parser)->type == writesym) {
-        if (next_token(parser)->type != identsym) {
-            error(IDENTIFIER_EXPECTED_WRITE_STATEMENT);
+    else if (current_type(parser) == writesym) {
+        if (next_type(parser) != identsym) {
+            report_error(parser, IDENTIFIER_EXPECTED_WRITE_STATEMENT);
+            return ir_statement(arena, IR_EMPTY, NULL, NULL, NULL);
         }
         // Retrieve this identifier's symbol from the table
         symbol *s = search_symbol(
-            &(parser->symbol_table), 
-            current_token(parser)->name
+            &(parser->symbol_table),
+            current_token(parser).name
         );
 
+        ir_node *value;
         if (s == NULL) {
-            error(WRITE_FROM_INVALID_IDENTIFIER);
+            report_error(parser, WRITE_FROM_INVALID_IDENTIFIER);
+            value = ir_number(arena, 0);
         }
-
-        if (s->kind != KIND_VAR && s->kind != KIND_CONST) {
-            error(WRITE_FROM_NON_VAR_CONST_IDENTIFIER);
-        }
-
-        if (s->kind == KIND_VAR) {
+        else if (s->kind == KIND_VAR) {
             // Load the variable from its address
-            emit_instruction(
-                &(parser->code_generator),
-                LOD,
-                parser->register_cursor,
-                s->level,
-                s->address
-            );
-        }
-        else { // KIND_CONST
+            value = ir_variable(arena, s);
+        }
+        else if (s->kind == KIND_CONST) {
             // Load the const from its value
-            emit_instruction(
-                &(parser->code_generator),
-                LIT,
-                parser->register_cursor,
-                0,
-                s->value
-            );
-        }
-
-        // Emit write command from the temporary register
-        emit_instruction(
-            &(parser->code_generator),
-            SIO_WRITE,
-            parser->register_cursor,
-            0,
-            0
-        );
+            value = ir_number(arena, s->value);
+        }
+        else {
+            report_error(parser, WRITE_FROM_NON_VAR_CONST_IDENTIFIER);
+            value = ir_number(arena, 0);
+        }
 
         // Consume identifier
-        next_token(parser);
+        next_type(parser);
+
+        return ir_statement(arena, IR_WRITE, NULL, value, NULL);
     }
+
+    // EBNF: e
+    return ir_statement(arena, IR_EMPTY, NULL, NULL, NULL);
 }
 
-void parse_condition(parser_t *parser) {
+ir_node *parse_condition(parser_t *parser, token_set follow) {
     // EBNF: "odd" expression
-    if (current_token(parser)->type == oddsym) {
+    if (current_type(parser) == oddsym) {
         // Consume odd symbol
-        next_token(parser);
+        next_type(parser);
 
-        parse_expression(parser);
+        ir_node *expression = parse_expression(parser, follow);
 
-        emit_instruction(
-            &(parser->code_generator),
-            ODD,
-            parser->register_cursor - 1,
-            0,
-            0
-        );
+        return ir_operation(&(parser->arena), ODD, expression, NULL);
     } else { // EBNF: expression rel-op expression
-        parse_expression(parser);
+        ir_node *left = parse_expression(parser, follow | RELATIONAL_OPERATORS);
 
-        token_type rel_op = current_token(parser);
-        parse_rel_op(parser);
+        opcode op = parse_rel_op(parser);
 
-        parse_expression(parser);
+        ir_node *right = parse_expression(parser, follow);
 
         // Evaluate the condition based on expressions and operator
-        opcode op;
-        switch(rel_op) {
-            case eqsym:
-                op = EQL;
-                break;
-            case neqsym:
-                op = NEQ;
-                break;
-            case lessym:
-                op = LSS;
-                break;
-            case leqsym:
-                op = LEQ;
-                break;
-            case gtrsym:
-                op = GTR;
-                break;
-            case geqsym:
-                op = GEQ;
-                break;
-        }
-
-        emit_instruction(
-            &(parser->code_generator),
-            op,
-            parser->register_cursor - 2,
-            parser->register_cursor - 2,
-            parser->register_cursor - 1
-        );
-        // Decrement register cursor, operation squashes 2 values into 1
-        parser->register_cursor--;
+        return ir_operation(&(parser->arena), op, left, right);
     }
 }
 
-void parse_rel_op(parser_t *parser) {
-    switch (current_token(parser)->type) {
+opcode parse_rel_op(parser_t *parser) {
+    opcode op;
+    switch (current_type(parser)) {
         case eqsym:
+            op = EQL;
+            break;
         case neqsym:
+            op = NEQ;
+            break;
         case lessym:
+            op = LSS;
+            break;
         case leqsym:
+            op = LEQ;
+            break;
         case gtrsym:
+            op = GTR;
+            break;
         case geqsym:
+            op = GEQ;
             break;
         default:
-            error(REL_OP_EXPECTED);
+            // Parsing goes on as if there was one
+            report_error(parser, REL_OP_EXPECTED);
+            return EQL;
     }
-    
+
     // Consume rel-op symbol
-    next_token(parser);
+    next_type(parser);
+
+    return op;
+}
+
+// Marks an open parenthesis on the operator stack, no opcode is 0
+#define OPEN_PARENTHESIS 0
+
+// Binding strength of the operators on the operator stack. A sign binds
+// looser than the term it applies to, and tighter than the terms around it.
+static int precedence(int op) {
+    switch (op) {
+        case ADD:
+        case SUB:
+            return 1;
+        case NEG:
+            return 2;
+        case MUL:
+        case DIV:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+// Opcode of a binary operator token, or 0 if the token is none
+static int binary_operator(token_type type) {
+    switch (type) {
+        case plussym: return ADD;
+        case minussym: return SUB;
+        case multsym: return MUL;
+        case slashsym: return DIV;
+        default: return 0;
+    }
 }
 
-void parse_expression(parser_t *parser) {
+static void *grow_stack(void *stack, int *capacity, size_t size) {
+    *capacity = *capacity > 0 ? *capacity * 2 : 32;
+    stack = realloc(stack, size * *capacity);
+    if (stack == NULL) {
+        fprintf(stderr, "ERROR: Expression stack allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    return stack;
+}
+
+static void push_operand(parser_t *parser, ir_node *operand) {
+    if (parser->num_operands == parser->operands_capacity) {
+        parser->operands = (ir_node **)grow_stack(parser->operands,
+            &(parser->operands_capacity), sizeof(ir_node *));
+    }
+    parser->operands[(parser->num_operands)++] = operand;
+}
+
+static void push_operator(parser_t *parser, int op) {
+    if (parser->num_operators == parser->operators_capacity) {
+        parser->operators = (int *)grow_stack(parser->operators,
+            &(parser->operators_capacity), sizeof(int));
+    }
+    parser->operators[(parser->num_operators)++] = op;
+}
+
+// Apply operators above the bottom of the stack while they bind at least
+// as strongly as the given precedence, all operators are left associative
+static void reduce(parser_t *parser, int bottom, int at_least) {
+    while (parser->num_operators > bottom) {
+        int op = parser->operators[parser->num_operators - 1];
+        if (op == OPEN_PARENTHESIS || precedence(op) < at_least) return;
+        (parser->num_operators)--;
+
+        ir_node *right = parser->operands[--(parser->num_operands)];
+        if (op == NEG) {
+            push_operand(parser, ir_operation(&(parser->arena), NEG, right,
+                NULL));
+        } else {
+            ir_node *left = parser->operands[--(parser->num_operands)];
+            push_operand(parser, ir_operation(&(parser->arena), op, left,
+                right));
+        }
+    }
+}
+
+ir_node *parse_expression(parser_t *parser, token_set follow) {
+    if (parser->options.recursive_expressions) {
+        return parse_recursive_expression(parser, follow);
+    }
+
+    // Only the stacks above these belong to this expression
+    int bottom = parser->num_operators;
+    int open_parentheses = 0;
+    // Whether a sign may come next, only at the start of an expression
+    bool starts_expression = true;
+
+    while (true) {
+        // Opening parentheses, each starting an expression that may be
+        // signed, up to the operand
+        while (true) {
+            if (starts_expression && current_type(parser) == plussym) {
+                next_type(parser);
+            } else if (starts_expression && current_type(parser) == minussym) {
+                push_operator(parser, NEG);
+                next_type(parser);
+            }
+            if (current_type(parser) != lparentsym) break;
+
+            push_operator(parser, OPEN_PARENTHESIS);
+            open_parentheses++;
+            starts_expression = true;
+            next_type(parser);
+        }
+        // Identifiers, numbers and errors are handled like any factor, with
+        // the tokens that may follow it in a term nested as deep
+        token_set factor_follow = follow | ADDING_OPERATORS |
+            MULTIPLYING_OPERATORS;
+        if (open_parentheses > 0) factor_follow |= TOKEN_SET(rparentsym);
+        push_operand(parser, parse_factor(parser, factor_follow));
+        starts_expression = false;
+
+        // Closing parentheses, up to the next binary operator. A missing
+        // one is taken to be there.
+        int op = binary_operator(current_type(parser));
+        while (op == 0 && open_parentheses > 0) {
+            bool closed = current_type(parser) == rparentsym;
+            if (!closed) {
+                report_error(parser, RIGHT_PARENTHESIS_EXPECTED_FACTOR);
+            }
+            reduce(parser, bottom, 0);
+            (parser->num_operators)--;
+            open_parentheses--;
+            if (closed) next_type(parser);
+            op = binary_operator(current_type(parser));
+        }
+        if (op == 0) break;
+
+        reduce(parser, bottom, precedence(op));
+        push_operator(parser, op);
+        next_type(parser);
+    }
+
+    reduce(parser, bottom, 0);
+    return parser->operands[--(parser->num_operands)];
+}
+
+ir_node *parse_recursive_expression(parser_t *parser, token_set follow) {
     bool will_negate = false;
-    if (current_token(parser)->type == plussym) {
+    if (current_type(parser) == plussym) {
         // Consume plus
-        next_token(parser);
+        next_type(parser);
     }
-    else if (current_token(parser)->type == minussym) {
+    else if (current_type(parser) == minussym) {
         will_negate = true;
         // Consume minus
-        next_token(parser);
+        next_type(parser);
     }
 
-    parse_term(parser);
+    ir_node *expression = parse_term(parser, follow | ADDING_OPERATORS);
 
     // Negate term
     if (will_negate) {
-        emit_instruction(
-            &(parser->code_generator),
-            NEG,
-            parser->register_cursor - 1,
-            0,
-            0
-        );
+        expression = ir_operation(&(parser->arena), NEG, expression, NULL);
     }
 
-    while (current_token(parser)->type == plussym || 
-        current_token(parser)->type == minussym) {
-        token_type operator = current_token(parser)->type;
+    while (current_type(parser) == plussym || 
+        current_type(parser) == minussym) {
+        token_type operator = current_type(parser);
 
         // Consume plus or minus
-        next_token(parser);
+        next_type(parser);
 
-        parse_term(parser);
+        ir_node *term = parse_term(parser, follow | ADDING_OPERATORS);
 
-        // Evaluate previous and current factor using current operator
-        if (operator == plussym) {
-            emit_instruction(
-                &(parser->code_generator),
-                ADD,
-                parser->register_cursor - 2,
-                parser->register_cursor - 2,
-                parser->register_cursor - 1
-            );
-        } else { // minussym
-            emit_instruction(
-                &(parser->code_generator),
-                SUB,
-                parser->register_cursor - 2,
-                parser->register_cursor - 2,
-                parser->register_cursor - 1
-            );
-        }
-        // Decrement register cursor, operation squashes 2 values into 1
-        parser->register_cursor--;
-    }
-}
-
-void parse_term(parser_t *parser) {
-    parse_factor(parser);
-
-    while (current_token(parser)->type == multsym ||
-        current_token(parser)->type == slashsym) {
-        token_type operator = current_token(parser)->type;
+        // Evaluate previous and current term using current operator
+        expression = ir_operation(
+            &(parser->arena),
+            operator == plussym ? ADD : SUB,
+            expression,
+            term
+        );
+    }
+
+    return expression;
+}
+
+ir_node *parse_term(parser_t *parser, token_set follow) {
+    ir_node *term = parse_factor(parser, follow | MULTIPLYING_OPERATORS);
+
+    while (current_type(parser) == multsym ||
+        current_type(parser) == slashsym) {
+        token_type operator = current_type(parser);
 
         // Consume multiply or divide
-        next_token(parser);
+        next_type(parser);
 
-        parse_factor(parser);
+        ir_node *factor = parse_factor(parser, follow | MULTIPLYING_OPERATORS);
 
         // Evaluate previous and current factor using current operator
-        if (operator == multsym) {
-            emit_instruction(
-                &(parser->code_generator),
-                MUL,
-                parser->register_cursor - 2,
-                parser->register_cursor - 2,
-                parser->register_cursor - 1
-            );
-        } else { // slashsym
-            emit_instruction(
-                &(parser->code_generator),
-                DIV,
-                parser->register_cursor - 2,
-                parser->register_cursor - 2,
-                parser->register_cursor - 1
-            );
-        }
-        // Decrement register cursor, operation squashes 2 values into 1
-        parser->register_cursor--;
-    }
-}
-
-void parse_factor(parser_t *parser) {
+        term = ir_operation(
+            &(parser->arena),
+            operator == multsym ? MUL : DIV,
+            term,
+            factor
+        );
+    }
+
+    return term;
+}
+
+ir_node *parse_factor(parser_t *parser, token_set follow) {
+    ir_node *factor = NULL;
+
+    // Skip what cannot start a factor, standing in a zero for it unless a
+    // factor comes before anything that may follow
+    if (!in_set(FACTOR_START, current_type(parser))) {
+        report_error(parser, INVALID_EXPRESSION);
+        skip_to(parser, follow | FACTOR_START);
+        if (!in_set(FACTOR_START, current_type(parser))) {
+            return ir_number(&(parser->arena), 0);
+        }
+    }
+
     // EBNF: ident
-    if (current_token(parser)->type == identsym) {
+    if (current_type(parser) == identsym) {
         symbol *s = search_symbol(
-            &(parser->symbol_table), 
-            current_token(parser)->name
+            &(parser->symbol_table),
+            current_token(parser).name
         );
 
         if (s == NULL) {
-            error(UNDECLARED_IDENTIFIER);
+            report_error(parser, UNDECLARED_IDENTIFIER);
+            factor = ir_number(&(parser->arena), 0);
         }
-
         // Load variable
-        if (s->kind == KIND_VAR) {
-            emit_instruction(
-                &(parser->code_generator),
-                LOD,
-                (parser->register_cursor)++,
-                s->level,
-                s->address
-            );
-        } 
+        else if (s->kind == KIND_VAR) {
+            factor = ir_variable(&(parser->arena), s);
+        }
         // Load literal constant
         else if (s->kind == KIND_CONST) {
-            emit_instruction(
-                &(parser->code_generator),
-                LIT,
-                (parser->register_cursor)++,
-                0,
-                s->value
-            );
+            factor = ir_number(&(parser->arena), s->value);
         }
         else {
-            error(NON_VAR_CONST_IDENTIFIER_FACTOR);
+            report_error(parser, NON_VAR_CONST_IDENTIFIER_FACTOR);
+            factor = ir_number(&(parser->arena), 0);
         }
-    } 
+
+        // Consume identifier
+        next_type(parser);
+    }
     // EBNF: number
-    else if (current_token(parser)->type == numbersym) {
-        emit_instruction(
-            &(parser->code_generator),
-            LIT,
-            (parser->register_cursor)++,
-            0,
-            atoi(current_token(parser)->name)
+    else if (current_type(parser) == numbersym) {
+        factor = ir_number(
+            &(parser->arena),
+            current_token(parser).value
         );
+
+        // Consume number
+        next_type(parser);
     }
     // EBNF: "(" expression ")"
-    else if (current_token(parser)->type == lparentsym) {
+    else {
         // Consume left parenthesis
-        next_token(parser);
+        next_type(parser);
 
-        parse_expression(parser);
+        factor = parse_recursive_expression(parser,
+            follow | TOKEN_SET(rparentsym));
 
-        if (current_token(parser)->type != rparentsym) {
-            error(RIGHT_PARENTHESIS_EXPECTED_FACTOR);
+        if (current_type(parser) != rparentsym) {
+            report_error(parser, RIGHT_PARENTHESIS_EXPECTED_FACTOR);
+        } else {
+            // Consume right parenthesis
+            next_type(parser);
         }
-
-        // Consume right parenthesis
-        next_token(parser);
-    }
-    else {
-        error(INVALID_EXPRESSION);
     }
+
+    return factor;
 }
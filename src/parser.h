@@ -4,21 +4,48 @@
 #include "symbol.h"
 #include "codegen.h"
 #include "token_list.h"
+#include "ir.h"
+#include "options.h"
+#include "error.h"
 
 typedef struct parser_t {
     token_list_t *token_list;
     int token_cursor;
     symbol_table_t symbol_table;
-    int register_cursor;
+    int level;                      // Lexicographical level being parsed
+    ir_arena_t arena;               // Owns every node of the program's IR
+    ir_node *program;               // IR of the parsed program
     code_generator_t code_generator;
+    compile_options_t options;
+    ir_node **operands;             // Operand stack of parse_expression
+    int num_operands;
+    int operands_capacity;
+    int *operators;                 // Operator stack of parse_expression
+    int num_operators;
+    int operators_capacity;
+    diagnostic *diagnostics;        // Errors found so far, in order
+    int num_diagnostics;
+    int diagnostics_capacity;
 } parser_t;
 
 /**
  * @brief Initialize a parser with the given token list
  * 
+ * @param parser The parser to initialize
  * @param token_list The list of tokens to use in the parser
+ * @param options Options to compile the program with
  */
-void init_parser(parser_t *parser, token_list_t *token_list);
+void init_parser(parser_t *parser, token_list_t *token_list,
+    compile_options_t *options);
+
+/**
+ * @brief Frees the IR, expression stacks and diagnostics of the parser
+ * 
+ * The token list is owned by the caller and is not freed.
+ * 
+ * @param parser The parser to free
+ */
+void free_parser(parser_t *parser);
 
 /**
  * @brief Adds an instruction to the code generator
@@ -38,9 +65,9 @@ void add_code(parser_t *parser, cg_instruction *i);
  *     return token_list[token_cursor];
  * 
  * @param parser The parser to read the token from
- * @return token* Pointer to the current token
+ * @return token The current token
  */
-token *current_token(parser_t *parser);
+token current_token(parser_t *parser);
 
 /**
  * @brief Advances the cursor to and returns the next token in the token list
@@ -50,9 +77,51 @@ token *current_token(parser_t *parser);
  * of the returned token.
  * 
  * @param parser The parser to read the token from
- * @return token* Pointer to the next token
+ * @return token The next token
+ */
+token next_token(parser_t *parser);
+
+/**
+ * @brief Returns the type of the token at the token_cursor index
+ * 
+ * Only reads the token list's array of types, unlike current_token.
+ * 
+ * @param parser The parser to read the token type from
+ * @return token_type Type of the current token
  */
-token *next_token(parser_t *parser);
+token_type current_type(parser_t *parser);
+
+/**
+ * @brief Advances the cursor and returns the type of the token it reaches
+ * 
+ * Like next_token, but only reads the token list's array of types.
+ * 
+ * @param parser The parser to read the token type from
+ * @return token_type Type of the next token
+ */
+token_type next_type(parser_t *parser);
+
+/**
+ * @brief Record an error at the current token and go on parsing
+ * 
+ * An error at the same token as the one before it is not recorded, since
+ * it is most likely a consequence of that one.
+ * 
+ * @param parser The parser that found the error
+ * @param e The error
+ */
+void report_error(parser_t *parser, error_type e);
+
+/**
+ * @brief Print every error found, if any, and exit
+ * 
+ * Errors are printed to stderr in the order they were found, along with
+ * the index of the token each was found at. The exit code is the type of
+ * the first error.
+ * 
+ * @param parser The parser whose errors to report
+ */
+void report_diagnostics(parser_t *parser);
 
 /**
  * @brief Parse a program
@@ -60,19 +129,57 @@ token *next_token(parser_t *parser);
  * EBNF:
  * program ::= block ".".
  * 
+ * The program's IR is kept in parser->program and lowered into 
+ * parser->code_generator.
+ * 
+ * Parsing does not stop at an error. Each parse function is given the
+ * tokens that may follow what it parses. After an error it skips tokens
+ * until it reaches one of them, or one it can go on parsing from, so one
+ * compile reports every error of the program. Once all of it was parsed,
+ * the errors are reported by report_diagnostics, and no code is generated.
+ * 
  * @param parser Pointer to the parser containing the tokens to parse
  */
 void parse_program(parser_t *parser);
 
+/**
+ * @brief Parse a program into a streaming code generator
+ *
+ * Like parse_program, but at optimization level 0, where no pass looks at
+ * the whole program, each statement of the main block's begin statement is
+ * lowered as soon as it is parsed and its IR freed, so the IR held does not
+ * grow with the number of statements. Other programs, and main blocks
+ * declaring no variables, are parsed whole and then lowered. Code lowered
+ * before an error was found is left in the stream.
+ *
+ * @param parser Parser whose code generator streams its code
+ */
+void stream_program(parser_t *parser);
+
+/**
+ * @brief Optimize the IR of a program and lower it into code
+ * 
+ * The code goes to parser->code_generator and is optimized further if it is 
+ * not streamed. The symbol table is changed, see optimize_program.
+ * 
+ * @param parser Parser holding the symbols the IR refers to
+ * @param program IR_BLOCK node of the program, modified in place
+ * @param arena Arena to allocate new nodes from
+ */
+void generate_program(parser_t *parser, ir_node *program, ir_arena_t *arena);
+
 /**
  * @brief Parse a block
  * 
  * EBNF:
- * block ::= const-declaration var-declaration statement.
+ * block ::= const-declaration var-declaration procedure-declaration 
+ *           statement.
  * 
  * @param parser Pointer to the parser containing the tokens to parse
+ * @param follow Tokens that may follow, where parsing resumes after an error
+ * @return ir_node* IR_BLOCK node of the block
  */
-void parse_block(parser_t *parser);
+ir_node *parse_block(parser_t *parser, token_set follow);
 
 /**
  * @brief Parse a const-declaration
@@ -81,8 +188,9 @@ void parse_block(parser_t *parser);
  * const-declaration ::= ["const" ident "=" number {"," ident "=" number} ";"].
  * 
  * @param parser Pointer to the parser containing the tokens to parse
+ * @param follow Tokens that may follow, where parsing resumes after an error
  */
-void parse_const_declaration(parser_t *parser);
+void parse_const_declaration(parser_t *parser, token_set follow);
 
 /**
  * @brief Parse a var-declaration
@@ -91,8 +199,25 @@ void parse_const_declaration(parser_t *parser);
  * var-declaration ::= ["var" ident {"," ident} ";"].
  * 
  * @param parser Pointer to the parser containing the tokens to parse
+ * @param follow Tokens that may follow, where parsing resumes after an error
+ * @return int Number of variables declared
  */
-void parse_var_declaration(parser_t *parser);
+int parse_var_declaration(parser_t *parser, token_set follow);
+
+/**
+ * @brief Parse a procedure-declaration
+ * 
+ * EBNF:
+ * procedure-declaration ::= {"procedure" ident ";" block ";"}.
+ * 
+ * Every procedure's block is one level deeper than the block declaring it, 
+ * has a frame of its own, and its declarations are out of scope after it.
+ * 
+ * @param parser Pointer to the parser containing the tokens to parse
+ * @param follow Tokens that may follow, where parsing resumes after an error
+ * @return ir_node* First IR_PROCEDURE node, chained through next, or NULL
+ */
+ir_node *parse_procedure_declaration(parser_t *parser, token_set follow);
 
 /**
  * @brief Parse a statement
@@ -102,13 +227,16 @@ void parse_var_declaration(parser_t *parser);
  *                | "begin" statement {";" statement} "end"
  *                | "if" condition "then" statement
  *                | "while" condition "do" statement 
+ *                | "call" ident
  *                | "read" ident 
  *                | "write" ident 
  *                | e].
  * 
  * @param parser Pointer to the parser containing the tokens to parse
+ * @param follow Tokens that may follow, where parsing resumes after an error
+ * @return ir_node* IR of the statement, IR_EMPTY if there is none
  */
-void parse_statement(parser_t *parser);
+ir_node *parse_statement(parser_t *parser, token_set follow);
 
 /**
  * @brief Parse a condition
@@ -118,8 +246,10 @@ void parse_statement(parser_t *parser);
  *               | expression rel-op expression.
  * 
  * @param parser Pointer to the parser containing the tokens to parse
+ * @param follow Tokens that may follow, where parsing resumes after an error
+ * @return ir_node* IR of the condition
  */
-void parse_condition(parser_t *parser);
+ir_node *parse_condition(parser_t *parser, token_set follow);
 
 /**
  * @brief Parse a rel-op
@@ -127,9 +257,13 @@ void parse_condition(parser_t *parser);
  * EBNF:
  * rel-op ::= "=" | "<>" | "<" | "<=" | ">" | ">=".
  * 
+ * A missing rel-op is reported, and taken to be "=" without consuming the
+ * current token.
+ * 
  * @param parser Pointer to the parser containing the tokens to parse
+ * @return opcode Comparison opcode of the rel-op
  */
-void parse_rel_op(parser_t *parser);
+opcode parse_rel_op(parser_t *parser);
 
 /**
  * @brief Parse an expression
@@ -137,9 +271,28 @@ void parse_rel_op(parser_t *parser);
  * EBNF:
  * expression ::= ["+" | "-"] term {("+" | "-") term}.
  * 
+ * Parses by precedence climbing over explicit operand and operator stacks,
+ * so neither operators nor parentheses make it recurse. Builds the same IR,
+ * in the same order, as parse_recursive_expression, which it defers to if
+ * the parser's options ask for recursive descent.
+ * 
  * @param parser Pointer to the parser containing the tokens to parse
+ * @param follow Tokens that may follow, where parsing resumes after an error
+ * @return ir_node* IR of the expression
  */
-void parse_expression(parser_t *parser);
+ir_node *parse_expression(parser_t *parser, token_set follow);
+
+/**
+ * @brief Parse an expression by recursive descent
+ * 
+ * EBNF:
+ * expression ::= ["+" | "-"] term {("+" | "-") term}.
+ * 
+ * @param parser Pointer to the parser containing the tokens to parse
+ * @param follow Tokens that may follow, where parsing resumes after an error
+ * @return ir_node* IR of the expression
+ */
+ir_node *parse_recursive_expression(parser_t *parser, token_set follow);
 
 /**
  * @brief Parse a term
@@ -148,8 +301,10 @@ void parse_expression(parser_t *parser);
  * term ::= factor {("*" | "/") factor}.
  * 
  * @param parser Pointer to the parser containing the tokens to parse
+ * @param follow Tokens that may follow, where parsing resumes after an error
+ * @return ir_node* IR of the term
  */
-void parse_term(parser_t *parser);
+ir_node *parse_term(parser_t *parser, token_set follow);
 
 /**
  * @brief Parse a factor
@@ -157,8 +312,12 @@ void parse_term(parser_t *parser);
  * EBNF:
  * factor ::= ident | number | "(" expression ")".
  * 
+ * A parenthesized expression is parsed by parse_recursive_expression.
+ * 
  * @param parser Pointer to the parser containing the tokens to parse
+ * @param follow Tokens that may follow, where parsing resumes after an error
+ * @return ir_node* IR of the factor
  */
-void parse_factor(parser_t *parser);
+ir_node *parse_factor(parser_t *parser, token_set follow);
 
 #endif /* PARSER_H */
@@ -0,0 +1,343 @@
+// open_memstream is POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
+
+#include "scheduler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void *allocate(size_t size) {
+    void *memory = malloc(size);
+    if (memory == NULL) {
+        fprintf(stderr, "Could not allocate memory for the scheduler\n");
+        exit(EXIT_FAILURE);
+    }
+    return memory;
+}
+
+void init_scheduler(scheduler_t *scheduler, int num_workers, long budget) {
+    scheduler->contexts = NULL;
+    scheduler->num_contexts = 0;
+    scheduler->contexts_capacity = 0;
+    scheduler->deques = NULL;
+    scheduler->workers = NULL;
+    scheduler->num_workers = num_workers;
+    scheduler->budget = budget;
+    pthread_mutex_init(&(scheduler->lock), NULL);
+    pthread_cond_init(&(scheduler->work_available), NULL);
+    pthread_cond_init(&(scheduler->context_finished), NULL);
+    scheduler->runnable = 0;
+    scheduler->unfinished = 0;
+    scheduler->started = false;
+}
+
+void free_scheduler(scheduler_t *scheduler) {
+    for (int i = 0; i < scheduler->num_contexts; i++) {
+        vm_context *context = scheduler->contexts[i];
+
+        free_vm(&(context->vm));
+        fclose(context->vm.output.stream);
+        free(context->output);
+        free(context->pending);
+        pthread_mutex_destroy(&(context->lock));
+        free(context);
+    }
+    for (int w = 0; scheduler->deques != NULL && w < scheduler->num_workers;
+        w++) {
+        pthread_mutex_destroy(&(scheduler->deques[w].lock));
+        free(scheduler->deques[w].contexts);
+    }
+    free(scheduler->contexts);
+    free(scheduler->deques);
+    free(scheduler->workers);
+    pthread_mutex_destroy(&(scheduler->lock));
+    pthread_cond_destroy(&(scheduler->work_available));
+    pthread_cond_destroy(&(scheduler->context_finished));
+}
+
+int add_context(scheduler_t *scheduler, code_generator_t *generator,
+    int superinstructions) {
+    if (scheduler->num_contexts == scheduler->contexts_capacity) {
+        int capacity = scheduler->contexts_capacity > 0 ?
+            scheduler->contexts_capacity * 2 : 16;
+        vm_context **contexts = (vm_context **)realloc(scheduler->contexts,
+            sizeof(vm_context *) * capacity);
+        if (contexts == NULL) {
+            fprintf(stderr, "Could not allocate memory for the scheduler\n");
+            exit(EXIT_FAILURE);
+        }
+        scheduler->contexts = contexts;
+        scheduler->contexts_capacity = capacity;
+    }
+
+    vm_context *context = (vm_context *)allocate(sizeof(vm_context));
+    init_vm(&(context->vm));
+    load_program(&(context->vm), generator, superinstructions);
+    // Nothing is read from stdin, the queue starts out empty
+    queue_input(&(context->vm), NULL, 0);
+
+    context->output = NULL;
+    context->output_size = 0;
+    FILE *output = open_memstream(&(context->output),
+        &(context->output_size));
+    if (output == NULL) {
+        fprintf(stderr, "Could not open the output of a context\n");
+        exit(EXIT_FAILURE);
+    }
+    set_vm_io(&(context->vm), NULL, output, IO_TEXT);
+
+    pthread_mutex_init(&(context->lock), NULL);
+    context->pending = NULL;
+    context->num_pending = 0;
+    context->pending_capacity = 0;
+    context->pending_closed = false;
+    context->parked = false;
+    context->finished = false;
+
+    scheduler->contexts[scheduler->num_contexts] = context;
+    return (scheduler->num_contexts)++;
+}
+
+// Put a context at the back of a deque, where its owner takes it next
+static void push_back(context_deque *deque, vm_context *context) {
+    pthread_mutex_lock(&(deque->lock));
+    deque->contexts[(deque->front + deque->size) % deque->capacity] = context;
+    (deque->size)++;
+    pthread_mutex_unlock(&(deque->lock));
+}
+
+// Put a context at the front of a deque, behind every other context
+static void push_front(context_deque *deque, vm_context *context) {
+    pthread_mutex_lock(&(deque->lock));
+    deque->front = (deque->front + deque->capacity - 1) % deque->capacity;
+    deque->contexts[deque->front] = context;
+    (deque->size)++;
+    pthread_mutex_unlock(&(deque->lock));
+}
+
+static vm_context *pop_back(context_deque *deque) {
+    vm_context *context = NULL;
+
+    pthread_mutex_lock(&(deque->lock));
+    if (deque->size > 0) {
+        (deque->size)--;
+        context = deque->contexts[(deque->front + deque->size) %
+            deque->capacity];
+    }
+    pthread_mutex_unlock(&(deque->lock));
+    return context;
+}
+
+static vm_context *pop_front(context_deque *deque) {
+    vm_context *context = NULL;
+
+    pthread_mutex_lock(&(deque->lock));
+    if (deque->size > 0) {
+        context = deque->contexts[deque->front];
+        deque->front = (deque->front + 1) % deque->capacity;
+        (deque->size)--;
+    }
+    pthread_mutex_unlock(&(deque->lock));
+    return context;
+}
+
+// Make a context runnable again, on the given worker
+static void schedule(scheduler_t *scheduler, int worker, vm_context *context,
+    bool preempted) {
+    if (preempted) push_front(&(scheduler->deques[worker]), context);
+    else push_back(&(scheduler->deques[worker]), context);
+
+    pthread_mutex_lock(&(scheduler->lock));
+    (scheduler->runnable)++;
+    pthread_cond_signal(&(scheduler->work_available));
+    pthread_mutex_unlock(&(scheduler->lock));
+}
+
+// Take the next context for a worker, stealing if its own queue is empty
+static vm_context *take_context(scheduler_t *scheduler, int worker) {
+    vm_context *context = pop_back(&(scheduler->deques[worker]));
+
+    for (int k = 1; context == NULL && k < scheduler->num_workers; k++) {
+        int victim = (worker + k) % scheduler->num_workers;
+        context = pop_front(&(scheduler->deques[victim]));
+    }
+
+    if (context != NULL) {
+        pthread_mutex_lock(&(scheduler->lock));
+        (scheduler->runnable)--;
+        pthread_mutex_unlock(&(scheduler->lock));
+    }
+    return context;
+}
+
+// Move the input given so far into the machine, the context must be locked
+static void take_pending_input(vm_context *context) {
+    queue_input(&(context->vm), context->pending, context->num_pending);
+    context->num_pending = 0;
+    if (context->pending_closed) close_input(&(context->vm));
+}
+
+// Run one turn of a context, then put it wherever it belongs
+static void run_turn(scheduler_t *scheduler, int worker, vm_context *context) {
+    pthread_mutex_lock(&(context->lock));
+    take_pending_input(context);
+    pthread_mutex_unlock(&(context->lock));
+
+    vm_status status = run_vm_budget(&(context->vm), scheduler->budget);
+
+    if (status == VM_PREEMPTED) {
+        schedule(scheduler, worker, context, true);
+    } else if (status == VM_WAITING) {
+        // Input may have been given since the turn started
+        pthread_mutex_lock(&(context->lock));
+        bool has_input = context->num_pending > 0 || context->pending_closed;
+        if (!has_input) context->parked = true;
+        pthread_mutex_unlock(&(context->lock));
+
+        if (has_input) schedule(scheduler, worker, context, false);
+    } else {
+        pthread_mutex_lock(&(scheduler->lock));
+        // Halting flushed the output, it can be printed from here on
+        context->finished = true;
+        pthread_cond_broadcast(&(scheduler->context_finished));
+        if (--(scheduler->unfinished) == 0) {
+            pthread_cond_broadcast(&(scheduler->work_available));
+        }
+        pthread_mutex_unlock(&(scheduler->lock));
+    }
+}
+
+/**
+ * @brief Arguments of a worker thread
+ */
+typedef struct worker_start {
+    scheduler_t *scheduler;
+    int worker;
+} worker_start;
+
+static void *run_worker(void *argument) {
+    worker_start *start = (worker_start *)argument;
+    scheduler_t *scheduler = start->scheduler;
+    int worker = start->worker;
+    free(start);
+
+    while (true) {
+        vm_context *context = take_context(scheduler, worker);
+
+        if (context != NULL) {
+            run_turn(scheduler, worker, context);
+            continue;
+        }
+
+        // Sleep until a context becomes runnable or everything halted
+        pthread_mutex_lock(&(scheduler->lock));
+        while (scheduler->runnable == 0 && scheduler->unfinished > 0) {
+            pthread_cond_wait(&(scheduler->work_available),
+                &(scheduler->lock));
+        }
+        bool done = scheduler->unfinished == 0;
+        pthread_mutex_unlock(&(scheduler->lock));
+
+        if (done) return NULL;
+    }
+}
+
+void give_input(scheduler_t *scheduler, int id, int *values, int count,
+    bool close) {
+    vm_context *context = scheduler->contexts[id];
+
+    pthread_mutex_lock(&(context->lock));
+    if (context->num_pending + count > context->pending_capacity) {
+        int capacity = context->pending_capacity > 0 ?
+            context->pending_capacity * 2 : 16;
+        while (capacity < context->num_pending + count) capacity *= 2;
+
+        int *pending = (int *)realloc(context->pending,
+            sizeof(int) * capacity);
+        if (pending == NULL) {
+            fprintf(stderr, "Could not allocate memory for the scheduler\n");
+            exit(EXIT_FAILURE);
+        }
+        context->pending = pending;
+        context->pending_capacity = capacity;
+    }
+    // Closing the input alone passes no values, and maybe no array
+    if (count > 0) {
+        memcpy(&(context->pending[context->num_pending]), values,
+            sizeof(int) * count);
+        context->num_pending += count;
+    }
+    if (close) context->pending_closed = true;
+
+    bool wake = context->parked;
+    context->parked = false;
+    pthread_mutex_unlock(&(context->lock));
+
+    if (wake) {
+        schedule(scheduler, id % scheduler->num_workers, context, false);
+    }
+}
+
+void start_scheduler(scheduler_t *scheduler) {
+    int num_workers = scheduler->num_workers;
+
+    scheduler->deques = (context_deque *)allocate(
+        sizeof(context_deque) * num_workers);
+    for (int w = 0; w < num_workers; w++) {
+        context_deque *deque = &(scheduler->deques[w]);
+
+        pthread_mutex_init(&(deque->lock), NULL);
+        // Every context may end up in the same queue
+        deque->capacity = scheduler->num_contexts + 1;
+        deque->contexts = (vm_context **)allocate(
+            sizeof(vm_context *) * deque->capacity);
+        deque->front = 0;
+        deque->size = 0;
+    }
+
+    // Deal the contexts out to the workers
+    scheduler->unfinished = scheduler->num_contexts;
+    scheduler->runnable = scheduler->num_contexts;
+    for (int i = 0; i < scheduler->num_contexts; i++) {
+        push_back(&(scheduler->deques[i % num_workers]),
+            scheduler->contexts[i]);
+    }
+
+    scheduler->started = true;
+    scheduler->workers = (pthread_t *)allocate(sizeof(pthread_t) * num_workers);
+    for (int w = 0; w < num_workers; w++) {
+        worker_start *start = (worker_start *)allocate(sizeof(worker_start));
+        start->scheduler = scheduler;
+        start->worker = w;
+
+        if (pthread_create(&(scheduler->workers[w]), NULL, run_worker,
+            start) != 0) {
+            fprintf(stderr, "Could not start a worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+void wait_scheduler(scheduler_t *scheduler) {
+    if (!scheduler->started) return;
+
+    for (int w = 0; w < scheduler->num_workers; w++) {
+        pthread_join(scheduler->workers[w], NULL);
+    }
+    scheduler->started = false;
+}
+
+void wait_context(scheduler_t *scheduler, int id) {
+    vm_context *context = scheduler->contexts[id];
+
+    pthread_mutex_lock(&(scheduler->lock));
+    while (!context->finished) {
+        pthread_cond_wait(&(scheduler->context_finished), &(scheduler->lock));
+    }
+    pthread_mutex_unlock(&(scheduler->lock));
+}
+
+vm_context *get_context(scheduler_t *scheduler, int id) {
+    return scheduler->contexts[id];
+}
@@ -0,0 +1,151 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+/**
+ * @file scheduler.h
+ * @brief Runs many programs concurrently on a pool of worker threads
+ *
+ * Every program runs in a context of its own, a virtual machine with its own
+ * registers, stack, input queue and output. Workers take contexts from their
+ * own queue and steal from the other workers' queues when theirs is empty.
+ * A context runs until it used up its instruction budget, waits for input or
+ * halts, so a long running program cannot keep the others from running.
+ *
+ * Contexts read only from their input queue, never from stdin, and are
+ * never compiled to native code.
+ *
+ */
+
+#include "codegen.h"
+#include "vm.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+
+/**
+ * @brief A program run by the scheduler
+ */
+typedef struct vm_context {
+    vm_t vm;
+    pthread_mutex_t lock;   // Guards the pending input and parked
+    int *pending;           // Input given while the context may be running
+    int num_pending;
+    int pending_capacity;
+    bool pending_closed;    // Whether the input was closed
+    bool parked;            // Waiting for input, in no worker's queue
+    char *output;           // Everything the program wrote
+    size_t output_size;
+    bool finished;          // Whether it halted, guarded by the scheduler
+} vm_context;
+
+/**
+ * @brief Double-ended queue of contexts owned by a worker
+ *
+ * The owner takes contexts from the back and puts preempted ones at the
+ * front, behind every other context. Thieves take from the front.
+ */
+typedef struct context_deque {
+    pthread_mutex_t lock;
+    vm_context **contexts;  // Ring buffer holding every context if needed
+    int capacity;
+    int front;
+    int size;
+} context_deque;
+
+typedef struct scheduler_t {
+    vm_context **contexts;
+    int num_contexts;
+    int contexts_capacity;
+    context_deque *deques;  // One per worker
+    pthread_t *workers;
+    int num_workers;
+    long budget;            // Instructions per turn of a context
+    pthread_mutex_t lock;   // Guards the counters below
+    pthread_cond_t work_available;
+    pthread_cond_t context_finished;
+    int runnable;           // Contexts in some worker's queue
+    int unfinished;         // Contexts that have not halted
+    bool started;
+} scheduler_t;
+
+/**
+ * @brief Initialize a scheduler with no contexts
+ *
+ * @param scheduler The scheduler to initialize
+ * @param num_workers Number of worker threads, at least 1
+ * @param budget Instructions a context runs before it is preempted
+ */
+void init_scheduler(scheduler_t *scheduler, int num_workers, long budget);
+
+/**
+ * @brief Frees the contexts of a scheduler that was waited for
+ *
+ * @param scheduler The scheduler to free
+ */
+void free_scheduler(scheduler_t *scheduler);
+
+/**
+ * @brief Load a program into a new context
+ *
+ * Programs can only be added before the scheduler is started.
+ *
+ * @param scheduler Scheduler to add the context to
+ * @param generator Generator holding the program's code
+ * @param superinstructions Mask of superinstructions to fuse
+ * @return int Identifier of the context
+ */
+int add_context(scheduler_t *scheduler, code_generator_t *generator,
+    int superinstructions);
+
+/**
+ * @brief Give input to a context, waking it up if it waits for input
+ *
+ * Safe to call from any thread while the scheduler runs.
+ *
+ * @param scheduler Scheduler the context belongs to
+ * @param id Identifier of the context
+ * @param values Values read by the program's SIO_READ, in order
+ * @param count Number of values
+ * @param close Whether these are the last values the program gets
+ */
+void give_input(scheduler_t *scheduler, int id, int *values, int count,
+    bool close);
+
+/**
+ * @brief Start the worker threads
+ *
+ * @param scheduler The scheduler to start
+ */
+void start_scheduler(scheduler_t *scheduler);
+
+/**
+ * @brief Wait until every context halted, then stop the workers
+ *
+ * Contexts waiting for input keep the scheduler running until their input
+ * is given or closed.
+ *
+ * @param scheduler The scheduler to wait for
+ */
+void wait_scheduler(scheduler_t *scheduler);
+
+/**
+ * @brief Wait until a context halted, while the others keep running
+ *
+ * @param scheduler Scheduler the context belongs to
+ * @param id Identifier of the context
+ */
+void wait_context(scheduler_t *scheduler, int id);
+
+/**
+ * @brief Returns the context with the given identifier
+ *
+ * The output of a context is complete once it was waited for, or the
+ * scheduler was.
+ *
+ * @param scheduler Scheduler the context belongs to
+ * @param id Identifier of the context
+ * @return vm_context* The context
+ */
+vm_context *get_context(scheduler_t *scheduler, int id);
+
+#endif /* SCHEDULER_H */
@@ -1,60 +1,102 @@
 #include "symbol.h"
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-void init_symbol_table(symbol_table_t *table) {
+void init_symbol_table(symbol_table_t *table, int capacity) {
+    table->symbols = (symbol *)malloc(sizeof(symbol) * capacity);
+    if (table->symbols == NULL) {
+        fprintf(stderr, "ERROR: Symbol table allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
     table->num_symbols = 0;
+    table->capacity = capacity;
+    table->num_in_scope = 0;
     table->var_address_index = 4;
 }
 
+void free_symbol_table(symbol_table_t *table) {
+    free(table->symbols);
+    table->symbols = NULL;
+    table->num_symbols = 0;
+    table->capacity = 0;
+    table->num_in_scope = 0;
+}
+
 symbol create_symbol(kind_type kind, char name[12], int value, int level,
     int address, mark_type mark) {
     symbol s = {
         kind,
-        name,
+        "",
         value,
         level,
         address,
         mark
     };
+    // Names are at most 11 characters, leave room for the terminator
+    strncpy(s.name, name, sizeof(s.name) - 1);
     return s;
 }
 
-symbol create_const_symbol(char name[12], int value) {
-    symbol s = {
+symbol create_const_symbol(char name[12], int value, int level) {
+    return create_symbol(
         KIND_CONST,     // Kind
         name,           // Name
         value,          // Value
-        0,              // Level 
+        level,          // Level 
         0,              // Address
         MARK_VALID      // Mark
-    };
-    return s;
+    );
 }
 
-symbol create_var_symbol(char name[12]) {
-    symbol s = {
+symbol create_var_symbol(char name[12], int level) {
+    return create_symbol(
         KIND_VAR,       // Kind
         name,           // Name
         0,              // Value
-        0,              // Level 
+        level,          // Level 
         0,              // Address
         MARK_VALID      // Mark
-    };
-    return s;
+    );
 }
 
-void insert_symbol(symbol_table_t *table, symbol *sym) {
+symbol create_proc_symbol(char name[12], int level) {
+    return create_symbol(
+        KIND_PROC,      // Kind
+        name,           // Name
+        0,              // Value
+        level,          // Level 
+        0,              // Address
+        MARK_VALID      // Mark
+    );
+}
+
+bool insert_symbol(symbol_table_t *table, symbol *sym) {
+    if (table->num_symbols == table->capacity ||
+        table->num_in_scope == MAX_SYMBOL_TABLE_SIZE) {
+        return false;
+    }
+
     // Grab the address of the destination symbol from the table
     symbol *s = &(table->symbols[table->num_symbols]);
 
-    if (s->kind == KIND_VAR)
+    if (sym->kind == KIND_VAR)
         sym->address = (table->var_address_index)++;
 
     // Copy the contents of the passed in symbol to the destination
     memcpy(s, sym, sizeof(symbol));
 
     (table->num_symbols)++;
+    if (sym->mark == MARK_VALID) (table->num_in_scope)++;
+    return true;
+}
+
+void close_scope(symbol_table_t *table, int scope) {
+    for (int i = scope; i < table->num_symbols; i++) {
+        if (table->symbols[i].mark == MARK_VALID) (table->num_in_scope)--;
+        table->symbols[i].mark = MARK_INVALID;
+    }
 }
 
 symbol *search_symbol(symbol_table_t *table, char name[12]) {
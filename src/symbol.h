@@ -1,6 +1,9 @@
 #ifndef SYMBOL_H
 #define SYMBOL_H
 
+#include <stdbool.h>
+
+// Symbols that can be in scope at once
 #define MAX_SYMBOL_TABLE_SIZE 200
 
 /**
@@ -8,7 +11,8 @@
  */
 typedef enum kind_type {
     KIND_CONST = 1, // Const symbol
-    KIND_VAR = 2    // Var symbol
+    KIND_VAR = 2,   // Var symbol
+    KIND_PROC = 3   // Procedure symbol, address is its first instruction
 } kind_type;
 
 /**
@@ -36,19 +40,36 @@ typedef struct symbol {
 /**
  * @brief Collection of symbols indexed in a parser
  * 
+ * Symbols stay in the table after their scope closes, since the IR refers
+ * to them, but only those in scope count against MAX_SYMBOL_TABLE_SIZE.
+ * 
  */
 typedef struct symbol_table_t {
-    symbol symbols[MAX_SYMBOL_TABLE_SIZE];
+    symbol *symbols;        // Every symbol declared, in order
     int num_symbols;        // Current size of symbol table
-    int var_address_index;  // Next value to use as a variable's address
+    int capacity;           // Symbols the table has room for
+    int num_in_scope;       // Symbols not marked invalid
+    int var_address_index;  // Next address in the frame of the current block
 } symbol_table_t;
 
 /**
  * @brief Initializes a symbol table with appropriate values
  * 
+ * The symbols are never moved, so pointers to them stay valid until the 
+ * table is freed. If the allocation fails, an error is logged to stderr 
+ * and the program is exited with EXIT_FAILURE.
+ * 
  * @param table Pointer to the table to initialize
+ * @param capacity Number of symbols the table has room for
  */
-void init_symbol_table(symbol_table_t *table);
+void init_symbol_table(symbol_table_t *table, int capacity);
+
+/**
+ * @brief Free the symbols of a table
+ * 
+ * @param table Pointer to the table to free
+ */
+void free_symbol_table(symbol_table_t *table);
 
 /**
  * @brief Create a symbol and return a copy
@@ -69,15 +90,16 @@ symbol create_symbol(kind_type kind, char name[12], int value, int level,
  * 
  * @param name Name of the identifier
  * @param value Value of the constant
+ * @param level Lexicographical level of the block declaring the constant
  * @return symbol The created symbol
  */
-symbol create_const_symbol(char name[12], int value);
+symbol create_const_symbol(char name[12], int value, int level);
 
 /**
  * @brief Create a var symbol
  * 
- * The level of all symbols in this assignment should be 0, because we are not 
- * implementing procedures.
+ * The level is the nesting depth of the block declaring the variable, 0 for 
+ * the main program and one more for every procedure around the declaration.
  * 
  * The address is not needed when creating the symbol because it will be set 
  * on insertion into the table. The address cannot be known without access to 
@@ -86,9 +108,21 @@ symbol create_const_symbol(char name[12], int value);
  * Note: Variables should not store nor update their value property
  * 
  * @param name Name of the identifier
+ * @param level Lexicographical level of the block declaring the variable
+ * @return symbol The created symbol
+ */
+symbol create_var_symbol(char name[12], int level);
+
+/**
+ * @brief Create a procedure symbol
+ * 
+ * The address is set once the procedure's code is generated.
+ * 
+ * @param name Name of the identifier
+ * @param level Lexicographical level of the block declaring the procedure
  * @return symbol The created symbol
  */
-symbol create_var_symbol(char name[12]);
+symbol create_proc_symbol(char name[12], int level);
 
 /**
  * @brief Copies the values from sym into the next available symbol
@@ -98,8 +132,18 @@ symbol create_var_symbol(char name[12]);
  * 
  * @param table Pointer to the table to insert a symbol into
  * @param sym Pointer to the symbol whose values to copy
+ * @return bool False if the table is full or MAX_SYMBOL_TABLE_SIZE symbols
+ *  are in scope already, in which case nothing is inserted
+ */
+bool insert_symbol(symbol_table_t *table, symbol *sym);
+
+/**
+ * @brief Mark the symbols inserted since a point as out of scope
+ * 
+ * @param table Pointer to the table holding the symbols
+ * @param scope Number of symbols the table held when the scope opened
  */
-void insert_symbol(symbol_table_t *table, symbol *sym);
+void close_scope(symbol_table_t *table, int scope);
 
 /**
  * @brief Searches for the symbol with the given name
@@ -7,8 +7,8 @@ char *token_type_strings[] = {
     "multsym", "slashsym", "oddsym", "eqsym", "neqsym", "lessym", 
     "leqsym", "gtrsym", "geqsym", "lparentsym", "rparentsym", "commasym", 
     "semicolonsym", "periodsym", "becomessym", "beginsym", "endsym", 
-    "ifsym", "thensym", "whilesym", "dosym", "", "constsym", "varsym", "",
-    "writesym", "readsym"
+    "ifsym", "thensym", "whilesym", "dosym", "callsym", "constsym", "varsym",
+    "procsym", "writesym", "readsym"
 };
 
 token_type string_to_token(char *str) {
@@ -39,6 +39,12 @@ token_type string_to_token(char *str) {
     if (strcmp(str, "do") == 0) {
         return dosym;
     }
+    if (strcmp(str, "call") == 0) {
+        return callsym;
+    }
+    if (strcmp(str, "procedure") == 0) {
+        return procsym;
+    }
     if (strcmp(str, "read") == 0) {
         return readsym;
     }
@@ -52,5 +58,6 @@ token_type string_to_token(char *str) {
 }
 
 char *token_to_string(token_type token) {
+    if (token < nulsym || token > readsym) return "unknown";
     return token_type_strings[token];
 }
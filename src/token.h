@@ -6,14 +6,20 @@ typedef enum token_type { nulsym = 1, identsym, numbersym, plussym, minussym,
     multsym, slashsym, oddsym, eqsym, neqsym, lessym, leqsym,
     gtrsym, geqsym, lparentsym, rparentsym, commasym, semicolonsym,
     periodsym, becomessym, beginsym, endsym, ifsym, thensym,
-    whilesym, dosym, constsym = 28, varsym, writesym = 31,
+    whilesym, dosym, callsym, constsym, varsym, procsym, writesym,
     readsym
 } token_type;
 
+/* Set of token types, one bit per type, only defined for nulsym..readsym */
+typedef unsigned long long token_set;
+
+#define TOKEN_SET(type) (1ULL << (type))
+
 /* Token structure */
 typedef struct token {
-    char *name;
+    char *name;         // Name of an identifier, NULL for other tokens
     token_type type;
+    int value;          // Value of a number, interned ID of an identifier
 } token;
 
 /**
@@ -31,7 +37,8 @@ token_type string_to_token(char *str);
  * @brief Returns string representation of given token
  * 
  * @param token A token type to stringify
- * @return char* String representing the given token
+ * @return char* String representing the given token, "unknown" if it is
+ *  not a token type
  */
 char *token_to_string(token_type token);
 
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "token_list.h"
 #include "token.h"
 
@@ -12,7 +13,16 @@ token_list_t *create_token_list() {
     token_list_t * l = (token_list_t *)malloc(sizeof(token_list_t));
     l->capacity = DEFAULT_INITIAL_CAPACITY;
     l->size = 0;
-    l->tokens = (token *)malloc(sizeof(token) * l->capacity);
+    l->types = (uint8_t *)malloc(sizeof(uint8_t) * l->capacity);
+    l->payloads = (int *)malloc(sizeof(int) * l->capacity);
+
+    l->names_capacity = DEFAULT_INITIAL_CAPACITY;
+    l->num_names = 0;
+    l->names = (char **)malloc(sizeof(char *) * l->names_capacity);
+    // Kept at most half full
+    l->num_buckets = 2 * l->names_capacity;
+    l->name_buckets = (int *)malloc(sizeof(int) * l->num_buckets);
+    for (int b = 0; b < l->num_buckets; b++) l->name_buckets[b] = -1;
 
     return l;
 }
@@ -26,34 +36,178 @@ void ensure_capacity(token_list_t *l) {
     }
 
     l->capacity *= CAPACITY_MULTIPLIER;
-    l->tokens = (token *)realloc(l->tokens, sizeof(token) * l->capacity);
+    l->types = (uint8_t *)realloc(l->types, sizeof(uint8_t) * l->capacity);
+    l->payloads = (int *)realloc(l->payloads, sizeof(int) * l->capacity);
 
-    if (l->tokens == NULL) {
+    if (l->types == NULL || l->payloads == NULL) {
         fprintf(stderr, "ERROR: List reallocation failed\n");
         exit(EXIT_FAILURE);
     }
 }
 
-void add(token_list_t *l, token t) {
+void reserve_tokens(token_list_t *l, int count) {
+    if (l->size + count <= l->capacity) return;
+
+    l->capacity = l->size + count;
+    l->types = (uint8_t *)realloc(l->types, sizeof(uint8_t) * l->capacity);
+    l->payloads = (int *)realloc(l->payloads, sizeof(int) * l->capacity);
+
+    if (l->types == NULL || l->payloads == NULL) {
+        fprintf(stderr, "ERROR: List reallocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// 32 bit FNV-1a, whose low bits stay well mixed for similar names
+static uint32_t hash_name(char *name) {
+    uint32_t hash = 2166136261u;
+    for (; *name != '\0'; name++) {
+        hash ^= (unsigned char)*name;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Bucket holding the ID of name, or the empty bucket it would go in
+static int find_bucket(token_list_t *l, char *name) {
+    int b = (int)(hash_name(name) % (uint32_t)l->num_buckets);
+
+    while (l->name_buckets[b] != -1 &&
+        strcmp(l->names[l->name_buckets[b]], name) != 0) {
+        b = (b + 1) % l->num_buckets;
+    }
+    return b;
+}
+
+// Double the identifier capacity and rehash every name
+static void grow_names(token_list_t *l) {
+    l->names_capacity *= CAPACITY_MULTIPLIER;
+    l->names = (char **)realloc(l->names, sizeof(char *) * l->names_capacity);
+    free(l->name_buckets);
+    l->num_buckets = 2 * l->names_capacity;
+    l->name_buckets = (int *)malloc(sizeof(int) * l->num_buckets);
+
+    if (l->names == NULL || l->name_buckets == NULL) {
+        fprintf(stderr, "ERROR: List reallocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int b = 0; b < l->num_buckets; b++) l->name_buckets[b] = -1;
+    for (int id = 0; id < l->num_names; id++) {
+        l->name_buckets[find_bucket(l, l->names[id])] = id;
+    }
+}
+
+int intern_name(token_list_t *l, char *name) {
+    int b = find_bucket(l, name);
+    if (l->name_buckets[b] != -1) return l->name_buckets[b];
+
+    if (l->num_names == l->names_capacity) {
+        grow_names(l);
+        b = find_bucket(l, name);
+    }
+
+    int id = (l->num_names)++;
+    l->names[id] = (char *)malloc(strlen(name) + 1);
+    strcpy(l->names[id], name);
+    l->name_buckets[b] = id;
+    return id;
+}
+
+void add_token(token_list_t *l, token_type type, int payload) {
     ensure_capacity(l);
 
-    l->tokens[l->size] = t;
+    l->types[l->size] = (uint8_t)type;
+    l->payloads[l->size] = payload;
     l->size++;
 }
 
-token *get(token_list_t *l, int i) {
-    if (i < 0 || i >= l->size) return NULL; // Invalid index
-    return &(l->tokens[i]);
+void splice_tokens(token_list_t *l, int first, int removed,
+    token_list_t *inserted) {
+    int count = inserted->size;
+    int tail = l->size - first - removed;
+
+    // Grown geometrically, a run of insertions must not copy every time
+    if (l->size - removed + count > l->capacity) {
+        reserve_tokens(l, l->size + count);
+    }
+    memmove(&(l->types[first + count]), &(l->types[first + removed]),
+        sizeof(uint8_t) * tail);
+    memmove(&(l->payloads[first + count]), &(l->payloads[first + removed]),
+        sizeof(int) * tail);
+
+    for (int i = 0; i < count; i++) {
+        int payload = inserted->payloads[i];
+
+        if (inserted->types[i] == identsym) {
+            payload = intern_name(l, inserted->names[payload]);
+        }
+        l->types[first + i] = inserted->types[i];
+        l->payloads[first + i] = payload;
+    }
+    l->size += count - removed;
+}
+
+token_type get_token_type(token_list_t *l, int i) {
+    if (i < 0 || i >= l->size) return nulsym; // Invalid index
+    return (token_type)l->types[i];
+}
+
+token get_token(token_list_t *l, int i) {
+    token t = { NULL, get_token_type(l, i), 0 };
+
+    if (i < 0 || i >= l->size) return t; // Invalid index
+    t.value = l->payloads[i];
+    if (t.type == identsym) t.name = l->names[t.value];
+    return t;
+}
+
+token_list_t *read_token_list(FILE *in) {
+    token_list_t *l = create_token_list();
+    // Identifiers are at most 11 characters and numbers at most 5 digits
+    char buffer[32];
+    int type;
+
+    while (fscanf(in, "%d", &type) == 1) {
+        int payload = 0;
+
+        if (type < nulsym || type > readsym) {
+            fprintf(stderr, "ERROR: Invalid token type %d\n", type);
+            exit(EXIT_FAILURE);
+        }
+        if (type == identsym || type == numbersym) {
+            if (fscanf(in, "%31s", buffer) != 1) {
+                fprintf(stderr, "ERROR: Missing lexeme after token %d\n", type);
+                exit(EXIT_FAILURE);
+            }
+            payload = type == identsym ? intern_name(l, buffer) :
+                atoi(buffer);
+        }
+
+        add_token(l, (token_type)type, payload);
+    }
+
+    if (!feof(in)) {
+        fprintf(stderr, "ERROR: Malformed lexeme list\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Sentinel so the parser never reads past the end of the list
+    add_token(l, nulsym, 0);
+
+    return l;
 }
 
 token_list_t *free_token_list(token_list_t *l) {
-    // Free the string inside each token
-    for (int i = 0; i < l->size; i++) {
-        token *t = get(l, i);
-        free(t->name);
+    // Free the name of each identifier
+    for (int id = 0; id < l->num_names; id++) {
+        free(l->names[id]);
     }
-    // Free the tokens array
-    free(l->tokens);
+    // Free the arrays
+    free(l->names);
+    free(l->name_buckets);
+    free(l->types);
+    free(l->payloads);
     // Free the list itself
     free(l);
     return NULL;
@@ -14,13 +14,29 @@
 
 #include "token.h"
 
+#include <stdint.h>
+#include <stdio.h>
+
 extern const int DEFAULT_INITIAL_CAPACITY;
 extern const int CAPACITY_MULTIPLIER;
 
+/**
+ * @brief Tokens stored as parallel arrays
+ *
+ * Scanning for a token type only touches the dense types array. Payloads
+ * hold the value of numbers and the interned ID of identifiers, whose names
+ * are stored once per distinct identifier.
+ */
 typedef struct token_list_t {
-    token *tokens; // Dynamic array of tokens
+    uint8_t *types;         // Type of every token
+    int *payloads;          // Value or identifier ID of every token, else 0
     int size;
     int capacity;
+    char **names;           // Name of every identifier ID
+    int num_names;
+    int names_capacity;
+    int *name_buckets;      // Open addressing table of IDs, -1 if empty
+    int num_buckets;
 } token_list_t;
 
 /**
@@ -52,22 +68,90 @@ token_list_t *create_token_list();
  */
 void ensure_capacity(token_list_t *l);
 
+/**
+ * @brief Make room for a number of tokens beyond the list's size
+ *
+ * If the reallocation fails, an error will be logged to stderr and the
+ * program will exit with EXIT_FAILURE.
+ *
+ * @param l The list whose capacity to grow
+ * @param count Number of tokens that must fit after the current ones
+ */
+void reserve_tokens(token_list_t *l, int count);
+
+/**
+ * @brief Returns the ID of an identifier, interning it if it is new
+ *
+ * IDs are handed out from 0 in the order identifiers are first interned.
+ *
+ * @param l The list whose identifiers to look in
+ * @param name Name of the identifier, copied if it is new
+ * @return int ID of the identifier
+ */
+int intern_name(token_list_t *l, char *name);
+
 /**
  * @brief Add a token to the end of the list
  *
  * @param l The list to add to
- * @param t The token to add
+ * @param type Type of the token
+ * @param payload Value of a number, ID of an identifier, else 0
+ */
+void add_token(token_list_t *l, token_type type, int payload);
+
+/**
+ * @brief Replace a range of tokens with the tokens of another list
+ *
+ * Identifiers of the inserted tokens are interned into the list. Names no
+ * longer used by any token stay interned.
+ *
+ * If the reallocation fails, an error will be logged to stderr and the
+ * program will exit with EXIT_FAILURE.
+ *
+ * @param l The list to change
+ * @param first Index of the first token replaced
+ * @param removed Number of tokens replaced
+ * @param inserted Tokens put in their place, all of them
  */
-void add_token(token_list_t *l, token_list_t t);
+void splice_tokens(token_list_t *l, int first, int removed,
+    token_list_t *inserted);
+
+/**
+ * @brief Returns the type of the token at index i in the list
+ *
+ * @param l The list to look in
+ * @param i The index of the desired token
+ * @return token_type Type of the token, nulsym if i is out of range
+ */
+token_type get_token_type(token_list_t *l, int i);
 
 /**
  * @brief Returns the token at index i in the list
  *
+ * The name of an identifier points into the list and lives as long as it.
+ *
  * @param l The list to look in
  * @param i The index of the desired token
- * @return token* A pointer to the desired token
+ * @return token The token, a nulsym token if i is out of range
+ */
+token get_token(token_list_t *l, int i);
+
+/**
+ * @brief Read a lexeme list produced by the lexical analyzer
+ *
+ * The lexeme list is a whitespace separated sequence of token types, where
+ * identsym is followed by the identifier name and numbersym is followed by
+ * the literal. For example: "29 2 x 18 21 2 x 20 3 5 22 19"
+ *
+ * A nulsym token is appended as an end of input marker.
+ *
+ * If the input is malformed, an error is logged to stderr and the program
+ * is exited with EXIT_FAILURE.
+ *
+ * @param in Stream to read the lexemes from
+ * @return token_list_t* The list of tokens read, to be freed by the caller
  */
-token *get_token(token_list_t *l, int i);
+token_list_t *read_token_list(FILE *in);
 
 /**
  * @brief Frees the list and its components
@@ -0,0 +1,153 @@
+#include "verify.h"
+#include "vm.h"
+
+// Shift amounts the machine computes without undefined behavior
+#define MAX_SHIFT 31
+
+static bool is_register(int r) {
+    return r >= 0 && r < NUM_REGISTERS;
+}
+
+// Whether the instruction reads and writes registers in all three fields
+static bool uses_three_registers(opcode op) {
+    return (op >= ADD && op <= MOD && op != ODD) ||
+        (op >= EQL && op <= GEQ) || op == MULH;
+}
+
+static bool is_jump(opcode op) {
+    return op == JMP || op == JPC || op == CAL;
+}
+
+// Highest register an instruction names, -1 if it names none
+static int highest_register(cg_instruction *instruction) {
+    opcode op = instruction->op;
+    int highest = instruction->regiser_num;
+
+    if (op == RTN || op == CAL || op == INC || op == JMP || op == SIO_END)
+        return -1;
+    if (uses_three_registers(op) || op == SHL || op == SHR) {
+        if (instruction->lex_level > highest) highest = instruction->lex_level;
+    }
+    if (uses_three_registers(op) && instruction->modifier > highest) {
+        highest = instruction->modifier;
+    }
+    return highest;
+}
+
+bool check_instruction(cg_instruction *instruction, int code_size) {
+    opcode op = instruction->op;
+
+    if (op < LIT || op >= NUM_OPCODES) return false;
+
+    if (highest_register(instruction) >= 0) {
+        if (!is_register(instruction->regiser_num)) return false;
+        if ((uses_three_registers(op) || op == SHL || op == SHR) &&
+            !is_register(instruction->lex_level)) return false;
+        if (uses_three_registers(op) && !is_register(instruction->modifier))
+            return false;
+    }
+
+    if (is_jump(op)) {
+        return instruction->modifier >= 0 && instruction->modifier < code_size;
+    }
+    if (op == SHL || op == SHR) {
+        return instruction->modifier >= 0 && instruction->modifier <= MAX_SHIFT;
+    }
+    return true;
+}
+
+static bool fail(verification_t *result, int index, char *error) {
+    result->verified = false;
+    result->error_index = index;
+    result->error = error;
+    return false;
+}
+
+bool verify_program(verification_t *result, code_generator_t *generator) {
+    cg_instruction *code = generator->code;
+    int code_size = generator->code_size;
+    // Stack depth above the base pointer before each instruction runs
+    int depth[MAX_CODE_LENGTH];
+    int worklist[MAX_CODE_LENGTH];
+    int num_pending = 0;
+
+    result->verified = true;
+    result->max_register = -1;
+    result->max_stack = 0;
+    result->error_index = -1;
+    result->error = NULL;
+
+    if (code_size == 0) return fail(result, -1, "Program is empty.");
+
+    for (int i = 0; i < code_size; i++) {
+        if (!check_instruction(&code[i], code_size)) {
+            return fail(result, i, "Invalid operand.");
+        }
+        if (code[i].op == CAL || code[i].op == RTN) {
+            return fail(result, i, "Calls are checked at run time.");
+        }
+
+        int highest = highest_register(&code[i]);
+        if (highest > result->max_register) result->max_register = highest;
+        depth[i] = -1;
+    }
+
+    // Walk every path from the first instruction, which starts on an empty
+    // stack
+    depth[0] = 0;
+    worklist[num_pending++] = 0;
+    while (num_pending > 0) {
+        int i = worklist[--num_pending];
+        cg_instruction *c = &code[i];
+        int after = depth[i];
+        int successors[2];
+        int num_successors = 0;
+
+        switch (c->op) {
+            case INC:
+                if (c->modifier < 0 ||
+                    depth[i] + c->modifier >= MAX_STACK_HEIGHT) {
+                    return fail(result, i, "Stack overflow.");
+                }
+                after += c->modifier;
+                if (after > result->max_stack) result->max_stack = after;
+                successors[num_successors++] = i + 1;
+                break;
+            case LOD:
+            case STO:
+                // Only the current frame exists without calls
+                if (c->lex_level != 0 || c->modifier < 0 ||
+                    c->modifier >= depth[i]) {
+                    return fail(result, i, "Address outside of the frame.");
+                }
+                successors[num_successors++] = i + 1;
+                break;
+            case JMP:
+                successors[num_successors++] = c->modifier;
+                break;
+            case JPC:
+                successors[num_successors++] = i + 1;
+                successors[num_successors++] = c->modifier;
+                break;
+            case SIO_END:
+                break;
+            default:
+                successors[num_successors++] = i + 1;
+        }
+
+        for (int s = 0; s < num_successors; s++) {
+            int next = successors[s];
+
+            if (next >= code_size) {
+                return fail(result, i, "Runs past the end of the program.");
+            }
+            if (depth[next] == -1) {
+                depth[next] = after;
+                worklist[num_pending++] = next;
+            } else if (depth[next] != after) {
+                return fail(result, next, "Stack depth differs between paths.");
+            }
+        }
+    }
+    return true;
+}
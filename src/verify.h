@@ -0,0 +1,55 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+/**
+ * @file verify.h
+ * @brief Static checks proving generated code cannot leave the machine
+ *
+ * A verified program only names registers inside of the register file, only
+ * jumps to instructions inside of the program, never runs past its last
+ * instruction, and only loads and stores addresses inside of the space its
+ * INC instructions reserved. Such a program can run without the bounds
+ * checks the virtual machine otherwise performs on every instruction.
+ *
+ * The stack depth has to be the same on every path reaching an instruction.
+ * Programs that call procedures are never verified, since the depth of the
+ * stack they reach depends on how deep calls nest at run time.
+ *
+ */
+
+#include "codegen.h"
+
+#include <stdbool.h>
+
+typedef struct verification_t {
+    bool verified;
+    int max_register;   // Highest register named, -1 if none
+    int max_stack;      // Highest stack address reserved by INC
+    int error_index;    // Instruction that failed verification, or -1
+    char *error;        // Why verification failed, NULL if verified
+} verification_t;
+
+/**
+ * @brief Whether the operands of an instruction are well formed
+ *
+ * Checks the opcode, that every register operand is inside of the register
+ * file, that jump targets are inside of the program and that shift amounts
+ * are below 32. Does not check stack addresses, which depend on where the
+ * instruction runs.
+ *
+ * @param instruction The instruction to check
+ * @param code_size Number of instructions in the program
+ * @return bool Whether the instruction is well formed
+ */
+bool check_instruction(cg_instruction *instruction, int code_size);
+
+/**
+ * @brief Verify the code held by a generator
+ *
+ * @param result Set to the outcome, and the register and stack bounds found
+ * @param generator Generator holding the program's code
+ * @return bool Whether the program was verified
+ */
+bool verify_program(verification_t *result, code_generator_t *generator);
+
+#endif /* VERIFY_H */
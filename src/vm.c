@@ -0,0 +1,578 @@
+#include "vm.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The checked and the unchecked path each get their own copy of the
+// interpreter, with every check folded away in the unchecked one
+#ifdef __GNUC__
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+/**
+ * @brief Fused sequence the loader looks for
+ */
+typedef struct superinstruction_pattern {
+    superinstruction flag;
+    char *name;
+    int length;
+    opcode ops[3];
+} superinstruction_pattern;
+
+// Longer patterns come first so they win over their own prefixes
+superinstruction_pattern superinstruction_patterns[NUM_SUPERINSTRUCTIONS] = {
+    { SUPER_LOD_LOD_ADD, "LOD_LOD_ADD", 3, { LOD, LOD, ADD } },
+    { SUPER_LOD_LIT_ADD, "LOD_LIT_ADD", 3, { LOD, LIT, ADD } },
+    { SUPER_LIT_ADD, "LIT_ADD", 2, { LIT, ADD } },
+    { SUPER_LIT_SUB, "LIT_SUB", 2, { LIT, SUB } },
+    { SUPER_LOD_STO, "LOD_STO", 2, { LOD, STO } },
+    { SUPER_LIT_STO, "LIT_STO", 2, { LIT, STO } }
+};
+
+// Stop the machine, the error is reported by whoever runs it
+static void vm_error(vm_t *vm, char *message) {
+    vm->error = message;
+    vm->halted = true;
+}
+
+void init_vm(vm_t *vm) {
+    memset(vm->stack, 0, sizeof(vm->stack));
+    memset(vm->registers, 0, sizeof(vm->registers));
+    vm->code_size = 0;
+    vm->verification.verified = false;
+    vm->sp = 0;
+    vm->bp = 1;
+    vm->pc = 0;
+    vm->use_display = false;
+    vm->level = 0;
+    vm->display[0] = vm->bp;
+    vm->call_depth = 0;
+    vm->links_followed = 0;
+    vm->halted = false;
+    vm->dispatches = 0;
+    vm->instructions = 0;
+    vm->tiering_threshold = 0;
+    memset(vm->back_edges, 0, sizeof(vm->back_edges));
+    memset(vm->native, 0, sizeof(vm->native));
+    vm->num_compiled = 0;
+    vm->native_entries = 0;
+    vm->queued = false;
+    vm->input_queue = NULL;
+    vm->queue_length = 0;
+    vm->queue_capacity = 0;
+    vm->queue_cursor = 0;
+    vm->input_closed = false;
+    vm->waiting = false;
+    vm->error = NULL;
+    set_vm_io(vm, standard_input(), stdout, IO_TEXT);
+}
+
+input_buffer_t *standard_input(void) {
+    static input_buffer_t buffer;
+    static bool initialized = false;
+
+    if (!initialized) {
+        init_input_buffer(&buffer, stdin, IO_TEXT, NULL);
+        initialized = true;
+    }
+    return &buffer;
+}
+
+void set_vm_io(vm_t *vm, input_buffer_t *input, FILE *output,
+    io_format format) {
+    init_output_buffer(&(vm->output), output, format);
+    vm->input = input;
+    // Prompts written before a read show up before it blocks
+    if (input != NULL) input->tied = &(vm->output);
+}
+
+void free_vm(vm_t *vm) {
+    free_output_buffer(&(vm->output));
+    if (vm->input != NULL && vm->input->tied == &(vm->output)) {
+        vm->input->tied = NULL;
+    }
+    free(vm->input_queue);
+    vm->input_queue = NULL;
+}
+
+void queue_input(vm_t *vm, int *values, int count) {
+    vm->queued = true;
+    if (count == 0) return;
+
+    if (vm->queue_length + count > vm->queue_capacity) {
+        int capacity = vm->queue_capacity > 0 ? vm->queue_capacity * 2 : 16;
+        while (capacity < vm->queue_length + count) capacity *= 2;
+
+        int *queue = (int *)realloc(vm->input_queue, sizeof(int) * capacity);
+        if (queue == NULL) {
+            fprintf(stderr, "Could not allocate the input queue\n");
+            exit(EXIT_FAILURE);
+        }
+        vm->input_queue = queue;
+        vm->queue_capacity = capacity;
+    }
+
+    memcpy(&(vm->input_queue[vm->queue_length]), values, sizeof(int) * count);
+    vm->queue_length += count;
+}
+
+void close_input(vm_t *vm) {
+    vm->queued = true;
+    vm->input_closed = true;
+}
+
+void enable_display(vm_t *vm) {
+    vm->use_display = true;
+}
+
+void enable_tiering(vm_t *vm, int threshold) {
+    vm->tiering_threshold = threshold;
+}
+
+int string_to_superinstruction(char *name) {
+    for (int i = 0; i < NUM_SUPERINSTRUCTIONS; i++) {
+        if (strcmp(name, superinstruction_patterns[i].name) == 0) {
+            return superinstruction_patterns[i].flag;
+        }
+    }
+    return SUPER_NONE;
+}
+
+static bool is_jump(opcode op) {
+    return op == JMP || op == JPC || op == CAL;
+}
+
+// Whether the pattern can be fused starting at instruction start
+static bool pattern_matches(vm_t *vm, superinstruction_pattern *p, int start,
+    bool *is_target) {
+    if (start + p->length > vm->code_size) return false;
+
+    for (int k = 0; k < p->length; k++) {
+        if (vm->code[start + k].op != p->ops[k]) return false;
+        // Jumping into the middle would skip the fused head
+        if (k > 0 && is_target[start + k]) return false;
+    }
+    return true;
+}
+
+void load_program(vm_t *vm, code_generator_t *generator,
+    int superinstructions) {
+    bool is_target[MAX_CODE_LENGTH] = { false };
+
+    vm->code_size = generator->code_size;
+    verify_program(&(vm->verification), generator);
+    for (int i = 0; i < vm->code_size; i++) {
+        vm->code[i] = generator->code[i];
+        vm->handler[i] = vm->code[i].op;
+
+        int target = vm->code[i].modifier;
+        if (is_jump(vm->code[i].op) && target >= 0 && target < MAX_CODE_LENGTH)
+            is_target[target] = true;
+    }
+
+    for (int i = 0; i < vm->code_size; i++) {
+        for (int p = 0; p < NUM_SUPERINSTRUCTIONS; p++) {
+            superinstruction_pattern *pattern = &superinstruction_patterns[p];
+
+            if (!(superinstructions & pattern->flag)) continue;
+            if (!pattern_matches(vm, pattern, i, is_target)) continue;
+
+            // Superinstructions dispatch after the regular opcodes
+            vm->handler[i] = NUM_OPCODES + p;
+            i += pattern->length - 1;
+            break;
+        }
+    }
+}
+
+// Find the base pointer l lexicographical levels down
+static int base(vm_t *vm, int l) {
+    if (vm->use_display) return vm->display[vm->level - l];
+
+    int b = vm->bp;
+    vm->links_followed += l;
+    while (l > 0) {
+        b = vm->stack[b + 1];
+        l--;
+    }
+    return b;
+}
+
+// Stack address a LOD or STO accesses, or -1 if checked and out of bounds
+static ALWAYS_INLINE int stack_address(vm_t *vm, cg_instruction *i,
+    const bool checked) {
+    if (!checked) return base(vm, i->lex_level) + i->modifier;
+
+    int b = vm->bp;
+    if (vm->use_display) {
+        if (i->lex_level < 0 || i->lex_level > vm->level) return -1;
+        b = vm->display[vm->level - i->lex_level];
+    } else {
+        vm->links_followed += i->lex_level;
+        for (int l = i->lex_level; l > 0; l--) {
+            if (b < 0 || b + 1 > vm->sp) return -1;
+            b = vm->stack[b + 1];
+        }
+    }
+    int address = b + i->modifier;
+    return address >= 1 && address <= vm->sp ? address : -1;
+}
+
+// Enter the frame a CAL made for a procedure declared l levels down,
+// pointing the display at it. Returns false if the level is out of range.
+static bool enter_frame(vm_t *vm, int l) {
+    int level = vm->level - l + 1;
+    int depth = (vm->call_depth)++;
+
+    if (level < 1 || level >= MAX_LEXI_LEVELS) return false;
+
+    vm->saved_display[depth] = vm->display[level];
+    vm->saved_level[depth] = vm->level;
+    vm->display[level] = vm->bp;
+    vm->level = level;
+    return true;
+}
+
+// Restore the level and display entry of the caller
+static void leave_frame(vm_t *vm) {
+    int depth = --(vm->call_depth);
+
+    vm->display[vm->level] = vm->saved_display[depth];
+    vm->level = vm->saved_level[depth];
+}
+
+static void exec_lit(vm_t *vm, cg_instruction *i) {
+    vm->registers[i->regiser_num] = i->modifier;
+}
+
+static ALWAYS_INLINE void exec_lod(vm_t *vm, cg_instruction *i,
+    const bool checked) {
+    int address = stack_address(vm, i, checked);
+
+    if (checked && address < 0) {
+        vm_error(vm, "Stack access out of bounds.");
+        return;
+    }
+    vm->registers[i->regiser_num] = vm->stack[address];
+}
+
+static ALWAYS_INLINE void exec_sto(vm_t *vm, cg_instruction *i,
+    const bool checked) {
+    int address = stack_address(vm, i, checked);
+
+    if (checked && address < 0) {
+        vm_error(vm, "Stack access out of bounds.");
+        return;
+    }
+    vm->stack[address] = vm->registers[i->regiser_num];
+}
+
+// Arithmetic wraps around through unsigned instead of overflowing
+static void exec_add(vm_t *vm, cg_instruction *i) {
+    vm->registers[i->regiser_num] =
+        (int)((unsigned int)vm->registers[i->lex_level] +
+        (unsigned int)vm->registers[i->modifier]);
+}
+
+static void exec_sub(vm_t *vm, cg_instruction *i) {
+    vm->registers[i->regiser_num] =
+        (int)((unsigned int)vm->registers[i->lex_level] -
+        (unsigned int)vm->registers[i->modifier]);
+}
+
+// Dividing by -1 negates, so INT_MIN / -1 wraps around to INT_MIN with no
+// remainder instead of trapping
+static int divide(int a, int b) {
+    return b == -1 ? (int)(0u - (unsigned int)a) : a / b;
+}
+
+static int modulo(int a, int b) {
+    return b == -1 ? 0 : a % b;
+}
+
+// Executes a regular instruction, returns the number of instructions retired.
+// Unless checked, the program must have been verified.
+static ALWAYS_INLINE int exec_instruction(vm_t *vm, cg_instruction *i,
+    const bool checked) {
+    int *r = vm->registers;
+
+    if (checked && !check_instruction(i, vm->code_size)) {
+        vm_error(vm, "Invalid instruction.");
+        return 0;
+    }
+
+    // Jumps overwrite this
+    vm->pc++;
+
+    switch (i->op) {
+        case LIT:
+            exec_lit(vm, i);
+            break;
+        case RTN:
+            if (checked && (vm->bp < 1 || vm->bp + 3 >= MAX_STACK_HEIGHT)) {
+                vm_error(vm, "Stack access out of bounds.");
+                break;
+            }
+            // Returning from the main program leaves no frame
+            if (vm->call_depth > 0) leave_frame(vm);
+            vm->sp = vm->bp - 1;
+            vm->bp = vm->stack[vm->sp + 3];
+            vm->pc = vm->stack[vm->sp + 4];
+            break;
+        case LOD:
+            exec_lod(vm, i, checked);
+            break;
+        case STO:
+            exec_sto(vm, i, checked);
+            break;
+        case CAL:
+            if (vm->sp + 4 >= MAX_STACK_HEIGHT ||
+                vm->call_depth == MAX_CALL_DEPTH) {
+                vm_error(vm, "Stack overflow.");
+                break;
+            }
+            if (checked && (i->lex_level < 0 || i->lex_level > vm->level)) {
+                vm_error(vm, "Call from an invalid level.");
+                break;
+            }
+            vm->stack[vm->sp + 1] = 0;                          // FV
+            vm->stack[vm->sp + 2] = base(vm, i->lex_level);     // SL
+            vm->stack[vm->sp + 3] = vm->bp;                     // DL
+            vm->stack[vm->sp + 4] = vm->pc;                     // RA
+            vm->bp = vm->sp + 1;
+            vm->pc = i->modifier;
+            if (!enter_frame(vm, i->lex_level)) {
+                vm_error(vm, "Procedures nested too deeply.");
+            }
+            break;
+        case INC:
+            if (checked && vm->sp + i->modifier >= MAX_STACK_HEIGHT) {
+                vm_error(vm, "Stack overflow.");
+                break;
+            }
+            vm->sp += i->modifier;
+            break;
+        case JMP:
+            vm->pc = i->modifier;
+            break;
+        case JPC:
+            if (r[i->regiser_num] == 0) vm->pc = i->modifier;
+            break;
+        case SIO_WRITE:
+            write_buffered_int(&(vm->output), r[i->regiser_num]);
+            break;
+        case SIO_READ:
+            if (!vm->queued) {
+                if (!read_buffered_int(vm->input, &r[i->regiser_num]))
+                    vm_error(vm, "Expected an integer on input.");
+            } else if (vm->queue_cursor < vm->queue_length) {
+                r[i->regiser_num] = vm->input_queue[(vm->queue_cursor)++];
+            } else if (vm->input_closed) {
+                vm_error(vm, "Expected an integer on input.");
+            } else {
+                // Run the read again once there is input
+                vm->waiting = true;
+                vm->pc--;
+                return 0;
+            }
+            break;
+        case SIO_END:
+            vm->halted = true;
+            break;
+        case NEG:
+            r[i->regiser_num] = (int)(0u - (unsigned int)r[i->regiser_num]);
+            break;
+        case ADD:
+            exec_add(vm, i);
+            break;
+        case SUB:
+            exec_sub(vm, i);
+            break;
+        case MUL:
+            r[i->regiser_num] = (int)((unsigned int)r[i->lex_level] *
+                (unsigned int)r[i->modifier]);
+            break;
+        case DIV:
+            if (r[i->modifier] == 0) {
+                vm_error(vm, "Division by zero.");
+                break;
+            }
+            r[i->regiser_num] = divide(r[i->lex_level], r[i->modifier]);
+            break;
+        case ODD:
+            r[i->regiser_num] = r[i->regiser_num] % 2;
+            break;
+        case MOD:
+            if (r[i->modifier] == 0) {
+                vm_error(vm, "Division by zero.");
+                break;
+            }
+            r[i->regiser_num] = modulo(r[i->lex_level], r[i->modifier]);
+            break;
+        case EQL:
+            r[i->regiser_num] = r[i->lex_level] == r[i->modifier];
+            break;
+        case NEQ:
+            r[i->regiser_num] = r[i->lex_level] != r[i->modifier];
+            break;
+        case LSS:
+            r[i->regiser_num] = r[i->lex_level] < r[i->modifier];
+            break;
+        case LEQ:
+            r[i->regiser_num] = r[i->lex_level] <= r[i->modifier];
+            break;
+        case GTR:
+            r[i->regiser_num] = r[i->lex_level] > r[i->modifier];
+            break;
+        case GEQ:
+            r[i->regiser_num] = r[i->lex_level] >= r[i->modifier];
+            break;
+        case SHL:
+            // Shift as unsigned, shifting a negative value left is undefined
+            r[i->regiser_num] = (int)((unsigned int)r[i->lex_level]
+                << i->modifier);
+            break;
+        case SHR:
+            r[i->regiser_num] = r[i->lex_level] >> i->modifier;
+            break;
+        case MULH:
+            r[i->regiser_num] = (int)(((long long)r[i->lex_level]
+                * r[i->modifier]) >> 32);
+            break;
+        default:
+            vm_error(vm, "Invalid opcode.");
+    }
+    return 1;
+}
+
+// Executes the superinstruction at pc, returns the instructions retired
+static ALWAYS_INLINE int exec_superinstruction(vm_t *vm, int handler,
+    const bool checked) {
+    cg_instruction *i = &(vm->code[vm->pc]);
+    superinstruction_pattern *p =
+        &superinstruction_patterns[handler - NUM_OPCODES];
+
+    for (int k = 0; checked && k < p->length; k++) {
+        if (!check_instruction(&i[k], vm->code_size)) {
+            vm_error(vm, "Invalid instruction.");
+            return 0;
+        }
+    }
+
+    switch (p->flag) {
+        case SUPER_LOD_LOD_ADD:
+            exec_lod(vm, &i[0], checked);
+            exec_lod(vm, &i[1], checked);
+            exec_add(vm, &i[2]);
+            break;
+        case SUPER_LOD_LIT_ADD:
+            exec_lod(vm, &i[0], checked);
+            exec_lit(vm, &i[1]);
+            exec_add(vm, &i[2]);
+            break;
+        case SUPER_LIT_ADD:
+            exec_lit(vm, &i[0]);
+            exec_add(vm, &i[1]);
+            break;
+        case SUPER_LIT_SUB:
+            exec_lit(vm, &i[0]);
+            exec_sub(vm, &i[1]);
+            break;
+        case SUPER_LOD_STO:
+            exec_lod(vm, &i[0], checked);
+            exec_sto(vm, &i[1], checked);
+            break;
+        case SUPER_LIT_STO:
+            exec_lit(vm, &i[0]);
+            exec_sto(vm, &i[1], checked);
+            break;
+    }
+
+    vm->pc += p->length;
+    return p->length;
+}
+
+// Count a backward jump from source, compiling its loop once it is hot
+static void count_back_edge(vm_t *vm, int source) {
+    int header = vm->pc;
+
+    if (++(vm->back_edges[header]) != vm->tiering_threshold) return;
+
+    vm->native[header] = compile_native_loop(vm->code, vm->code_size, header,
+        source + 1);
+    if (vm->native[header] != NULL) (vm->num_compiled)++;
+}
+
+void run_vm(vm_t *vm) {
+    run_vm_budget(vm, LONG_MAX);
+
+    if (vm->error != NULL) {
+        fprintf(stderr, "VM Error: %s\n", vm->error);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Run until the machine halts, waits or the budget runs out
+static ALWAYS_INLINE vm_status run_instructions(vm_t *vm, long budget,
+    const bool checked) {
+    while (!vm->halted) {
+        if (budget <= 0) return VM_PREEMPTED;
+
+        if (checked && (vm->pc < 0 || vm->pc >= vm->code_size)) {
+            vm_error(vm, "Program counter out of bounds.");
+            break;
+        }
+
+        if (vm->native[vm->pc] != NULL) {
+            int header = vm->pc;
+            long retired = 0;
+            vm->pc = vm->native[header](vm->registers, vm->stack, &(vm->sp),
+                &(vm->bp), &retired, budget);
+            (vm->native_entries)++;
+            vm->instructions += retired;
+            budget -= retired;
+            // A loop whose header is left to the interpreter hands it right
+            // back, which has to be run here before entering the loop again
+            if (vm->pc != header) continue;
+        }
+
+        int pc = vm->pc;
+        int handler = vm->handler[pc];
+        int retired;
+        if (handler < NUM_OPCODES) {
+            retired = exec_instruction(vm, &(vm->code[pc]), checked);
+        } else {
+            retired = exec_superinstruction(vm, handler, checked);
+        }
+        if (vm->waiting) return VM_WAITING;
+
+        vm->instructions += retired;
+        vm->dispatches++;
+        budget -= retired;
+
+        // Native code is unchecked, only verified programs may tier up
+        if (!checked && vm->tiering_threshold > 0 && vm->pc <= pc &&
+            (vm->code[pc].op == JMP || vm->code[pc].op == JPC)) {
+            count_back_edge(vm, pc);
+        }
+    }
+    return VM_HALTED;
+}
+
+vm_status run_vm_budget(vm_t *vm, long budget) {
+    vm_status status;
+
+    vm->waiting = false;
+    if (vm->verification.verified) {
+        status = run_instructions(vm, budget, false);
+    } else {
+        status = run_instructions(vm, budget, true);
+    }
+
+    if (status == VM_HALTED) flush_output_buffer(&(vm->output));
+    return status;
+}
@@ -0,0 +1,241 @@
+#ifndef VM_H
+#define VM_H
+
+/**
+ * @file vm.h
+ * @brief P-machine (HW1) interpreter for code produced by the code generator
+ *
+ * The interpreter can fuse common instruction sequences into
+ * superinstructions when a program is loaded. A superinstruction performs
+ * every effect of the instructions it replaces, but only costs a single
+ * dispatch.
+ *
+ * Programs are verified when they are loaded. Verified programs run on a
+ * path without bounds checks, any other program on a path that checks the
+ * operands of every instruction it executes, the program counter and every
+ * stack access.
+ *
+ */
+
+#include "codegen.h"
+#include "iobuf.h"
+#include "jit.h"
+#include "verify.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#define MAX_STACK_HEIGHT 2000
+// Every frame takes at least FV, SL, DL and RA
+#define MAX_CALL_DEPTH (MAX_STACK_HEIGHT / 4)
+
+/**
+ * @brief Superinstructions the interpreter knows how to execute
+ *
+ * Values are bit flags, so a set of enabled superinstructions can be passed
+ * around as a mask.
+ */
+typedef enum superinstruction {
+    SUPER_LOD_LOD_ADD = 1 << 0, // Operands of a binary add
+    SUPER_LOD_LIT_ADD = 1 << 1, // Variable plus constant
+    SUPER_LIT_ADD = 1 << 2,     // Constant added to previous result
+    SUPER_LIT_SUB = 1 << 3,     // Constant subtracted from previous result
+    SUPER_LOD_STO = 1 << 4,     // Copy of one variable into another
+    SUPER_LIT_STO = 1 << 5      // Constant assignment
+} superinstruction;
+
+#define NUM_SUPERINSTRUCTIONS 6
+#define SUPER_NONE 0
+#define SUPER_ALL ((1 << NUM_SUPERINSTRUCTIONS) - 1)
+
+/**
+ * @brief Why run_vm_budget returned
+ */
+typedef enum vm_status {
+    VM_HALTED = 0,  // The program ended or stopped with an error
+    VM_PREEMPTED,   // The instruction budget ran out
+    VM_WAITING      // SIO_READ found the input queue empty
+} vm_status;
+
+typedef struct vm_t {
+    cg_instruction code[MAX_CODE_LENGTH];
+    int handler[MAX_CODE_LENGTH];   // Opcode or superinstruction to dispatch
+    int code_size;
+    verification_t verification;    // Outcome of verifying the program
+    int stack[MAX_STACK_HEIGHT];
+    int registers[NUM_REGISTERS];
+    int sp;                         // Stack pointer
+    int bp;                         // Base pointer
+    int pc;                         // Program counter
+    bool use_display;               // Whether frames are found by display
+    int level;                      // Lexicographical level of the frame at bp
+    int display[MAX_LEXI_LEVELS];   // Latest frame of every level, up to level
+    int saved_display[MAX_CALL_DEPTH];  // Display entry each call replaced
+    int saved_level[MAX_CALL_DEPTH];    // Level each call was made from
+    int call_depth;
+    long links_followed;            // Static links walked to reach frames
+    bool halted;
+    long dispatches;                // Handlers executed
+    long instructions;              // Original instructions retired
+    int tiering_threshold;          // Back edges before compiling, 0 if off
+    int back_edges[MAX_CODE_LENGTH];    // Times each loop header was jumped to
+    native_loop native[MAX_CODE_LENGTH];    // Compiled loop at each header
+    int num_compiled;               // Loops compiled so far
+    long native_entries;            // Times compiled loops were entered
+    input_buffer_t *input;          // Read by SIO_READ unless input is queued
+    output_buffer_t output;         // Written by SIO_WRITE
+    bool queued;                    // Whether SIO_READ reads the queue
+    int *input_queue;               // Values queued for SIO_READ
+    int queue_length;
+    int queue_capacity;
+    int queue_cursor;               // Next queued value to read
+    bool input_closed;              // Whether no more values will be queued
+    bool waiting;                   // Suspended in SIO_READ
+    char *error;                    // Why the machine stopped, NULL if none
+} vm_t;
+
+/**
+ * @brief Initialize a virtual machine with an empty program
+ *
+ * The machine reads text from stdin through standard_input, and writes text
+ * to stdout.
+ *
+ * @param vm The virtual machine to initialize
+ */
+void init_vm(vm_t *vm);
+
+/**
+ * @brief Returns the input buffer over stdin shared by virtual machines
+ *
+ * Machines run one after another share the buffer, so input read ahead by
+ * one machine is left for the next.
+ *
+ * @return input_buffer_t* The buffer, reading text
+ */
+input_buffer_t *standard_input(void);
+
+/**
+ * @brief Set where SIO_READ and SIO_WRITE read and write
+ *
+ * Output is buffered and flushed when the buffer is full, before waiting 
+ * for input and when the machine halts.
+ *
+ * @param vm The virtual machine to set the streams of
+ * @param input Buffer values are read from, NULL if input will be queued
+ * @param output Stream values are written to
+ * @param format Whether values are written as text or raw 32 bit integers
+ */
+void set_vm_io(vm_t *vm, input_buffer_t *input, FILE *output,
+    io_format format);
+
+/**
+ * @brief Flushes the output and frees the buffers of a virtual machine
+ *
+ * @param vm The virtual machine to free
+ */
+void free_vm(vm_t *vm);
+
+/**
+ * @brief Feed values to SIO_READ through the machine's input queue
+ *
+ * The machine stops reading its input stream. An SIO_READ finding the queue
+ * empty suspends the machine until more values are queued, or fails once
+ * the input was closed.
+ *
+ * @param vm The virtual machine to feed
+ * @param values Values to append to the queue
+ * @param count Number of values
+ */
+void queue_input(vm_t *vm, int *values, int count);
+
+/**
+ * @brief Mark that no more values will be queued
+ *
+ * @param vm The virtual machine whose input to close
+ */
+void close_input(vm_t *vm);
+
+/**
+ * @brief Copy a generated program into the virtual machine
+ *
+ * Sequences matching an enabled superinstruction are fused, as long as no
+ * jump lands inside of the sequence. The program is verified, which decides
+ * whether it runs with bounds checks.
+ *
+ * @param vm The virtual machine to load into
+ * @param generator Generator holding the program's code
+ * @param superinstructions Mask of enabled superinstructions
+ */
+void load_program(vm_t *vm, code_generator_t *generator,
+    int superinstructions);
+
+/**
+ * @brief Address the frames of other procedures through a display
+ *
+ * Without a display, a LOD or STO l levels down follows l static links. The
+ * display holds the base of the latest frame of every lexicographical level
+ * instead, so reaching any frame takes a single lookup. CAL points the
+ * display at the new frame and RTN restores the entry it replaced, whether
+ * or not the display is enabled. Frames still hold their static link, so 
+ * code compiled to native code, which follows links, runs unchanged.
+ *
+ * @param vm The virtual machine to enable the display on
+ */
+void enable_display(vm_t *vm);
+
+/**
+ * @brief Compile hot loops into native code while running
+ *
+ * Every backward JMP or JPC taken counts against the instruction it jumps 
+ * to. Once a loop header has been jumped back to threshold times, the 
+ * instructions from the header through the backward jump are compiled by 
+ * the host C compiler, and the loop runs natively whenever the interpreter 
+ * reaches its header again. Registers and the stack are handed over as 
+ * they are, and control returns to the interpreter when the loop exits.
+ *
+ * Instructions run natively count as retired instructions and against the
+ * budget, at whose end a compiled loop returns at its next backward jump,
+ * but not as dispatches. Compiled loops leave SIO_READ and SIO_WRITE to the
+ * interpreter.
+ * If compiling fails, the loop keeps being interpreted. Native code does
+ * no bounds checks, so loops of programs that were not verified are never
+ * compiled.
+ *
+ * @param vm The virtual machine to enable tiering on
+ * @param threshold Back edges before a loop is compiled, 0 to disable
+ */
+void enable_tiering(vm_t *vm, int threshold);
+
+/**
+ * @brief Execute the loaded program until it halts
+ *
+ * If the program stops with an error, the error is logged to stderr and the
+ * process exits with EXIT_FAILURE.
+ *
+ * @param vm The virtual machine to run
+ */
+void run_vm(vm_t *vm);
+
+/**
+ * @brief Execute the loaded program for a limited number of instructions
+ *
+ * The machine can be run again to continue where it stopped. Errors halt the
+ * machine and are left in vm->error instead of ending the process.
+ *
+ * @param vm The virtual machine to run
+ * @param budget Instructions to retire before returning, at least
+ * @return vm_status Why the machine stopped
+ */
+vm_status run_vm_budget(vm_t *vm, long budget);
+
+/**
+ * @brief Returns the superinstruction with the given name
+ *
+ * Names are the fused mnemonics joined with underscores, e.g. "LOD_STO"
+ *
+ * @param name Name of the superinstruction
+ * @return int The superinstruction flag, or SUPER_NONE if unknown
+ */
+int string_to_superinstruction(char *name);
+
+#endif /* VM_H */